@@ -0,0 +1,113 @@
+// Compares message routing through MessageRouter with the old linear walk,
+// where every handler checks every command it knows with getCommandArguments
+
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "messagerouter.h"
+#include "handlers/lemonhandler.h"
+#include "handlers/util/stringops.h"
+
+class BenchHandler : public LemonHandler
+{
+public:
+	BenchHandler(const std::string &name, const std::set<std::string> &commands)
+		: LemonHandler(name, nullptr)
+	{
+		RegisterCommands(commands);
+	}
+
+	ProcessingResult HandleMessage(const ChatMessage &msg) final
+	{
+		std::string args;
+		for (const auto &command : _commands)
+		{
+			if (getCommandArguments(msg.Body(), command, args))
+			{
+				_handled++;
+				return ProcessingResult::StopProcessing;
+			}
+		}
+
+		return ProcessingResult::KeepGoing;
+	}
+
+	size_t _handled = 0;
+};
+
+static constexpr int commandsPerHandler = 5;
+static constexpr int iterations = 200000;
+
+template <class Dispatch>
+double measure(const std::vector<ChatMessage> &messages, Dispatch dispatch)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		dispatch(messages[i % messages.size()]);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+void runBenchmark(int commandCount)
+{
+	std::list<std::shared_ptr<LemonHandler>> handlers;
+	MessageRouter router;
+	std::vector<std::string> commands;
+
+	for (int handlerIndex = 0; handlerIndex * commandsPerHandler < commandCount; handlerIndex++)
+	{
+		std::set<std::string> handlerCommands;
+		for (int i = 0; i < commandsPerHandler && commands.size() < static_cast<size_t>(commandCount); i++)
+		{
+			commands.push_back("!cmd" + std::to_string(handlerIndex) + "_" + std::to_string(i));
+			handlerCommands.insert(commands.back());
+		}
+
+		auto handler = std::make_shared<BenchHandler>("handler" + std::to_string(handlerIndex), handlerCommands);
+		handlers.push_back(handler);
+		router.AddHandler(handler);
+	}
+
+	// Busy room: mostly chatter, some commands with arguments
+	std::mt19937 generator(42);
+	std::uniform_int_distribution<size_t> pick(0, commands.size() - 1);
+	std::vector<ChatMessage> messages;
+	for (int i = 0; i < 1000; i++)
+	{
+		messages.emplace_back("nick", "jid@example.com",
+							  i % 4 == 0 ? commands[pick(generator)] + " some arguments"
+										 : "just some regular chat message number " + std::to_string(i),
+							  false);
+	}
+
+	auto linear = measure(messages, [&](const ChatMessage &msg) {
+		for (auto &handler : handlers)
+			if (handler->HandleMessage(msg) == LemonHandler::ProcessingResult::StopProcessing)
+				break;
+	});
+
+	auto routed = measure(messages, [&](const ChatMessage &msg) {
+		const auto features = MessageFeatures::Extract(msg.Body(), router.GetRequestedFeatures());
+		for (auto &handler : router.GetRoute(features->_command, features->_present))
+			if (handler->HandleMessage(msg) == LemonHandler::ProcessingResult::StopProcessing)
+				break;
+	});
+
+	std::cout << commandCount << " commands, " << handlers.size() << " handlers: "
+			  << "list walk " << linear << " ns/msg, "
+			  << "router " << routed << " ns/msg" << std::endl;
+}
+
+int main()
+{
+	for (int commandCount : {10, 50, 200})
+		runBenchmark(commandCount);
+
+	return 0;
+}
@@ -0,0 +1,79 @@
+// End-to-end throughput: replays a recorded chat log through Bot with
+// ReplayClient instead of a real XMPP connection.
+//
+// Usage: lemongrab_replay <config.toml> <log.jsonl> [repeat]
+// See bench/replay.toml for a config with network handlers disabled
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "bot.h"
+#include "replayclient.h"
+#include "settings.h"
+#include "handlers/util/stringops.h"
+
+static std::string formatLatency(std::uint64_t microseconds)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.3fms", microseconds / 1000.0);
+	return buffer;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <config.toml> <log.jsonl> [repeat]" << std::endl;
+		return 1;
+	}
+
+	initLocale();
+
+	Settings settings;
+	if (!settings.Open(argv[1]))
+		return 1;
+
+	auto events = ReplayClient::LoadLog(argv[2]);
+	if (!events || events->empty())
+	{
+		std::cerr << "Nothing to replay" << std::endl;
+		return 1;
+	}
+
+	const auto repeat = argc > 3 ? from_string<size_t>(argv[3]).value_or(1) : 1;
+	mkdir(settings.GetDBPrefixPath().c_str(), 0755);
+
+	auto *client = new ReplayClient(*events, repeat);
+	Bot bot(client, settings);
+
+	bot.Run();
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - client->GetReplayStart()).count();
+
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	std::cout << "Replayed " << client->GetEventsReplayed() << " events in " << elapsed << " s: "
+			  << client->GetEventsReplayed() / elapsed << " events/s, "
+			  << client->GetMessagesSent() << " replies sent" << std::endl;
+	std::cout << "Peak RSS: " << usage.ru_maxrss / 1024 << " MB" << std::endl;
+
+	for (const auto &handler : bot._metrics.GetHandlers())
+	{
+		const auto &latency = handler.second->_latency;
+		if (latency.GetCount() == 0)
+			continue;
+
+		std::cout << handler.first << ": " << latency.GetCount() << " calls"
+				  << ", p50 " << formatLatency(latency.GetPercentile(50))
+				  << " p90 " << formatLatency(latency.GetPercentile(90))
+				  << " p99 " << formatLatency(latency.GetPercentile(99))
+				  << " max " << formatLatency(latency.GetMax()) << std::endl;
+	}
+
+	return 0;
+}
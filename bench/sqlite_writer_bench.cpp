@@ -0,0 +1,124 @@
+// Inserts per second and read latency with several threads writing at once:
+// one shared sqlite_orm storage in rollback journal mode, as handlers used
+// it before, against StorageEngine in WAL mode with a writer thread
+//
+// Usage: lemongrab_sqlite_writer_bench [writers] [inserts per writer]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handlers/util/metrics.h"
+#include "handlers/util/sqlite_db.h"
+#include "handlers/util/storageengine.h"
+#include "handlers/util/stringops.h"
+
+static const std::string benchDB = "sqlite_writer_bench.db";
+
+static void removeDB()
+{
+	for (const auto &suffix : {"", "-wal", "-shm", "-journal"})
+		std::remove((benchDB + suffix).c_str());
+}
+
+static DB::LoggedURL makeRecord(int writer, int index)
+{
+	const std::string url = "http://example.com/" + std::to_string(writer) + "/" + std::to_string(index);
+	return { -1, url, "Example page title", index, url + " Example page title" };
+}
+
+static std::string formatLatency(std::uint64_t microseconds)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.3fms", microseconds / 1000.0);
+	return buffer;
+}
+
+/**
+ * @param write Runs on every writer thread, returns when its inserts are durable
+ * @param read Runs in a loop on a reader thread until writers are done
+ */
+static void runBenchmark(const std::string &name, int writers, int insertsPerWriter,
+						 const std::function<void(int writer)> &write, const std::function<void()> &read)
+{
+	std::atomic<bool> done{false};
+	LatencyHistogram readLatency;
+
+	std::thread reader([&] {
+		while (!done)
+		{
+			const auto started = std::chrono::steady_clock::now();
+			read();
+			readLatency.Record(std::chrono::steady_clock::now() - started);
+		}
+	});
+
+	const auto started = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int writer = 0; writer < writers; writer++)
+		threads.emplace_back(write, writer);
+	for (auto &thread : threads)
+		thread.join();
+	const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	done = true;
+	reader.join();
+
+	std::cout << name << ": " << static_cast<std::uint64_t>(writers * insertsPerWriter / elapsed) << " inserts/s"
+			  << ", reads " << readLatency.GetCount()
+			  << ", read p50 " << formatLatency(readLatency.GetPercentile(50))
+			  << " p99 " << formatLatency(readLatency.GetPercentile(99))
+			  << " max " << formatLatency(readLatency.GetMax()) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	const int writers = argc > 1 ? from_string<int>(argv[1]).value_or(4) : 4;
+	const int insertsPerWriter = argc > 2 ? from_string<int>(argv[2]).value_or(2000) : 2000;
+
+	using namespace sqlite_orm;
+	const auto readQuery = [](Storage &storage) {
+		storage.get_all<DB::LoggedURL>(order_by(&DB::LoggedURL::id).desc(), limit(10));
+	};
+
+	removeDB();
+	{
+		auto storage = initStorage(benchDB);
+		storage.sync_schema();
+
+		runBenchmark("shared connection", writers, insertsPerWriter,
+			[&](int writer) {
+				for (int i = 0; i < insertsPerWriter; i++)
+					storage.insert(makeRecord(writer, i));
+			},
+			[&] { readQuery(storage); });
+	}
+
+	removeDB();
+	{
+		auto storage = initStorage(benchDB);
+		storage.sync_schema();
+	}
+	{
+		StorageEngine engine(benchDB, StorageEngine::Options());
+
+		runBenchmark("WAL + writer thread", writers, insertsPerWriter,
+			[&](int writer) {
+				for (int i = 0; i < insertsPerWriter; i++)
+				{
+					const auto record = makeRecord(writer, i);
+					engine.Write([record](Storage &storage) { storage.insert(record); });
+				}
+				engine.Flush();
+			},
+			[&] { readQuery(engine.GetReader()); });
+	}
+	removeDB();
+
+	return 0;
+}
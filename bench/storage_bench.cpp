@@ -0,0 +1,358 @@
+// Latency of the queries handlers run against local.db, on synthetic
+// databases of growing size. Tables are created by initStorage and schema
+// migrations, as the bot does, and filled with generated url_log, quotes,
+// nicks and useractivity rows
+//
+// Databases are kept as storage_bench_<rows>.db and reused by later runs,
+// delete them to generate again. Results are printed to stdout as JSON,
+// progress goes to stderr
+//
+// Usage: lemongrab_storage_bench [rows...] (default: 10000 1000000 10000000)
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json/value.h>
+#include <json/writer.h>
+
+#include "handlers/util/fulltextindex.h"
+#include "handlers/util/metrics.h"
+#include "handlers/util/migrations.h"
+#include "handlers/util/sqlite_db.h"
+#include "handlers/util/stringops.h"
+
+// Same limits as in handlers
+static constexpr int maxURLsInSearch = 15; // UrlPreview
+static constexpr int maxMatches = 10; // Quotes
+static constexpr int maxSearchResults = 20; // LastSeen
+
+static constexpr size_t insertBatch = 100000;
+static constexpr size_t maxRuns = 200;
+static const auto runBudget = std::chrono::seconds(2);
+
+class WordGenerator
+{
+public:
+	explicit WordGenerator(size_t vocabularySize)
+	{
+		static const char *syllables[] = {"ka", "lo", "mi", "re", "tu", "sa", "ne", "po", "vi", "da", "go", "ri", "le", "mon", "zu", "ba"};
+		std::mt19937 random(1);
+		std::uniform_int_distribution<size_t> syllable(0, std::size(syllables) - 1);
+		std::uniform_int_distribution<int> length(2, 4);
+		for (size_t i = 0; i < vocabularySize; i++)
+		{
+			std::string word;
+			for (int s = length(random); s > 0; s--)
+				word += syllables[syllable(random)];
+			_words.push_back(word + std::to_string(i % 10));
+		}
+	}
+
+	std::string Sentence(std::mt19937 &random, int minWords, int maxWords) const
+	{
+		std::uniform_int_distribution<size_t> word(0, _words.size() - 1);
+		std::string sentence;
+		for (int count = std::uniform_int_distribution<int>(minWords, maxWords)(random); count > 0; count--)
+		{
+			if (!sentence.empty())
+				sentence += ' ';
+			sentence += _words[word(random)];
+		}
+		return sentence;
+	}
+
+	const std::string &Word(size_t index) const { return _words[index % _words.size()]; }
+
+private:
+	std::vector<std::string> _words;
+};
+
+static bool execSql(sqlite3 *db, const std::string &sql)
+{
+	char *error = nullptr;
+	if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+	{
+		std::cerr << "\"" << sql << "\" failed: " << (error ? error : "unknown error") << std::endl;
+		sqlite3_free(error);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Insert rows in transactions of insertBatch rows
+ * @param bind Binds parameters of the insert statement for row
+ */
+static bool fillTable(sqlite3 *db, const std::string &insertSql, size_t rows, const std::function<void(sqlite3_stmt *, size_t row)> &bind)
+{
+	sqlite3_stmt *insert = nullptr;
+	if (sqlite3_prepare_v2(db, insertSql.c_str(), -1, &insert, nullptr) != SQLITE_OK)
+	{
+		std::cerr << "Failed to prepare \"" << insertSql << "\": " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	bool success = true;
+	for (size_t row = 0; success && row < rows; row++)
+	{
+		if (row % insertBatch == 0)
+			success = execSql(db, "BEGIN");
+
+		bind(insert, row);
+		success = success && sqlite3_step(insert) == SQLITE_DONE;
+		sqlite3_reset(insert);
+
+		if (success && (row % insertBatch == insertBatch - 1 || row == rows - 1))
+			success = execSql(db, "COMMIT");
+	}
+
+	sqlite3_finalize(insert);
+	return success;
+}
+
+static void bindText(sqlite3_stmt *statement, int index, const std::string &text)
+{
+	sqlite3_bind_text(statement, index, text.c_str(), -1, SQLITE_TRANSIENT);
+}
+
+static bool generate(const std::string &path, size_t rows, const WordGenerator &words)
+{
+	for (const auto &suffix : {"", "-wal", "-shm", "-journal"})
+		std::remove((path + suffix).c_str());
+
+	initStorage(path).sync_schema();
+
+	sqlite3 *db = nullptr;
+	if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+	{
+		std::cerr << "Failed to open " << path << std::endl;
+		sqlite3_close(db);
+		return false;
+	}
+
+	std::mt19937 random(2);
+	const long firstTime = 1500000000;
+	const bool success = execSql(db, "PRAGMA synchronous = OFF")
+		&& fillTable(db, "INSERT INTO url_log (URL, title, time, fulltext) VALUES (?, ?, ?, ?)", rows, [&](sqlite3_stmt *insert, size_t row) {
+			const auto url = "https://site" + std::to_string(row % 5000) + ".example.com/" + words.Word(row) + "/" + std::to_string(row);
+			const auto title = words.Sentence(random, 3, 10);
+			bindText(insert, 1, url);
+			bindText(insert, 2, title);
+			sqlite3_bind_int64(insert, 3, firstTime + static_cast<long>(row) * 30);
+			bindText(insert, 4, url + " " + title);
+		})
+		&& fillTable(db, "INSERT INTO quotes (\"index\", quote, author, author_id) VALUES (?, ?, ?, ?)", rows, [&](sqlite3_stmt *insert, size_t row) {
+			const auto author = "user" + std::to_string(row % 1000);
+			sqlite3_bind_int64(insert, 1, static_cast<sqlite3_int64>(row + 1));
+			bindText(insert, 2, "<" + author + "> " + words.Sentence(random, 5, 30));
+			bindText(insert, 3, author);
+			bindText(insert, 4, author + "@example.com");
+		})
+		&& fillTable(db, "INSERT INTO nicks (nick, uniqueID) VALUES (?, ?)", rows, [&](sqlite3_stmt *insert, size_t row) {
+			bindText(insert, 1, words.Word(row) + "_" + std::to_string(row));
+			bindText(insert, 2, "user" + std::to_string(row) + "@example.com");
+		})
+		&& fillTable(db, "INSERT INTO useractivity (uniqueID, nick, message, timepoint_status, timepoint_message) VALUES (?, ?, ?, ?, ?)", rows, [&](sqlite3_stmt *insert, size_t row) {
+			bindText(insert, 1, "user" + std::to_string(row) + "@example.com");
+			bindText(insert, 2, words.Word(row) + "_" + std::to_string(row));
+			bindText(insert, 3, words.Sentence(random, 1, 15));
+			sqlite3_bind_int64(insert, 4, firstTime + static_cast<long>(row));
+			sqlite3_bind_int64(insert, 5, firstTime + static_cast<long>(row));
+		});
+
+	sqlite3_close(db);
+	return success;
+}
+
+static size_t countRows(const std::string &path)
+{
+	sqlite3 *db = nullptr;
+	sqlite3_stmt *statement = nullptr;
+	size_t count = 0;
+	if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK
+			&& sqlite3_prepare_v2(db, "SELECT count(*) FROM useractivity", -1, &statement, nullptr) == SQLITE_OK
+			&& sqlite3_step(statement) == SQLITE_ROW)
+		count = static_cast<size_t>(sqlite3_column_int64(statement, 0));
+	sqlite3_finalize(statement);
+	sqlite3_close(db);
+	return count;
+}
+
+/**
+ * @brief Apply migrations as the bot does at startup and wait for background ones
+ */
+static bool migrate(const std::string &path)
+{
+	SchemaMigrations::Options options;
+	options._batchSize = insertBatch;
+	options._pause = std::chrono::milliseconds(0);
+	SchemaMigrations migrations(path, options);
+
+	const auto all = storageMigrations();
+	if (!migrations.Run(all))
+		return false;
+
+	while (migrations.IsRunningInBackground())
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	return migrations.GetVersion() == all.back()._version;
+}
+
+static Json::Value measure(const std::string &name, const std::function<size_t()> &query)
+{
+	LatencyHistogram latency;
+	size_t results = query(); // warm up page cache
+
+	const auto started = std::chrono::steady_clock::now();
+	while (latency.GetCount() < maxRuns && (latency.GetCount() < 3 || std::chrono::steady_clock::now() - started < runBudget))
+	{
+		const auto queryStarted = std::chrono::steady_clock::now();
+		results = query();
+		latency.Record(std::chrono::steady_clock::now() - queryStarted);
+	}
+
+	std::cerr << "  " << name << ": " << latency.GetPercentile(50) << "us" << std::endl;
+
+	Json::Value result;
+	result["query"] = name;
+	result["results"] = static_cast<Json::UInt64>(results);
+	result["runs"] = static_cast<Json::UInt64>(latency.GetCount());
+	result["mean_us"] = static_cast<Json::UInt64>(latency.GetSum() / latency.GetCount());
+	result["p50_us"] = static_cast<Json::UInt64>(latency.GetPercentile(50));
+	result["p99_us"] = static_cast<Json::UInt64>(latency.GetPercentile(99));
+	result["max_us"] = static_cast<Json::UInt64>(latency.GetMax());
+	return result;
+}
+
+static Json::Value runBenchmark(size_t rows, const WordGenerator &words)
+{
+	using namespace sqlite_orm;
+
+	Json::Value result;
+	result["rows"] = static_cast<Json::UInt64>(rows);
+
+	const auto path = "storage_bench_" + std::to_string(rows) + ".db";
+	const auto started = std::chrono::steady_clock::now();
+	if (countRows(path) != rows)
+	{
+		std::cerr << "Generating " << path << std::endl;
+		if (!generate(path, rows, words))
+			return result;
+	}
+
+	std::cerr << "Migrating " << path << std::endl;
+	if (!migrate(path))
+		return result;
+	result["prepare_s"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	auto storage = initStorage(path);
+	storage.open_forever();
+	FullTextIndex fullTextIndex(path);
+	fullTextIndex.Attach("url_log");
+	fullTextIndex.Attach("quotes");
+
+	// A word present in about rows / vocabulary records, and one that is nowhere
+	const auto &word = words.Word(rows / 2);
+	const std::string missing = "nosuchword";
+	const auto nick = words.Word(rows / 3);
+
+	std::cerr << "Querying " << path << std::endl;
+	auto &queries = result["queries"];
+
+	// UrlPreview::findUrlsInHistory
+	for (const auto &request : {word, missing})
+	{
+		const auto suffix = request == missing ? "_miss" : "";
+		queries.append(measure(std::string("url_history_like") + suffix, [&] {
+			return storage.get_all<DB::LoggedURL>(
+						where(like(&DB::LoggedURL::fullText, "%" + request + "%")),
+						order_by(&DB::LoggedURL::id).desc(),
+						limit(maxURLsInSearch)).size();
+		}));
+		queries.append(measure(std::string("url_history_fts") + suffix, [&] {
+			std::vector<DB::LoggedURL> urls;
+			for (auto id : fullTextIndex.Search("url_log", request, maxURLsInSearch))
+				if (auto url = storage.get_no_throw<DB::LoggedURL>(static_cast<int>(id)))
+					urls.push_back(*url);
+			return urls.size();
+		}));
+	}
+
+	// Quotes::FindQuote
+	for (const auto &request : {word, missing})
+	{
+		const auto suffix = request == missing ? "_miss" : "";
+		queries.append(measure(std::string("quote_find_like") + suffix, [&] {
+			return storage.get_all<DB::Quote>(where(like(&DB::Quote::quote, "%" + request + "%"))).size();
+		}));
+		queries.append(measure(std::string("quote_find_fts") + suffix, [&] {
+			if (fullTextIndex.Count("quotes", request) > maxMatches)
+				return size_t(0);
+
+			std::vector<DB::Quote> quotes;
+			for (auto id : fullTextIndex.Search("quotes", request, maxMatches))
+				if (auto quote = storage.get_no_throw<DB::Quote>(static_cast<int>(id)))
+					quotes.push_back(*quote);
+			return quotes.size();
+		}));
+	}
+
+	// Quotes::GetQuote, max index is loaded once by handler
+	queries.append(measure("quote_max_index", [&] {
+		return storage.max(&DB::Quote::humanIndex) ? size_t(1) : size_t(0);
+	}));
+	queries.append(measure("quote_by_index", [&] {
+		return storage.get_all<DB::Quote>(where(is_equal(&DB::Quote::humanIndex, static_cast<int>(rows / 2)))).size();
+	}));
+	queries.append(measure("quote_random_order_by", [&] {
+		return storage.get_all<DB::Quote>(order_by(sqlite_orm::random())).size();
+	}));
+	std::mt19937 random(3);
+	std::uniform_int_distribution<int> quoteIndex(1, static_cast<int>(rows));
+	queries.append(measure("quote_random", [&] {
+		return storage.get_all<DB::Quote>(where(is_equal(&DB::Quote::humanIndex, quoteIndex(random)))).size();
+	}));
+
+	// LastSeen::GetLastStatus
+	queries.append(measure("seen_by_jid", [&] {
+		return storage.get_no_throw<DB::UserActivity>("user" + std::to_string(rows / 3) + "@example.com") ? size_t(1) : size_t(0);
+	}));
+	queries.append(measure("seen_like", [&] {
+		return storage.get_all<DB::Nick>(where(like(&DB::Nick::nick, "%" + nick + "%")), limit(maxSearchResults)).size()
+				+ storage.get_all<DB::Nick>(where(like(&DB::Nick::uniqueID, "%" + nick + "%")), limit(maxSearchResults)).size();
+	}));
+	queries.append(measure("seen_like_miss", [&] {
+		return storage.get_all<DB::Nick>(where(like(&DB::Nick::nick, "%" + missing + "%")), limit(maxSearchResults)).size()
+				+ storage.get_all<DB::Nick>(where(like(&DB::Nick::uniqueID, "%" + missing + "%")), limit(maxSearchResults)).size();
+	}));
+
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<size_t> sizes;
+	for (int i = 1; i < argc; i++)
+		if (auto rows = from_string<size_t>(argv[i]))
+			sizes.push_back(*rows);
+	if (sizes.empty())
+		sizes = {10000, 1000000, 10000000};
+
+	const WordGenerator words(5000);
+
+	Json::Value results;
+	results["sqlite"] = sqlite3_libversion();
+	auto &databases = results["databases"];
+	for (auto rows : sizes)
+		databases.append(runBenchmark(rows, words));
+
+	std::cout << results << std::endl;
+	return 0;
+}
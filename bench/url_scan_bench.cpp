@@ -0,0 +1,71 @@
+// Throughput of findURLs against the std::regex it replaced, on chat-like text
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "handlers/util/stringops.h"
+
+static constexpr int iterations = 20;
+
+template <class Scan>
+double measure(const std::vector<std::string> &messages, size_t bytes, Scan scan)
+{
+	size_t found = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		for (const auto &message : messages)
+			found += scan(message).size();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	if (found == 0)
+		std::cerr << "No URLs found" << std::endl;
+
+	return static_cast<double>(bytes) * iterations / (1024 * 1024) / std::chrono::duration<double>(elapsed).count();
+}
+
+int main()
+{
+	initLocale();
+
+	const std::vector<std::string> words = {
+		"привет", "как", "дела", "the", "build", "is", "broken", "again", "lol", "ок", "сегодня",
+		"nope", "10:30", "meeting", "see", "above", ":)", "re:", "это", "баг", "fixed", "in", "master",
+	};
+	const std::vector<std::string> links = {
+		"https://www.youtube.com/watch?v=dQw4w9WgXcQ",
+		"https://github.com/mechmind/lemongrab/pull/42#issuecomment-1",
+		"http://example.com/",
+		"https://ru.wikipedia.org/wiki/%D0%A2%D0%B5%D1%81%D1%82",
+	};
+
+	// Busy room: short lines, every tenth one has a link
+	std::mt19937 generator(42);
+	std::uniform_int_distribution<size_t> pickWord(0, words.size() - 1);
+	std::uniform_int_distribution<size_t> pickLink(0, links.size() - 1);
+	std::uniform_int_distribution<int> length(3, 20);
+	std::vector<std::string> messages;
+	size_t bytes = 0;
+	for (int i = 0; i < 20000; i++)
+	{
+		std::string message;
+		for (int count = length(generator); count > 0; count--)
+			message += words[pickWord(generator)] + " ";
+		if (i % 10 == 0)
+			message += links[pickLink(generator)] + " " + words[pickWord(generator)];
+
+		bytes += message.size();
+		messages.push_back(std::move(message));
+	}
+
+	const auto scanner = measure(messages, bytes, findURLs);
+	const auto regex = measure(messages, bytes, findURLsRegex);
+
+	std::cout << messages.size() << " messages, " << bytes / 1024 << " KiB: "
+			  << "scanner " << scanner << " MB/s, "
+			  << "regex " << regex << " MB/s" << std::endl;
+
+	return 0;
+}
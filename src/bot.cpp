@@ -23,6 +23,7 @@
 #include <glog/logging.h>
 
 #include <algorithm>
+#include <cstdio>
 
 static Bot *signalHandlingInstance = nullptr;
 
@@ -50,27 +51,78 @@ Bot::Bot(XMPPClient *client, Settings &settings)
 	: LemonBot(settings.GetDBPrefixPath() + "/local.db")
 	, _xmpp(client)
 	, _settings(settings)
+	, _outbound(GetOutboundOptions(settings), [this](const ChatMessage &message) { Deliver(message); }, &_metrics)
+	, _executor(GetHandlerThreads(settings), &_metrics)
 {
-	_storage.sync_schema(true);
+	_httpClient = std::make_unique<HttpClient>(GetHttpOptions(settings), &_metrics);
+
+	const auto storagePath = settings.GetDBPrefixPath() + "/local.db";
+	_fullTextIndex = std::make_unique<FullTextIndex>(storagePath);
+
+	SchemaMigrations::Options migrationOptions;
+	migrationOptions._batchSize = from_string<size_t>(settings.GetRawString("Storage.MigrationBatch")).value_or(migrationOptions._batchSize);
+	migrationOptions._pause = std::chrono::milliseconds(from_string<int>(settings.GetRawString("Storage.MigrationPauseMs")).value_or(50));
+	_urlArchive = std::make_unique<UrlArchive>(storagePath, GetUrlArchiveOptions(settings));
+	_migrations = std::make_unique<SchemaMigrations>(storagePath, migrationOptions);
+	// Searches fall back to LIKE until indexes are filled
+	if (!_migrations->Run(storageMigrations(), [this] {
+			_fullTextIndex->Attach("url_log");
+			_fullTextIndex->Attach("quotes");
+			_urlArchive->Start();
+		}))
+		LOG(ERROR) << "Storage schema is not up to date, some handlers may fail";
+
+	// Shared sqlite_orm connection is not thread-safe, handler workers need their own
+	const bool parallelHandlers = GetHandlerThreads(settings) > 1;
+	if (settings.GetRawString("Storage.WAL") == "true" || parallelHandlers)
+	{
+		if (settings.GetRawString("Storage.WAL") != "true")
+			LOG(WARNING) << "Storage.WAL is off, but handlers run on several threads (General.HandlerThreads), using WAL mode anyway";
+		LOG(INFO) << "Storage: WAL mode with writer thread";
+		_storageEngine = std::make_unique<StorageEngine>(storagePath, GetStorageOptions(settings), &_metrics);
+	}
+
 	_xmpp->SetXMPPHandler(this);
+
+	_globalCommands = {
+		{"!uptime", {&Bot::UptimeCommand, false}},
+		{"!die", {&Bot::DieCommand, false}},
+		{"!restart", {&Bot::RestartCommand, false}},
+		{"!reload", {&Bot::ReloadCommand, false}},
+		{"!help", {&Bot::HelpCommand, true}},
+		{"!queues", {&Bot::QueuesCommand, false}},
+		{"!stats", {&Bot::StatsCommand, true}},
+	};
+
 	RegisterSignalHandler(this);
 }
 
 Bot::~Bot()
 {
 	UnregisterSignalHandler();
+	// Cancelled requests still call back into handlers, handler threads blocked
+	// on requests get "Cancelled" and new requests fail right away
+	if (_httpClient)
+		_httpClient->Shutdown();
+
+	// Handler threads (discord gateway, feed updaters) dispatch and send through
+	// executor and outbound queue, stop them while those are still alive
+	UnregisterAllHandlers();
+	// Nothing can reach the client now
+	_httpClient.reset();
+	_executor.Drain();
 }
 
 Bot::ExitCode Bot::Run()
 {
 	_startTime = std::chrono::system_clock::now();
-	_lastMessage = std::chrono::system_clock::now();
 
 	RegisterAllHandlers();
 
 	LOG(INFO) << "Connecting to XMPP server";
 	_xmpp->Connect(_settings.GetUserJID(), _settings.GetPassword());
 
+	_executor.Drain();
 	return _exitCode;
 }
 
@@ -92,13 +144,20 @@ void Bot::RegisterAllHandlers()
 	for (const auto &handler : _handlersByName)
 		LOG(INFO) << "Handler loaded: " << handler.first;
 
+	std::atomic_store(&_discord, std::dynamic_pointer_cast<Discord>(_handlersByName["discord"]));
+
 	EnableHandlers(_settings.GetStringSet("General.Modules"), _settings.GetStringSet("General.ModulesBlacklist"));
 }
 
 void Bot::UnregisterAllHandlers()
 {
+	_executor.Reset();
+	std::atomic_store(&_discord, std::shared_ptr<Discord>());
 	_handlersByName.clear();
-	_chatEventHandlers.clear();
+	_router.Clear();
+	// Last references, handlers stop their threads and save pending state here,
+	// before !reload registers new instances over the same storage
+	_allChatEventHandlers.clear();
 }
 
 void Bot::OnConnect()
@@ -109,93 +168,207 @@ void Bot::OnConnect()
 	_xmpp->JoinRoom(muc);
 }
 
-void Bot::OnMessage(ChatMessage &msg)
+void Bot::OnMessage(const ChatMessage &incoming)
 {
-	if (msg._jid.empty())
-		msg._jid = GetJidByNick(msg._nick);
+	_metrics._inboundMessages.Increment();
+	_metrics._inboundRate.Mark();
 
-	msg._isAdmin |= !msg._jid.empty()
-			&& GetRawConfigValue("General.admin") == msg._jid;
+	const auto withJid = incoming.Jid().empty() ? incoming.WithJid(_identities.GetInternedJidByNick(incoming.Nick())) : incoming;
+	const bool isAdmin = withJid.IsAdmin()
+			|| (!withJid.Jid().empty() && GetRawConfigValue("General.admin") == withJid.Jid());
+
+	// Classified once for everyone, handlers get the features they asked for with the message
+	const auto features = MessageFeatures::Extract(withJid.Body(), _router.GetRequestedFeatures());
+
+	// Shared by every handler on the route, nothing is copied per handler
+	const ChatMessagePtr msg = std::make_shared<const ChatMessage>(withJid.WithAdmin(isAdmin).WithFeatures(features));
 
 	if (_settings.verboseLogging())
 	{
-		LOG(INFO) << ">>> Message: " << msg._jid << " as " << msg._nick << " > " << msg._body
-				  << " [ Priv? " << msg._isPrivate << " Module? " << msg._module_name << " Discord embed? " << msg._hasDiscordEmbed << " ]";
+		LOG(INFO) << ">>> Message: " << msg->Jid() << " as " << msg->Nick() << " > " << msg->Body()
+				  << " [ Priv? " << msg->IsPrivate() << " Module? " << msg->Module() << " Discord embed? " << msg->HasDiscordEmbed() << " ]";
 	}
 
-	auto &text = msg._body;
+	const auto &command = features->_command;
 
-	if (text == "!uptime")
+	auto globalCommand = _globalCommands.find(command);
+	if (globalCommand != _globalCommands.end())
 	{
-		// FIXME: dirty hack
-		if (msg._module_name != "discord")
-			dynamic_cast<Discord*>(_handlersByName["discord"].get())->HandleMessage(msg);
-
-		auto currentTime = std::chrono::system_clock::now();
-		std::string uptime("Uptime: " + CustomTimeFormat(currentTime - _startTime));
-		return SendMessage(uptime);
+		std::string args;
+		getCommandArguments(msg->Body(), command, args);
+		if (args.empty() || globalCommand->second._takesArguments)
+			return (this->*globalCommand->second._command)(*msg, args);
 	}
 
-	if (text == "!die" && msg._isAdmin)
-	{
-		// FIXME: dirty hack
-		if (msg._module_name != "discord")
-			dynamic_cast<Discord*>(_handlersByName["discord"].get())->HandleMessage(msg);
+	_executor.Dispatch(_router.Select(*msg), [msg](LemonHandler &handler) {
+		return handler.HandleMessage(*msg);
+	});
+}
 
-		LOG(WARNING) << "Termination requested (!die command received)";
-		_exitCode = ExitCode::TerminationRequested;
-		_xmpp->Disconnect();
+void Bot::UptimeCommand(const ChatMessage &msg, const std::string &args)
+{
+	MirrorToDiscord(msg);
+
+	auto currentTime = std::chrono::system_clock::now();
+	std::string uptime("Uptime: " + CustomTimeFormat(currentTime - _startTime));
+	SendMessage(uptime);
+}
+
+void Bot::DieCommand(const ChatMessage &msg, const std::string &args)
+{
+	if (!msg.IsAdmin())
 		return;
-	}
 
-	if (text == "!restart" && msg._isAdmin)
-	{
-		// FIXME: dirty hack
-		if (msg._module_name != "discord")
-			dynamic_cast<Discord*>(_handlersByName["discord"].get())->HandleMessage(msg);
-
-		LOG(WARNING) << "Restart requested";
-		_exitCode = ExitCode::RestartRequested;
-		// _chatEventHandlers.clear();
-		_xmpp->Disconnect();
+	MirrorToDiscord(msg);
+
+	LOG(WARNING) << "Termination requested (!die command received)";
+	_exitCode = ExitCode::TerminationRequested;
+	// Replies queued before disconnecting still go out
+	_outbound.Flush(GetOutboundOptions(_settings)._shutdownFlush);
+	_xmpp->Disconnect();
+}
+
+void Bot::RestartCommand(const ChatMessage &msg, const std::string &args)
+{
+	if (!msg.IsAdmin())
+		return;
+
+	MirrorToDiscord(msg);
+
+	LOG(WARNING) << "Restart requested";
+	_exitCode = ExitCode::RestartRequested;
+	// Replies queued before disconnecting still go out
+	_outbound.Flush(GetOutboundOptions(_settings)._shutdownFlush);
+	_xmpp->Disconnect();
+}
+
+void Bot::ReloadCommand(const ChatMessage &msg, const std::string &args)
+{
+	if (!msg.IsAdmin())
 		return;
+
+	MirrorToDiscord(msg);
+
+	LOG(INFO) << "Config reload requested";
+	if (_settings.Reload())
+	{
+		SendMessage("Settings successfully reloaded, re-registering handlers...");
+		UnregisterAllHandlers();
+		RegisterAllHandlers();
+		SendMessage("Done");
 	}
+	else
+		SendMessage("Failed to reload settings");
+}
+
+void Bot::HelpCommand(const ChatMessage &msg, const std::string &args)
+{
+	MirrorToDiscord(msg);
+
+	const auto &module = args;
+	SendMessage(GetHelp(module));
+}
+
+void Bot::QueuesCommand(const ChatMessage &msg, const std::string &args)
+{
+	if (!msg.IsAdmin())
+		return;
 
-	if (text == "!reload" && msg._isAdmin)
+	using namespace std::chrono;
+	std::string result = "Handler queues:";
+	for (const auto &queue : _executor.GetStats())
 	{
-		// FIXME: dirty hack
-		if (msg._module_name != "discord")
-			dynamic_cast<Discord*>(_handlersByName["discord"].get())->HandleMessage(msg);
+		result += "\n" + queue._name + ": depth " + std::to_string(queue._depth)
+				+ ", processed " + std::to_string(queue._processed)
+				+ ", wait avg " + std::to_string(duration_cast<milliseconds>(queue._averageWait).count()) + "ms"
+				+ " max " + std::to_string(duration_cast<milliseconds>(queue._maxWait).count()) + "ms";
+	}
 
-		LOG(INFO) << "Config reload requested";
-		if (_settings.Reload())
-		{
-			SendMessage("Settings successfully reloaded, re-registering handlers...");
-			UnregisterAllHandlers();
-			RegisterAllHandlers();
-			SendMessage("Done");
-		}
-		else
-			SendMessage("Failed to reload settings");
+	const auto outbound = _outbound.GetStats();
+	result += "\nOutbound: depth " + std::to_string(outbound._depth)
+			+ ", sent " + std::to_string(outbound._sent)
+			+ ", dropped " + std::to_string(outbound._dropped)
+			+ ", coalesced " + std::to_string(outbound._coalesced)
+			+ ", latency avg " + std::to_string(duration_cast<milliseconds>(outbound._averageLatency).count()) + "ms"
+			+ " max " + std::to_string(duration_cast<milliseconds>(outbound._maxLatency).count()) + "ms";
+
+	const auto http = _httpClient->GetStats();
+	result += "\nHTTP: active " + std::to_string(http._active) + ", queued " + std::to_string(http._queued);
+
+	if (_storageEngine)
+	{
+		const auto storage = _storageEngine->GetStats();
+		result += "\nStorage writes: pending " + std::to_string(storage._pending)
+				+ ", written " + std::to_string(storage._written)
+				+ " in " + std::to_string(storage._commits) + " commits"
+				+ ", readers " + std::to_string(storage._readers);
 	}
 
-	std::string args;
-	if (getCommandArguments(text, "!help", args))
+	SendMessage(result);
+}
+
+static std::string FormatLatency(std::uint64_t microseconds)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.1fms", microseconds / 1000.0);
+	return buffer;
+}
+
+void Bot::StatsCommand(const ChatMessage &msg, const std::string &args)
+{
+	if (!msg.IsAdmin())
+		return;
+
+	const auto &module = args;
+	std::string result;
+
+	if (module.empty())
 	{
-		// FIXME: dirty hack
-		if (msg._module_name != "discord")
-			dynamic_cast<Discord*>(_handlersByName["discord"].get())->HandleMessage(msg);
+		char rate[32];
+		snprintf(rate, sizeof(rate), "%.2f", _metrics._inboundRate.GetRate());
+		result = "Inbound: " + std::to_string(_metrics._inboundMessages.Get()) + " messages, "
+				+ rate + "/s over last minute";
+	}
 
-		const auto &module = args;
-		return SendMessage(GetHelp(module));
+	for (const auto &handler : _metrics.GetHandlers())
+	{
+		if (!module.empty() && handler.first != module)
+			continue;
+
+		const auto &stats = *handler.second;
+		const auto calls = stats._calls.Get();
+		if (!result.empty())
+			result += "\n";
+
+		result += handler.first + ": " + std::to_string(calls) + " calls, "
+				+ std::to_string(stats._errors.Get()) + " errors";
+		if (calls == 0)
+			continue;
+
+		result += ", p50 " + FormatLatency(stats._latency.GetPercentile(50))
+				+ " p90 " + FormatLatency(stats._latency.GetPercentile(90))
+				+ " p99 " + FormatLatency(stats._latency.GetPercentile(99))
+				+ " max " + FormatLatency(stats._latency.GetMax());
+
+		if (!module.empty())
+			result += ", avg " + FormatLatency(stats._latency.GetSum() / stats._latency.GetCount());
 	}
 
-	for (auto &handler : _chatEventHandlers) {
-//		if (handler->GetName() == msg._module_name)
-//			continue;
+	if (result.empty())
+		result = "No stats for " + module;
+
+	SendMessage(result);
+}
 
-		if (handler->HandleMessage(msg) == LemonHandler::ProcessingResult::StopProcessing)
-			break;
+void Bot::MirrorToDiscord(const ChatMessage &msg)
+{
+	// FIXME: dirty hack
+	auto discord = _handlersByName.find("discord");
+	if (msg.Module() != "discord" && discord != _handlersByName.end())
+	{
+		_executor.Dispatch({discord->second}, [msg](LemonHandler &handler) {
+			return handler.HandleMessage(msg);
+		});
 	}
 }
 
@@ -203,36 +376,29 @@ void Bot::OnPresence(const std::string &nick, const std::string &jid, bool onlin
 {
 	bool isNewConnection = false;
 	if (online)
-	{
-		isNewConnection = _nick2jid.insert(std::pair(nick, jid)).second;
-		_jid2nick[jid] = nick;
-	}
+		isNewConnection = _identities.OnJoin(nick, jid);
 	else
-	{
-		_nick2jid.erase(nick);
-		if (!newNick.empty())
-		{
-			_nick2jid[newNick] = jid;
-			_jid2nick[jid] = newNick;
-		} else {
-			_jid2nick.erase(jid);
-		}
-	}
+		_identities.OnLeave(nick, jid, newNick);
 
-	for (auto &handler : _chatEventHandlers)
-		handler->HandlePresence(nick, jid, isNewConnection);
+	_executor.Dispatch(_router.GetHandlers(), [nick, jid, isNewConnection](LemonHandler &handler) {
+		handler.HandlePresence(nick, jid, isNewConnection);
+		return LemonHandler::ProcessingResult::KeepGoing;
+	});
 }
 
 std::string Bot::GetNickByJid(const std::string &jid) const
 {
-	auto nick = _jid2nick.find(jid);
-	return nick != _jid2nick.end() ? nick->second : "";
+	return _identities.GetNickByJid(jid);
 }
 
 std::string Bot::GetJidByNick(const std::string &nick) const
 {
-	auto jid = _nick2jid.find(nick);
-	return jid != _nick2jid.end() ? jid->second : "";
+	return _identities.GetJidByNick(nick);
+}
+
+UserID Bot::GetUserID(const std::string &jid) const
+{
+	return _identities.GetUserID(jid);
 }
 
 std::string Bot::GetDBPathPrefix() const
@@ -244,8 +410,8 @@ std::string Bot::GetOnlineUsers() const
 {
 	std::string result = "Jabber users:";
 
-	for (auto pair : _jid2nick) {
-		result += "\n" + pair.second + " (" + pair.first + ")";
+	for (const auto &user : _identities.GetOnlineUsers()) {
+		result += "\n" + user.first + " (" + user.second + ")";
 	};
 
 	return result;
@@ -254,47 +420,83 @@ std::string Bot::GetOnlineUsers() const
 void Bot::SendMessage(const std::string &message, const std::string &channel)
 {
 	// FIXME: get rid of this
-	ChatMessage msg;
-	msg._body = message;
-	msg._origin = ChatMessage::Origin::Bot;
-    msg._discordChannel = channel;
-
-	SendMessage(msg);
+	SendMessage(ChatMessage::FromBot(message, channel));
 }
 
 void Bot::SendMessage(const ChatMessage &message)
 {
-	if (message._body.empty()) {
+	if (message.Body().empty()) {
 		return;
 	}
 
-	std::lock_guard<std::mutex> lock(_sendMessageMutex);
+	_outbound.Push(message);
+}
 
-	// Throttle
-	auto currentTime = std::chrono::system_clock::now();
-	if (_lastMessage + std::chrono::seconds(_sendMessageThrottle) > currentTime)
-	{
-		_sendMessageThrottle++;
-		std::this_thread::sleep_for(std::chrono::seconds(_sendMessageThrottle));
-	} else {
-		_sendMessageThrottle = 1;
-	}
+size_t Bot::GetHandlerThreads(const Settings &settings)
+{
+	return from_string<size_t>(settings.GetRawString("General.HandlerThreads")).value_or(4);
+}
+
+OutboundQueue::Options Bot::GetOutboundOptions(const Settings &settings)
+{
+	OutboundQueue::Options options;
+	options._burst = from_string<size_t>(settings.GetRawString("General.SendBurst")).value_or(options._burst);
+	options._ratePerMinute = from_string<size_t>(settings.GetRawString("General.SendRatePerMinute")).value_or(options._ratePerMinute);
+	options._maxQueued = from_string<size_t>(settings.GetRawString("General.SendQueueLimit")).value_or(options._maxQueued);
+	options._coalesceWindow = std::chrono::milliseconds(from_string<int>(settings.GetRawString("General.CoalesceMs")).value_or(0));
+	options._maxLength = from_string<size_t>(settings.GetRawString("General.MaxMessageLength")).value_or(options._maxLength);
+	options._shutdownFlush = std::chrono::milliseconds(from_string<int>(settings.GetRawString("General.ShutdownFlushMs")).value_or(3000));
+	return options;
+}
 
-	// Send
-	_xmpp->SendMessage(message._body, ""); // FIXME: unused arg
+StorageEngine::Options Bot::GetStorageOptions(const Settings &settings)
+{
+	StorageEngine::Options options;
+	const auto synchronous = settings.GetRawString("Storage.Synchronous");
+	options._synchronous = synchronous.empty() ? options._synchronous : toUpper(synchronous);
+	options._mmapSize = static_cast<std::int64_t>(from_string<size_t>(settings.GetRawString("Storage.MmapSizeMB")).value_or(0)) * 1024 * 1024;
+	options._cacheSize = static_cast<std::int64_t>(from_string<size_t>(settings.GetRawString("Storage.CacheSizeMB")).value_or(0)) * 1024;
+	options._busyTimeout = from_string<int>(settings.GetRawString("Storage.BusyTimeoutMs")).value_or(options._busyTimeout);
+	options._maxBatch = from_string<size_t>(settings.GetRawString("Storage.WriteBatch")).value_or(options._maxBatch);
+	return options;
+}
 
-	if (message._origin != ChatMessage::Origin::Discord) {
-        dynamic_cast<Discord*>(_handlersByName["discord"].get())->SendToDiscord(message._body, message._discordChannel);
-	}
+HttpClient::Options Bot::GetHttpOptions(const Settings &settings)
+{
+	HttpClient::Options options;
+	options._maxConnections = from_string<int>(settings.GetRawString("HTTP.MaxConnections")).value_or(options._maxConnections);
+	options._maxHostConnections = from_string<int>(settings.GetRawString("HTTP.MaxHostConnections")).value_or(options._maxHostConnections);
+	options._maxIdleConnections = from_string<int>(settings.GetRawString("HTTP.MaxIdleConnections")).value_or(options._maxIdleConnections);
+	options._dnsCacheTimeout = from_string<int>(settings.GetRawString("HTTP.DNSCacheSec")).value_or(options._dnsCacheTimeout);
+	options._http2 = settings.GetRawString("HTTP.HTTP2") != "false";
+	return options;
+}
 
-	_lastMessage = std::chrono::system_clock::now();
+UrlArchive::Options Bot::GetUrlArchiveOptions(const Settings &settings)
+{
+	UrlArchive::Options options;
+	options._keepFullDays = from_string<int>(settings.GetRawString("URL.KeepFullDays")).value_or(options._keepFullDays);
+	options._keepArchiveDays = from_string<int>(settings.GetRawString("URL.KeepArchiveDays")).value_or(options._keepArchiveDays);
+	options._batchSize = from_string<size_t>(settings.GetRawString("URL.RetentionBatch")).value_or(options._batchSize);
+	options._interval = std::chrono::seconds(from_string<int>(settings.GetRawString("URL.RetentionIntervalSec")).value_or(600));
+	options._vacuumPages = from_string<int>(settings.GetRawString("URL.VacuumPages")).value_or(options._vacuumPages);
+	options._switchAutoVacuum = settings.GetRawString("URL.SwitchAutoVacuum") == "true";
+	return options;
+}
+
+void Bot::Deliver(const ChatMessage &message)
+{
+	_xmpp->SendMessage(message.Body(), ""); // FIXME: unused arg
+
+	auto discord = std::atomic_load(&_discord);
+	if (discord && message.GetOrigin() != ChatMessage::Origin::Discord) {
+		discord->SendToDiscord(message.Body(), message.DiscordChannel());
+	}
 }
 
-void Bot::TunnelMessage(const ChatMessage &msg, const std::string &module_name)
+void Bot::TunnelMessage(const ChatMessage &msg, const InternedString &module_name)
 {
-	auto newMsg = msg;
-	newMsg._module_name = module_name;
-    OnMessage(newMsg);
+	OnMessage(msg.WithModule(module_name));
 }
 
 void Bot::SendDiscordPresense(const std::string &nick, const std::string &userid, bool online)
@@ -363,7 +565,7 @@ bool Bot::EnableHandler(std::shared_ptr<LemonHandler> &handler)
 		return false;
 	}
 
-	_chatEventHandlers.push_back(handler);
+	_router.AddHandler(handler);
 	LOG(INFO) << "Handler enabled: " << handler->GetName();
 	return true;
 }
@@ -375,7 +577,7 @@ const std::string Bot::GetHelp(const std::string &module) const
 	if (handler == _handlersByName.end())
 	{
 		std::string help = "Use !help %module_name%, where module_name is one of:";
-		for (auto handlerPtr : _chatEventHandlers)
+		for (const auto &handlerPtr : _router.GetHandlers())
 		{
 			help.append(" " + handlerPtr->GetName());
 		}
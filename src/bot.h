@@ -10,9 +10,15 @@
 
 #include "xmpphandler.h"
 #include "settings.h"
+#include "messagerouter.h"
+#include "handlerexecutor.h"
+#include "outboundqueue.h"
+#include "identityregistry.h"
 #include "handlers/lemonhandler.h"
+#include "handlers/util/migrations.h"
 
 class XMPPClient;
+class Discord;
 
 class Bot
 		: public XMPPHandler
@@ -33,19 +39,20 @@ public:
 
 	// XMPPHandler interface
 	void OnConnect() override;
-	void OnMessage(ChatMessage &msg) final;
+	void OnMessage(const ChatMessage &msg) final;
 	void OnPresence(const std::string &nick, const std::string &jid, bool online, const std::string &newNick) final;
 
 	// Nick/jid maps
 	std::string GetNickByJid(const std::string &jid) const final;
 	std::string GetJidByNick(const std::string &nick) const final;
+	UserID GetUserID(const std::string &jid) const final;
 	std::string GetDBPathPrefix() const final;
 	std::string GetOnlineUsers() const final;
 
 	// LemonBot interface
     void SendMessage(const std::string &message, const std::string &channel = "") final;
 	void SendMessage(const ChatMessage &message) final;
-	void TunnelMessage(const ChatMessage &msg, const std::string &module_name) final;
+	void TunnelMessage(const ChatMessage &msg, const InternedString &module_name) final;
     void SendDiscordPresense(const std::string &nick, const std::string &userid, bool online) final;
 
 	std::string GetRawConfigValue(const std::string &name) const final;
@@ -69,22 +76,52 @@ private:
 	bool EnableHandler(std::shared_ptr<LemonHandler> &handler);
 
 	// Global commands
+	typedef void (Bot::*GlobalCommand)(const ChatMessage &msg, const std::string &args);
+	class GlobalCommandEntry
+	{
+	public:
+		GlobalCommand _command;
+		bool _takesArguments; // Otherwise only matches whole message, "!die now" is plain text
+	};
+	void UptimeCommand(const ChatMessage &msg, const std::string &args);
+	void DieCommand(const ChatMessage &msg, const std::string &args);
+	void RestartCommand(const ChatMessage &msg, const std::string &args);
+	void ReloadCommand(const ChatMessage &msg, const std::string &args);
+	void HelpCommand(const ChatMessage &msg, const std::string &args);
+	void QueuesCommand(const ChatMessage &msg, const std::string &args);
+	void StatsCommand(const ChatMessage &msg, const std::string &args);
+	void MirrorToDiscord(const ChatMessage &msg);
+
+	static size_t GetHandlerThreads(const Settings &settings);
+	static OutboundQueue::Options GetOutboundOptions(const Settings &settings);
+	static StorageEngine::Options GetStorageOptions(const Settings &settings);
+	static UrlArchive::Options GetUrlArchiveOptions(const Settings &settings);
+	static HttpClient::Options GetHttpOptions(const Settings &settings);
+	void Deliver(const ChatMessage &message);
+
 	const std::string GetHelp(const std::string &module) const;
 
 private:
 	std::shared_ptr<XMPPClient> _xmpp;
 	Settings &_settings;
-	std::unordered_map<std::string, std::string> _nick2jid;
-	std::unordered_map<std::string, std::string> _jid2nick;
+	IdentityRegistry _identities;
 
-	std::list<std::shared_ptr<LemonHandler>> _chatEventHandlers;
+	MessageRouter _router;
 	std::list<std::shared_ptr<LemonHandler>> _allChatEventHandlers;
 
 	std::unordered_map<std::string, std::shared_ptr<LemonHandler>> _handlersByName;
+	std::unordered_map<std::string, GlobalCommandEntry> _globalCommands;
 
 	ExitCode _exitCode = ExitCode::Error;
 	std::chrono::system_clock::time_point _startTime;
-	std::chrono::system_clock::time_point _lastMessage;
-	std::mutex _sendMessageMutex;
-	int _sendMessageThrottle = 1;
+
+	// Background part may still run, stopped before storage is closed
+	std::unique_ptr<SchemaMigrations> _migrations;
+
+	// Read by outbound queue thread, use atomic_load/atomic_store
+	std::shared_ptr<Discord> _discord;
+	OutboundQueue _outbound;
+
+	// Keep last: drained before anything else is destroyed, handlers are destroyed in ~Bot before it
+	HandlerExecutor _executor;
 };
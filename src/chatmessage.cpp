@@ -0,0 +1,181 @@
+#include "chatmessage.h"
+
+#include "messagefeatures.h"
+
+ChatMessage::ChatMessage()
+	: _nick(internString(""))
+	, _jid(_nick)
+	, _body(_nick)
+	, _module(_nick)
+	, _discordChannel(_nick)
+{
+
+}
+
+ChatMessage::ChatMessage(const std::string &nick, const std::string &jid, const std::string &body, bool priv)
+	: ChatMessage(internString(nick), internString(jid), body, priv)
+{
+
+}
+
+ChatMessage::ChatMessage(InternedString nick, InternedString jid, const std::string &body, bool priv)
+	: _nick(std::move(nick))
+	, _jid(std::move(jid))
+	, _body(body.empty() ? internString("") : std::make_shared<const std::string>(body))
+	, _module(internString(""))
+	, _discordChannel(_module)
+	, _isPrivate(priv)
+{
+
+}
+
+ChatMessage ChatMessage::FromBot(const std::string &body, const std::string &discordChannel)
+{
+	return ChatMessage("", "", body, false)
+			.WithOrigin(Origin::Bot)
+			.WithDiscordChannel(discordChannel);
+}
+
+ChatMessage ChatMessage::WithBody(std::string body) const
+{
+	auto result = *this;
+	result._body = std::make_shared<const std::string>(std::move(body));
+	result._features.reset();
+	return result;
+}
+
+ChatMessage ChatMessage::WithJid(const std::string &jid) const
+{
+	return WithJid(internString(jid));
+}
+
+ChatMessage ChatMessage::WithJid(InternedString jid) const
+{
+	auto result = *this;
+	result._jid = std::move(jid);
+	return result;
+}
+
+ChatMessage ChatMessage::WithModule(const std::string &module) const
+{
+	return WithModule(internString(module));
+}
+
+ChatMessage ChatMessage::WithModule(InternedString module) const
+{
+	auto result = *this;
+	result._module = std::move(module);
+	return result;
+}
+
+ChatMessage ChatMessage::WithDiscordChannel(const std::string &channel) const
+{
+	return WithDiscordChannel(internString(channel));
+}
+
+ChatMessage ChatMessage::WithDiscordChannel(InternedString channel) const
+{
+	auto result = *this;
+	result._discordChannel = std::move(channel);
+	return result;
+}
+
+ChatMessage ChatMessage::WithAdmin(bool isAdmin) const
+{
+	auto result = *this;
+	result._isAdmin = isAdmin;
+	return result;
+}
+
+ChatMessage ChatMessage::WithDiscordEmbed(bool hasEmbed) const
+{
+	auto result = *this;
+	result._hasDiscordEmbed = hasEmbed;
+	return result;
+}
+
+ChatMessage ChatMessage::WithOrigin(Origin origin) const
+{
+	auto result = *this;
+	result._origin = origin;
+	return result;
+}
+
+ChatMessage ChatMessage::WithFeatures(std::shared_ptr<const MessageFeatures> features) const
+{
+	auto result = *this;
+	result._features = std::move(features);
+	return result;
+}
+
+std::shared_ptr<const MessageFeatures> ChatMessage::Features() const
+{
+	return _features ? _features : MessageFeatures::Extract(Body());
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+TEST(ChatMessage, Defaults)
+{
+	ChatMessage empty;
+	EXPECT_TRUE(empty.Nick().empty());
+	EXPECT_TRUE(empty.Body().empty());
+	EXPECT_TRUE(empty.Module().empty());
+	EXPECT_FALSE(empty.IsAdmin());
+	EXPECT_EQ(ChatMessage::Origin::Unknown, empty.GetOrigin());
+
+	auto fromBot = ChatMessage::FromBot("reply", "123");
+	EXPECT_EQ("reply", fromBot.Body());
+	EXPECT_EQ("123", fromBot.DiscordChannel());
+	EXPECT_EQ(ChatMessage::Origin::Bot, fromBot.GetOrigin());
+}
+
+TEST(ChatMessage, SharedStrings)
+{
+	ChatMessage first("nick", "jid@example.com", "body", false);
+	ChatMessage second("nick", "jid@example.com", "other body", true);
+
+	// Interned
+	EXPECT_EQ(first.Nick().data(), second.Nick().data());
+	EXPECT_EQ(first.Jid().data(), second.Jid().data());
+
+	// Derived messages share text and keep everything not overridden
+	auto derived = first.WithModule("discord").WithAdmin(true).WithOrigin(ChatMessage::Origin::Discord);
+	EXPECT_EQ(first.Body().data(), derived.Body().data());
+	EXPECT_EQ("nick", derived.Nick());
+	EXPECT_EQ("discord", derived.Module());
+	EXPECT_TRUE(derived.IsAdmin());
+	EXPECT_EQ(ChatMessage::Origin::Discord, derived.GetOrigin());
+
+	EXPECT_TRUE(first.Module().empty());
+	EXPECT_FALSE(first.IsAdmin());
+
+	auto rewritten = first.WithBody("new body");
+	EXPECT_EQ("new body", rewritten.Body());
+	EXPECT_EQ("body", first.Body());
+
+	// Already interned strings are passed through as is
+	auto module = internString("module");
+	EXPECT_EQ(module.get(), &first.WithModule(module).Module());
+	auto jid = internString("other@example.com");
+	EXPECT_EQ(jid.get(), &first.WithJid(jid).Jid());
+	EXPECT_EQ(jid.get(), &ChatMessage(internString("nick"), jid, "body", false).Jid());
+}
+
+TEST(ChatMessage, Features)
+{
+	auto features = MessageFeatures::Extract("!cmd", MessageFeatures::Command);
+	auto msg = ChatMessage("nick", "", "!cmd", false).WithFeatures(features);
+	EXPECT_EQ(features, msg.Features());
+	EXPECT_EQ(features, msg.WithModule("test").Features());
+
+	// Features describe the body they were computed from
+	auto rewritten = msg.WithBody("see http://example.com/");
+	EXPECT_NE(features, rewritten.Features());
+	EXPECT_TRUE(rewritten.Features()->Has(MessageFeatures::URLs));
+	EXPECT_FALSE(rewritten.Features()->Has(MessageFeatures::Command));
+}
+
+#endif // LCOV_EXCL_STOP
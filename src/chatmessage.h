@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "stringpool.h"
+
+class MessageFeatures;
+
+/**
+ * Immutable chat message. Text is shared between copies and nicks, jids,
+ * module and channel names are interned, so copying a message or deriving
+ * one with different metadata (With* methods) doesn't copy strings
+ *
+ * Overloads taking std::string intern it, which locks the global pool: use
+ * them where messages enter the bot, pass InternedString everywhere after
+ */
+class ChatMessage
+{
+public:
+	enum class Origin {
+		Unknown,
+		XMPP,
+		Discord,
+		Bot,
+	};
+
+	ChatMessage();
+	ChatMessage(const std::string &nick,
+	            const std::string &jid,
+	            const std::string &body,
+	            bool priv);
+	ChatMessage(InternedString nick,
+	            InternedString jid,
+	            const std::string &body,
+	            bool priv);
+
+	/**
+	 * @brief Message sent by the bot itself
+	 */
+	static ChatMessage FromBot(const std::string &body, const std::string &discordChannel = "");
+
+	const std::string &Nick() const { return *_nick; }
+	const std::string &Jid() const { return *_jid; }
+	const std::string &Body() const { return *_body; }
+	const std::string &Module() const { return *_module; }
+	const std::string &DiscordChannel() const { return *_discordChannel; }
+
+	bool IsPrivate() const { return _isPrivate; }
+	bool IsAdmin() const { return _isAdmin; }
+	bool HasDiscordEmbed() const { return _hasDiscordEmbed; }
+	Origin GetOrigin() const { return _origin; }
+
+	/**
+	 * @brief Features attached by the bot, computed from body if message didn't pass through the router
+	 */
+	std::shared_ptr<const MessageFeatures> Features() const;
+
+	ChatMessage WithBody(std::string body) const;
+	ChatMessage WithJid(const std::string &jid) const;
+	ChatMessage WithJid(InternedString jid) const;
+	ChatMessage WithModule(const std::string &module) const;
+	ChatMessage WithModule(InternedString module) const;
+	ChatMessage WithDiscordChannel(const std::string &channel) const;
+	ChatMessage WithDiscordChannel(InternedString channel) const;
+	ChatMessage WithAdmin(bool isAdmin) const;
+	ChatMessage WithDiscordEmbed(bool hasEmbed) const;
+	ChatMessage WithOrigin(Origin origin) const;
+	ChatMessage WithFeatures(std::shared_ptr<const MessageFeatures> features) const;
+
+private:
+	InternedString _nick;
+	InternedString _jid;
+	std::shared_ptr<const std::string> _body;
+	InternedString _module;
+	InternedString _discordChannel;
+	std::shared_ptr<const MessageFeatures> _features;
+
+	bool _isPrivate = false;
+	bool _isAdmin = false;
+	bool _hasDiscordEmbed = false;
+	Origin _origin = Origin::Unknown;
+};
+
+/**
+ * @brief Handle messages are passed through the bot by
+ */
+typedef std::shared_ptr<const ChatMessage> ChatMessagePtr;
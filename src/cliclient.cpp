@@ -78,11 +78,7 @@ void ConsoleClient::SendMessage(const std::string &message, const std::string &r
 
 void ConsoleClient::FakeMessage(const std::string &message)
 {
-	ChatMessage msg;
-	msg._body = message;
-	msg._nick = _nick;
-	msg._isAdmin = true;
-	_handler->OnMessage(msg);
+	_handler->OnMessage(ChatMessage(_nick, "", message, false).WithAdmin(true));
 }
 
 void ConsoleClient::FakeJoin(const std::string &nick, const std::string &jid)
@@ -98,8 +98,8 @@ void GlooxClient::handleMessage(const gloox::Message &msg, gloox::MessageSession
 	}
 
 	ChatMessage message(msg.from().resource(), "", msg.body(), false);
-	if (message._nick == _room->nick()
-			|| message._nick.empty())
+	if (message.Nick() == _room->nick()
+			|| message.Nick().empty())
 	{
 #ifdef EVENT_LOGGING
 	LOG(INFO) << "Message: " << msg.body() << " ignored because it's ours or has empty nick";
@@ -107,8 +107,7 @@ void GlooxClient::handleMessage(const gloox::Message &msg, gloox::MessageSession
 		return;
 	}
 
-	message._origin = ChatMessage::Origin::XMPP;
-	_handler->OnMessage(message);
+	_handler->OnMessage(message.WithOrigin(ChatMessage::Origin::XMPP));
 }
 
 void GlooxClient::handleMUCParticipantPresence(gloox::MUCRoom *room, const gloox::MUCRoomParticipant participant, const gloox::Presence &presence)
@@ -132,9 +131,9 @@ void GlooxClient::handleMUCMessage(gloox::MUCRoom *room, const gloox::Message &m
 	}
 
 	ChatMessage message(msg.from().resource(), "", msg.body(), priv);
-	if (message._nick == _room->nick()
-			|| message._nick.empty()
-			|| message._isPrivate)
+	if (message.Nick() == _room->nick()
+			|| message.Nick().empty()
+			|| message.IsPrivate())
 	{
 #ifdef EVENT_LOGGING
 	LOG(INFO) << "MUCMessage: " << msg.body() << " ignored because it's private, ours or has empty nick";
@@ -142,8 +141,7 @@ void GlooxClient::handleMUCMessage(gloox::MUCRoom *room, const gloox::Message &m
 		return;
 	}
 
-	message._origin = ChatMessage::Origin::XMPP;
-	_handler->OnMessage(message);
+	_handler->OnMessage(message.WithOrigin(ChatMessage::Origin::XMPP));
 }
 
 void GlooxClient::handleMUCError(gloox::MUCRoom *room, gloox::StanzaError error)
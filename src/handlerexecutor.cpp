@@ -0,0 +1,322 @@
+#include "handlerexecutor.h"
+
+#include <glog/logging.h>
+
+#include "handlers/util/thread_util.h"
+
+class HandlerExecutor::Task
+{
+public:
+	std::shared_ptr<LemonHandler> _handler;
+	std::shared_ptr<const Job> _job; // Same for every handler of the route
+	std::chrono::steady_clock::time_point _dispatched;
+};
+
+class HandlerExecutor::Queue
+{
+public:
+	std::string _name;
+	HandlerMetrics *_metrics = nullptr;
+	std::deque<Task> _tasks;
+	bool _busy = false;
+	bool _scheduled = false;
+
+	size_t _processed = 0;
+	std::chrono::steady_clock::duration _totalWait{0};
+	std::chrono::steady_clock::duration _maxWait{0};
+};
+
+HandlerExecutor::HandlerExecutor(size_t threads, Metrics *metrics)
+	: _metrics(metrics)
+{
+	if (threads == 0)
+		threads = 1;
+
+	for (size_t i = 0; i < threads; i++)
+	{
+		_workers.emplace_back(&HandlerExecutor::WorkerThread, this);
+		nameThread(_workers.back(), "Handler worker");
+	}
+}
+
+HandlerExecutor::~HandlerExecutor()
+{
+	Drain();
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+	_wakeup.notify_all();
+
+	for (auto &worker : _workers)
+		worker.join();
+}
+
+void HandlerExecutor::Dispatch(const MessageRouter::Route &route, Job job)
+{
+	if (route.empty())
+		return;
+
+	auto sharedJob = std::make_shared<const Job>(std::move(job));
+	const auto dispatched = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (const auto &handler : route)
+	{
+		auto &queue = _queues[handler.get()];
+		if (!queue)
+		{
+			queue = std::make_unique<Queue>();
+			queue->_name = handler->GetName();
+			if (_metrics)
+				queue->_metrics = &_metrics->GetHandler(queue->_name);
+		}
+
+		queue->_tasks.push_back({handler, sharedJob, dispatched});
+		_activeTasks++;
+		Schedule(queue.get());
+	}
+}
+
+void HandlerExecutor::Drain()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle.wait(lock, [this]{ return _activeTasks == 0; });
+}
+
+void HandlerExecutor::Reset()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle.wait(lock, [this]{ return _activeTasks == 0; });
+	_queues.clear();
+}
+
+std::vector<HandlerExecutor::QueueStats> HandlerExecutor::GetStats() const
+{
+	using namespace std::chrono;
+	std::vector<QueueStats> result;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (const auto &queue : _queues)
+	{
+		QueueStats stats;
+		stats._name = queue.second->_name;
+		stats._depth = queue.second->_tasks.size() + (queue.second->_busy ? 1 : 0);
+		stats._processed = queue.second->_processed;
+		if (stats._processed > 0)
+			stats._averageWait = duration_cast<microseconds>(queue.second->_totalWait / stats._processed);
+		stats._maxWait = duration_cast<microseconds>(queue.second->_maxWait);
+		result.push_back(stats);
+	}
+
+	return result;
+}
+
+// Must be called with _mutex held
+void HandlerExecutor::Schedule(Queue *queue)
+{
+	if (queue->_busy || queue->_scheduled || queue->_tasks.empty())
+		return;
+
+	queue->_scheduled = true;
+	_ready.push_back(queue);
+	_wakeup.notify_one();
+}
+
+void HandlerExecutor::WorkerThread()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_wakeup.wait(lock, [this]{ return !_running || !_ready.empty(); });
+		if (_ready.empty())
+			return;
+
+		auto *queue = _ready.front();
+		_ready.pop_front();
+
+		auto task = std::move(queue->_tasks.front());
+		queue->_tasks.pop_front();
+		queue->_scheduled = false;
+		queue->_busy = true;
+
+		auto wait = std::chrono::steady_clock::now() - task._dispatched;
+		queue->_totalWait += wait;
+		queue->_maxWait = std::max(queue->_maxWait, wait);
+		lock.unlock();
+
+		const auto started = std::chrono::steady_clock::now();
+		try {
+			(*task._job)(*task._handler);
+		} catch (std::exception &e) {
+			LOG(ERROR) << "Handler " << task._handler->GetName() << " failed: " << e.what();
+			if (queue->_metrics)
+				queue->_metrics->_errors.Increment();
+		}
+
+		if (queue->_metrics)
+		{
+			queue->_metrics->_calls.Increment();
+			queue->_metrics->_latency.Record(std::chrono::steady_clock::now() - started);
+		}
+
+		// Handler may be the last owner of itself, release it outside of the lock
+		task = Task();
+
+		lock.lock();
+		queue->_busy = false;
+		queue->_processed++;
+
+		if (--_activeTasks == 0)
+			_idle.notify_all();
+
+		Schedule(queue);
+	}
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+
+class ExecutorTestHandler : public LemonHandler
+{
+public:
+	explicit ExecutorTestHandler(const std::string &name)
+		: LemonHandler(name, nullptr)
+	{ }
+
+	ProcessingResult HandleMessage(const ChatMessage &msg) final
+	{
+		_seen.push_back(msg.Body());
+		return msg.Body() == "stop" ? ProcessingResult::StopProcessing : ProcessingResult::KeepGoing;
+	}
+
+	std::vector<std::string> _seen;
+};
+
+static HandlerExecutor::Job MessageJob(const std::string &body)
+{
+	ChatMessage msg("nick", "", body, false);
+	return [msg](LemonHandler &handler) { return handler.HandleMessage(msg); };
+}
+
+TEST(HandlerExecutor, Order)
+{
+	auto first = std::make_shared<ExecutorTestHandler>("first");
+	auto second = std::make_shared<ExecutorTestHandler>("second");
+
+	HandlerExecutor executor(4);
+	MessageRouter::Route route = {first, second};
+	MessageRouter::Route secondOnly = {second};
+
+	std::vector<std::string> expectedFirst;
+	std::vector<std::string> expectedSecond;
+	for (int i = 0; i < 100; i++)
+	{
+		// Result doesn't cancel the job for other handlers, MessageRouter::Select decides that
+		auto body = i % 10 == 0 ? "stop" : std::to_string(i);
+		executor.Dispatch(route, MessageJob(body));
+		expectedFirst.push_back(body);
+		expectedSecond.push_back(body);
+
+		if (i % 7 == 0)
+		{
+			executor.Dispatch(secondOnly, MessageJob("direct" + std::to_string(i)));
+			expectedSecond.push_back("direct" + std::to_string(i));
+		}
+	}
+
+	executor.Drain();
+	EXPECT_EQ(expectedFirst, first->_seen);
+	EXPECT_EQ(expectedSecond, second->_seen);
+
+	auto stats = executor.GetStats();
+	ASSERT_EQ(2, stats.size());
+	for (const auto &queue : stats)
+	{
+		EXPECT_EQ(0, queue._depth);
+		EXPECT_EQ(queue._name == "first" ? expectedFirst.size() : expectedSecond.size(), queue._processed);
+	}
+}
+
+TEST(HandlerExecutor, SlowHandlerDoesNotBlockOthers)
+{
+	auto slow = std::make_shared<ExecutorTestHandler>("slow");
+	auto fast = std::make_shared<ExecutorTestHandler>("fast");
+
+	HandlerExecutor executor(2);
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	std::atomic<bool> fastDone{false};
+
+	executor.Dispatch({slow}, [released](LemonHandler &) {
+		released.wait();
+		return LemonHandler::ProcessingResult::KeepGoing;
+	});
+	executor.Dispatch({fast}, [&fastDone](LemonHandler &) {
+		fastDone = true;
+		return LemonHandler::ProcessingResult::KeepGoing;
+	});
+
+	for (int i = 0; i < 1000 && !fastDone; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_TRUE(fastDone);
+	release.set_value();
+	executor.Drain();
+}
+
+TEST(HandlerExecutor, SlowHandlerDoesNotBlockItsRoute)
+{
+	auto slow = std::make_shared<ExecutorTestHandler>("slow");
+	auto fast = std::make_shared<ExecutorTestHandler>("fast");
+
+	HandlerExecutor executor(2);
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	std::atomic<int> fastDone{0};
+
+	// Same message goes to both, slow one is first in route
+	for (int i = 0; i < 3; i++)
+	{
+		executor.Dispatch({slow, fast}, [released, &fastDone](LemonHandler &handler) {
+			if (handler.GetName() == "slow")
+				released.wait();
+			else
+				fastDone++;
+			return LemonHandler::ProcessingResult::KeepGoing;
+		});
+	}
+
+	for (int i = 0; i < 1000 && fastDone < 3; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	EXPECT_EQ(3, fastDone);
+	release.set_value();
+	executor.Drain();
+}
+
+TEST(HandlerExecutor, Metrics)
+{
+	auto handler = std::make_shared<ExecutorTestHandler>("handler");
+
+	Metrics metrics;
+	HandlerExecutor executor(2, &metrics);
+
+	executor.Dispatch({handler}, MessageJob("ok"));
+	executor.Dispatch({handler}, [](LemonHandler &) -> LemonHandler::ProcessingResult {
+		throw std::runtime_error("failure");
+	});
+	executor.Drain();
+
+	auto &handlerMetrics = metrics.GetHandler("handler");
+	EXPECT_EQ(2, handlerMetrics._calls.Get());
+	EXPECT_EQ(1, handlerMetrics._errors.Get());
+	EXPECT_EQ(2, handlerMetrics._latency.GetCount());
+}
+
+#endif // LCOV_EXCL_STOP
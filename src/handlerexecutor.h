@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "messagerouter.h"
+#include "handlers/lemonhandler.h"
+#include "handlers/util/metrics.h"
+
+/**
+ * Runs handlers on a worker pool. Every handler has its own serial queue,
+ * so a handler never runs concurrently with itself and sees events in the
+ * order they were dispatched, while different handlers run in parallel.
+ * Queues don't wait for each other, even for the same message
+ */
+class HandlerExecutor
+{
+public:
+	typedef std::function<LemonHandler::ProcessingResult(LemonHandler &handler)> Job;
+
+	/**
+	 * @param metrics If set, every job is timed and counted there under its handler name
+	 */
+	explicit HandlerExecutor(size_t threads, Metrics *metrics = nullptr);
+	~HandlerExecutor();
+
+	/**
+	 * @brief Queue job for every handler of the route, each one runs it on its own
+	 * Who gets the message is decided before, see MessageRouter::Select
+	 */
+	void Dispatch(const MessageRouter::Route &route, Job job);
+
+	/**
+	 * @brief Block until every dispatched job is finished
+	 */
+	void Drain();
+
+	/**
+	 * @brief Drain and forget all handler queues, call before handlers are destroyed
+	 */
+	void Reset();
+
+	class QueueStats
+	{
+	public:
+		std::string _name;
+		size_t _depth = 0;
+		size_t _processed = 0;
+		std::chrono::microseconds _averageWait{0};
+		std::chrono::microseconds _maxWait{0};
+	};
+
+	std::vector<QueueStats> GetStats() const;
+
+private:
+	class Task;
+	class Queue;
+
+	void WorkerThread();
+	void Schedule(Queue *queue);
+
+	Metrics *const _metrics;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::condition_variable _idle;
+
+	std::unordered_map<const LemonHandler *, std::unique_ptr<Queue>> _queues;
+	std::deque<Queue *> _ready;
+	size_t _activeTasks = 0;
+	bool _running = true;
+
+	std::vector<std::thread> _workers;
+};
@@ -107,12 +107,13 @@ std::vector<std::string> GetDiceTokens(std::string rawInput)
 DiceRoller::DiceRoller(LemonBot *bot)
 	: LemonHandler("dice", bot)
 {
+	SetPassiveTraffic(PassiveTraffic::PlainText); // rolls start with "."
 	ResetRNG();
 }
 
 LemonHandler::ProcessingResult DiceRoller::HandleMessage(const ChatMessage &msg)
 {
-	auto diceTokens = GetDiceTokens(msg._body);
+	auto diceTokens = GetDiceTokens(msg.Body());
 
 	if (diceTokens.empty())
 		return ProcessingResult::KeepGoing;
@@ -180,11 +181,17 @@ LemonHandler::ProcessingResult DiceRoller::HandleMessage(const ChatMessage &msg)
 	if (diceTokens.size() > 1)
 		resultDescription.append("= " + std::to_string(result));
 
-	SendMessage(msg._nick + ": " + resultDescription, msg._discordChannel);
+	SendMessage(msg.Nick() + ": " + resultDescription, msg.DiscordChannel());
 
 	return ProcessingResult::StopProcessing;
 }
 
+bool DiceRoller::ClaimsMessage(const ChatMessage &msg) const
+{
+	// Rolls are not passed on, even ones that turn out to be invalid
+	return !GetDiceTokens(msg.Body()).empty();
+}
+
 const std::string DiceRoller::GetHelp() const
 {
 	return "Start your message with . (dot) and write an expression using integer numbers, dice"
@@ -11,6 +11,7 @@ class DiceRoller : public LemonHandler
 public:
 	explicit DiceRoller(LemonBot *bot);
 	ProcessingResult HandleMessage(const ChatMessage &msg) final;
+	bool ClaimsMessage(const ChatMessage &msg) const final;
 	const std::string GetHelp() const override;
 
 private:
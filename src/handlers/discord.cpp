@@ -10,40 +10,49 @@
 #include <glog/logging.h>
 #include "util/stringops.h"
 
-#include <cpr/cpr.h>
-
 #include <boost/algorithm/string/replace.hpp>
 
 Discord::Discord(LemonBot *bot)
 	: LemonHandler("discord", bot)
 {
+	RegisterCommands({"!discord", "!jabber", "!xmpp"});
+	SetPassiveTraffic(PassiveTraffic::All); // everything is mirrored to discord
 
+	HttpClient::Limits limits;
+	limits._concurrency = 1; // keeps webhook messages in order
+	SetHttpLimits(limits);
 }
 
 LemonHandler::ProcessingResult Discord::HandleMessage(const ChatMessage &msg)
 {
-	if (msg._module_name != GetName()) {
+	if (msg.Module() != GetName()) {
 		if (!_webhookURL.empty()) {
 			//FIXME: empty ID map crashes the bot
-			auto mappedId = GetRawConfigValue("discord.idmap", msg._jid);
+			auto mappedId = GetRawConfigValue("discord.idmap", msg.Jid());
 
 			std::string avatar_url;
 			if (!_users[mappedId]._avatar.empty()) {
 				avatar_url = "https://cdn.discordapp.com/avatars/" + mappedId + "/" + _users[mappedId]._avatar + ".png";
 			}
-			cpr::Post(cpr::Url{_webhookURL},
-					  cpr::Payload{
-						  {"username", msg._nick},
-						  {"content", sanitizeDiscord(msg._body)},
-						  {"avatar_url", avatar_url}
-					  });
+			HttpRequest request{"POST", _webhookURL};
+			request._body = HttpClient::FormBody({
+													 {"username", msg.Nick()},
+													 {"content", sanitizeDiscord(msg.Body())},
+													 {"avatar_url", avatar_url}
+												 });
+
+			auto &metrics = getMetrics();
+			httpRequest(std::move(request), [&metrics](HttpResponse response) {
+				if (response._status == 0 || response._status >= 400)
+					metrics._discordRestFailures.Increment();
+			});
 
 		} else if (_channelID != 0) {
-            rclientSafeSend(msg._body, "");
+            rclientSafeSend(msg.Body(), "");
 		}
 	}
 
-	if (msg._body == "!discord") {
+	if (msg.Body() == "!discord") {
 		std::string result = "Discord users:";
 
 		for (const auto &user : _users) {
@@ -61,12 +70,12 @@ LemonHandler::ProcessingResult Discord::HandleMessage(const ChatMessage &msg)
 		return LemonHandler::ProcessingResult::StopProcessing;
 	}
 
-	if ((msg._body == "!jabber" || msg._body == "!xmpp")
-			&& msg._module_name == "discord") {
+	if ((msg.Body() == "!jabber" || msg.Body() == "!xmpp")
+			&& msg.Module() == "discord") {
 		//SendMessage(_botPtr->GetOnlineUsers());
         rclientSafeSend("\n" + _botPtr->GetOnlineUsers()
                         + "\n`this message is invisible to xmpp users to avoid highlighting`",
-                        msg._discordChannel);
+                        msg.DiscordChannel());
 		return ProcessingResult::StopProcessing;
 	}
 
@@ -116,8 +125,10 @@ void Discord::rclientSafeSend(const std::string &message, const std::string &cha
 		}
 	} catch (Hexicord::RESTError &e) {
 		LOG(ERROR) << "Failed to deliver message \"" << message << "\" via REST, REST error: " << e.what();
+		getMetrics()._discordRestFailures.Increment();
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to deliver message \"" << message << "\" via REST: " << e.what();
+		getMetrics()._discordRestFailures.Increment();
 	}
 }
 
@@ -148,15 +159,14 @@ void Discord::createRole(Hexicord::Snowflake guildid, const std::string &rolenam
 			o << guildid.value;
 
 			auto url = "https://discordapp.com/api/guilds/" + o.str() + "/roles";
-			cpr::Response response = cpr::Post(cpr::Url{url},
-											   cpr::Header{{"Authorization"
-														   , "Bot " + rclient->token}},
-											   cpr::Body{newRole.dump()});
+			auto response = httpRequest({"POST", url,
+										 {"Authorization: Bot " + rclient->token},
+										 newRole.dump()}).get();
 
-			LOG(WARNING) << response.status_code;
-			LOG(WARNING) << response.text;
+			LOG(WARNING) << response._status;
+			LOG(WARNING) << response._body;
 
-			nlohmann::json newroleresult = nlohmann::json::parse(response.text);
+			nlohmann::json newroleresult = nlohmann::json::parse(response._body);
 
 			//auto newroleresult = rclient->createRole(guildid, newRole);
 			roleid = newroleresult["id"].get<std::string>();
@@ -184,13 +194,12 @@ void Discord::createRole(Hexicord::Snowflake guildid, const std::string &rolenam
 		nlohmann::json newrolestuff;
 		newrolestuff["roles"] = oldroles;
 
-		cpr::Response response = cpr::Patch(cpr::Url{url},
-										   cpr::Header{{"Authorization"
-													   , "Bot " + rclient->token},
-											{"Content-Type", "application/json"}},
-										  cpr::Body{newrolestuff.dump()});
+		auto response = httpRequest({"PATCH", url,
+									 {"Authorization: Bot " + rclient->token,
+									  "Content-Type: application/json"},
+									 newrolestuff.dump()}).get();
 
-		LOG(INFO) << "Role added:" << response.status_code;
+		LOG(INFO) << "Role added:" << response._status;
 
 		//rclient->setMemberRoles(guildid, userid, newRoles);
 	} catch (nlohmann::json::parse_error& e) {
@@ -199,6 +208,7 @@ void Discord::createRole(Hexicord::Snowflake guildid, const std::string &rolenam
 				   << "Byte: " << e.byte;
 	} catch (std::exception &e) {
 		LOG(ERROR) << e.what();
+		getMetrics()._discordRestFailures.Increment();
 	}
 }
 
@@ -322,21 +332,16 @@ bool Discord::Init()
 			}
 
 
-			ChatMessage jabberTunneledMessage;
-			jabberTunneledMessage._body = channelName + "<" + _users[id]._nick + "> " + text;
-			jabberTunneledMessage._origin = ChatMessage::Origin::Discord;
-			if (mirror) this->SendMessage(jabberTunneledMessage);
-
-			ChatMessage msg;
-			msg._nick = _users[id]._nick;
-			msg._body = text;
-			msg._jid = _users[id]._username;
-			msg._isAdmin = senderId == ownerId;
-			msg._isPrivate = false;
-			msg._hasDiscordEmbed = hasEmbeds;
-			msg._origin = ChatMessage::Origin::Discord;
-			msg._discordChannel = json["channel_id"].get<std::string>();
-			this->TunnelMessage(msg);
+			if (mirror) {
+				this->SendMessage(ChatMessage::FromBot(channelName + "<" + _users[id]._nick + "> " + text)
+								  .WithOrigin(ChatMessage::Origin::Discord));
+			}
+
+			this->TunnelMessage(ChatMessage(_users[id]._nick, _users[id]._username, text, false)
+								.WithAdmin(senderId == ownerId)
+								.WithDiscordEmbed(hasEmbeds)
+								.WithOrigin(ChatMessage::Origin::Discord)
+								.WithDiscordChannel(json["channel_id"].get<std::string>()));
 		} catch (std::exception &e) {
 			LOG(ERROR) << e.what();
 		}
@@ -89,6 +89,18 @@ void httpHandler(evhttp_request *request, void *arg) {
 	}
 }
 
+void metricsHandler(evhttp_request *request, void *arg) {
+	GithubWebhooks * parent = static_cast<GithubWebhooks*>(arg);
+
+	// Built from atomics only, scraping doesn't wait for handlers
+	const auto text = parent->getMetrics().FormatPrometheus();
+
+	auto *output = evhttp_request_get_output_buffer(request);
+	evbuffer_add(output, text.data(), text.size());
+	evhttp_add_header(evhttp_request_get_output_headers(request), "Content-Type", "text/plain; version=0.0.4");
+	evhttp_send_reply(request, HTTP_OK, "OK", output);
+}
+
 void terminateServer(int, short int, void * arg)
 {
 	GithubWebhooks * parent = static_cast<GithubWebhooks*>(arg);
@@ -108,6 +120,7 @@ void httpServerThread(GithubWebhooks * parent, std::uint16_t port)
 		return;
 	}
 	evhttp_set_gencb(parent->_evhttp , httpHandler, parent);
+	evhttp_set_cb(parent->_evhttp, "/metrics", metricsHandler, parent);
 
 	evthread_use_pthreads();
 	evthread_make_base_notifiable(parent->_eventBase);
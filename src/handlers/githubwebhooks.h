@@ -30,4 +30,5 @@ private:
 	friend void terminateServer(int, short int, void *arg);
 	friend void httpServerThread(GithubWebhooks * parent, std::uint16_t port);
 	friend void httpHandler(evhttp_request *request, void *arg);
+	friend void metricsHandler(evhttp_request *request, void *arg);
 };
@@ -7,31 +7,38 @@
 
 namespace {
 	std::string response = "https://youtu.be/WgYhYw-lS_s";
+
+	bool hasMagicPhrase(const ChatMessage &msg)
+	{
+		static const std::list<std::string> magicPhrases = {
+			"так сойдет",
+			"так сойдёт",
+			"пока так",
+			"потом поправлю",
+			"good enough"
+		};
+
+		const auto features = msg.Features();
+		const auto &lowercase = features->_lowercaseBody;
+
+		return std::any_of(magicPhrases.begin(), magicPhrases.end(), [&lowercase](const std::string &phrase) {
+			return lowercase.find(phrase) != lowercase.npos;
+		});
+	}
 }
 
 LemonHandler::ProcessingResult GoodEnough::HandleMessage(const ChatMessage &msg)
 {
-	static std::list<std::string> magicPhrases = {
-		"так сойдет",
-		"так сойдёт",
-		"пока так",
-		"потом поправлю",
-		"good enough"
-	};
-
-	auto lowercase = toLower(msg._body);
+	if (!hasMagicPhrase(msg))
+		return ProcessingResult::KeepGoing;
 
-	for (auto &phrase : magicPhrases)
-	{
-		auto loc = lowercase.find(phrase);
-		if (loc != lowercase.npos)
-		{
-			SendMessage(msg._nick + ": " + response, msg._discordChannel);
-			return ProcessingResult::StopProcessing;
-		}
-	}
+	SendMessage(msg.Nick() + ": " + response, msg.DiscordChannel());
+	return ProcessingResult::StopProcessing;
+}
 
-	return ProcessingResult::KeepGoing;
+bool GoodEnough::ClaimsMessage(const ChatMessage &msg) const
+{
+	return hasMagicPhrase(msg);
 }
 
 #ifdef _BUILD_TESTS // LCOV_EXCL_START
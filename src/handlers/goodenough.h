@@ -5,6 +5,11 @@
 class GoodEnough : public LemonHandler
 {
 public:
-	explicit GoodEnough(LemonBot *bot) : LemonHandler("goodenough", bot) {}
+	explicit GoodEnough(LemonBot *bot) : LemonHandler("goodenough", bot)
+	{
+		SetPassiveTraffic(PassiveTraffic::PlainText);
+		RequestFeatures(MessageFeatures::Lowercase);
+	}
 	ProcessingResult HandleMessage(const ChatMessage &msg) final;
+	bool ClaimsMessage(const ChatMessage &msg) const final;
 };
@@ -2,14 +2,36 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <ctime>
+#include <vector>
 
 #include "util/stringops.h"
+#include "util/thread_util.h"
 
 LastSeen::LastSeen(LemonBot *bot)
 	: LemonHandler("seen", bot)
+	, _flushInterval(from_string<int>(GetRawConfigValue("Seen.FlushIntervalSec")).value_or(5))
+	, _maxStaleness(from_string<int>(GetRawConfigValue("Seen.MaxStalenessSec")).value_or(30))
+	, _cacheSize(from_string<size_t>(GetRawConfigValue("Seen.CacheSize")).value_or(5000))
 {
+	RegisterCommands({"!seen", "!seenstat"});
+	SetPassiveTraffic(PassiveTraffic::All); // activity is tracked for every message
 
+	_flushThread = std::thread(&LastSeen::FlushThread, this);
+	nameThread(_flushThread, "Seen flusher");
+}
+
+LastSeen::~LastSeen()
+{
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		_isRunning = false;
+	}
+	_flushWakeup.notify_one();
+	_flushThread.join();
+
+	Flush();
 }
 
 LemonHandler::ProcessingResult LastSeen::HandleMessage(const ChatMessage &msg)
@@ -18,30 +40,27 @@ LemonHandler::ProcessingResult LastSeen::HandleMessage(const ChatMessage &msg)
 	auto now_t = std::chrono::system_clock::to_time_t(now);
 
 	try {
-		if (auto userRecord = getStorage().get_no_throw<DB::UserActivity>(msg._jid)) {
-			userRecord->nick = msg._nick;
-			userRecord->message = msg._body;
-			userRecord->timepoint_message = now_t;
-			getStorage().update(*userRecord);
-		} else {
-			getStorage().replace(DB::UserActivity{msg._jid, msg._nick, msg._body, static_cast<int>(now_t), static_cast<int>(now_t)});
-		}
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		auto &activity = GetActivity(msg.Jid());
+		activity._record.nick = msg.Nick();
+		activity._record.message = msg.Body();
+		activity._record.timepoint_message = static_cast<int>(now_t);
+		MarkChanged(activity._dirty);
 	} catch (std::exception &e) {
-		// get_no_throws throws? debug this
 		LOG(ERROR) << e.what();
 	}
 
-	if (msg._body == "!seenstat")
+	if (msg.Body() == "!seenstat")
 	{
-        SendMessage(GetStats(), msg._discordChannel);
+        SendMessage(GetStats(), msg.DiscordChannel());
 		return ProcessingResult::KeepGoing;
 	}
 
 	std::string wantedUser;
-	if (!getCommandArguments(msg._body, "!seen", wantedUser))
+	if (!getCommandArguments(msg.Body(), "!seen", wantedUser))
 		return ProcessingResult::KeepGoing;
 
-    SendMessage(GetUserInfo(wantedUser), msg._discordChannel);
+    SendMessage(GetUserInfo(wantedUser), msg.DiscordChannel());
 	return ProcessingResult::KeepGoing;
 }
 
@@ -50,24 +69,198 @@ void LastSeen::HandlePresence(const std::string &from, const std::string &jid, b
 	auto now = std::chrono::system_clock::now();
 	auto now_t = std::chrono::system_clock::to_time_t(now);
 
-	using namespace sqlite_orm;
-	DB::Nick newNick{ from, jid };
-	getStorage().replace(newNick);
-
 	try {
-		if (auto userRecord = getStorage().get_no_throw<DB::UserActivity>(jid)) {
-			userRecord->nick = from;
-			userRecord->timepoint_status = now_t;
-			getStorage().update(*userRecord);
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		auto &nick = GetNick(from);
+		if (nick._jid != jid)
+		{
+			nick._jid = jid;
+			MarkChanged(nick._dirty);
 		} else {
-			getStorage().replace(DB::UserActivity{jid, from, "", static_cast<int>(now_t), static_cast<int>(now_t)});
+			getMetrics()._seenWritesAvoided.Increment();
 		}
+
+		auto &activity = GetActivity(jid);
+		activity._record.nick = from;
+		activity._record.timepoint_status = static_cast<int>(now_t);
+		MarkChanged(activity._dirty);
 	} catch (std::exception &e) {
-		// get_no_throws throws? debug this
 		LOG(ERROR) << e.what();
 	}
 }
 
+LastSeen::CachedActivity &LastSeen::GetActivity(const std::string &jid)
+{
+	auto cached = _activity.find(jid);
+	if (cached != _activity.end())
+	{
+		cached->second._used = ++_useCounter;
+		return cached->second;
+	}
+
+	auto &activity = _activity[jid];
+	activity._used = ++_useCounter;
+	if (auto userRecord = getStorage().get_no_throw<DB::UserActivity>(jid)) {
+		activity._record = *userRecord;
+	} else {
+		activity._record.uniqueID = jid;
+	}
+	return activity;
+}
+
+LastSeen::CachedNick &LastSeen::GetNick(const std::string &nick)
+{
+	auto cached = _nicks.find(nick);
+	if (cached != _nicks.end())
+	{
+		cached->second._used = ++_useCounter;
+		return cached->second;
+	}
+
+	auto &result = _nicks[nick];
+	result._used = ++_useCounter;
+	if (auto nickRecord = getStorage().get_no_throw<DB::Nick>(nick))
+		result._jid = nickRecord->uniqueID;
+	return result;
+}
+
+void LastSeen::MarkChanged(bool &dirty)
+{
+	if (dirty) {
+		getMetrics()._seenWritesAvoided.Increment(); // Goes into the same row write as the previous change
+	}
+	dirty = true;
+
+	if (!_oldestChange)
+	{
+		_oldestChange = std::chrono::steady_clock::now();
+		_flushWakeup.notify_one(); // Max staleness may come before next flush
+	}
+}
+
+void LastSeen::Flush()
+{
+	std::vector<DB::UserActivity> activities;
+	std::vector<DB::Nick> nicks;
+	std::optional<std::chrono::steady_clock::time_point> oldestChange;
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		for (auto &activity : _activity)
+		{
+			if (activity.second._dirty)
+				activities.push_back(activity.second._record);
+			activity.second._dirty = false;
+		}
+		for (auto &nick : _nicks)
+		{
+			if (nick.second._dirty)
+				nicks.push_back(DB::Nick{nick.first, nick.second._jid});
+			nick.second._dirty = false;
+		}
+		oldestChange = _oldestChange;
+		_oldestChange.reset();
+	}
+
+	if (!activities.empty() || !nicks.empty())
+	{
+		// Waits, so entries evicted below are already in storage when they are read again
+		try {
+			writeStorageAndWait([&activities, &nicks](Storage &storage) {
+				for (const auto &nick : nicks)
+					storage.replace(nick);
+				for (const auto &activity : activities)
+					storage.replace(activity);
+			});
+		} catch (std::exception &e) {
+			LOG(ERROR) << "Failed to save " << activities.size() << " activity records: " << e.what();
+			RestoreUnsaved(activities, nicks, oldestChange);
+			return; // Nothing may be evicted, cache holds the only copy
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+	Evict(_activity);
+	Evict(_nicks);
+}
+
+void LastSeen::RestoreUnsaved(const std::vector<DB::UserActivity> &activities, const std::vector<DB::Nick> &nicks,
+							  std::optional<std::chrono::steady_clock::time_point> oldestChange)
+{
+	std::lock_guard<std::mutex> lock(_cacheMutex);
+
+	// Entries changed since then are already dirty and newer, keep them
+	for (const auto &activity : activities)
+	{
+		auto &cached = _activity[activity.uniqueID];
+		if (!cached._dirty)
+		{
+			cached._record = activity;
+			cached._dirty = true;
+		}
+	}
+	for (const auto &nick : nicks)
+	{
+		auto &cached = _nicks[nick.nick];
+		if (!cached._dirty)
+		{
+			cached._jid = nick.uniqueID;
+			cached._dirty = true;
+		}
+	}
+
+	if (oldestChange && (!_oldestChange || *oldestChange < *_oldestChange))
+		_oldestChange = oldestChange;
+}
+
+// Must be called with _cacheMutex held
+template <class Cache> void LastSeen::Evict(Cache &cache)
+{
+	if (cache.size() <= _cacheSize)
+		return;
+
+	std::vector<typename Cache::iterator> saved;
+	for (auto entry = cache.begin(); entry != cache.end(); ++entry)
+		if (!entry->second._dirty)
+			saved.push_back(entry);
+
+	const auto count = std::min(saved.size(), cache.size() - _cacheSize);
+	std::nth_element(saved.begin(), saved.begin() + count, saved.end(), [](const auto &left, const auto &right) {
+		return left->second._used < right->second._used;
+	});
+
+	for (size_t i = 0; i < count; i++)
+		cache.erase(saved[i]);
+}
+
+void LastSeen::FlushThread()
+{
+	std::unique_lock<std::mutex> lock(_cacheMutex);
+	auto nextFlush = std::chrono::steady_clock::now() + _flushInterval;
+	while (_isRunning)
+	{
+		// Changes are saved every interval, and earlier if the oldest one would get too stale
+		auto wakeUp = nextFlush;
+		if (_oldestChange)
+			wakeUp = std::min(wakeUp, *_oldestChange + _maxStaleness);
+
+		_flushWakeup.wait_until(lock, wakeUp);
+		if (!_isRunning)
+			break;
+
+		const auto now = std::chrono::steady_clock::now();
+		const bool intervalPassed = now >= nextFlush;
+		if (intervalPassed)
+			nextFlush = now + _flushInterval;
+
+		if (_oldestChange && (intervalPassed || now - *_oldestChange >= _maxStaleness))
+		{
+			lock.unlock();
+			Flush();
+			lock.lock();
+		}
+	}
+}
+
 const std::string LastSeen::GetHelp() const
 {
 	return "Use !seen %nickname% or !seen %jid%; use !seen %regex% or !seenjid %regex% to search users by regex\n"
@@ -78,7 +271,8 @@ std::string LastSeen::GetStats()
 {
 	auto nick_count = getStorage().count<DB::Nick>();
 	auto user_count = getStorage().count<DB::UserActivity>();
-	return "Seen nicks: " + std::to_string(nick_count) + " | Seen users: " + std::to_string(user_count);
+	return "Seen nicks: " + std::to_string(nick_count) + " | Seen users: " + std::to_string(user_count)
+			+ " | Writes avoided: " + std::to_string(getMetrics()._seenWritesAvoided.Get());
 }
 
 std::string LastSeen::GetUserInfo(const std::string &wantedUser)
@@ -113,6 +307,18 @@ LastSeen::LastStatus LastSeen::GetLastStatus(const std::string &name) // FIXME c
 	using namespace sqlite_orm;
 	auto now = std::chrono::system_clock::now();
 
+	{
+		// Recent activity may not be saved yet
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		auto nick = _nicks.find(name);
+		auto activity = _activity.find(nick != _nicks.end() ? nick->second._jid : name);
+		if (activity != _activity.end())
+		{
+			auto lastSeenTime = std::chrono::system_clock::from_time_t(activity->second._record.timepoint_status);
+			return { now - lastSeenTime, activity->first, "" };
+		}
+	}
+
 	if (auto userRecord = getStorage().get_no_throw<DB::UserActivity>(name))
 	{
 		auto lastSeenTime = std::chrono::system_clock::from_time_t(userRecord->timepoint_status);
@@ -149,6 +355,17 @@ LastSeen::LastStatus LastSeen::GetLastStatus(const std::string &name) // FIXME c
 std::optional<LastSeen::LastActivity> LastSeen::GetLastActive(const std::string &jid)
 {
 	auto now = std::chrono::system_clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(_cacheMutex);
+		auto activity = _activity.find(jid);
+		if (activity != _activity.end())
+		{
+			auto lastActiveTime = std::chrono::system_clock::from_time_t(activity->second._record.timepoint_message);
+			return {{ now - lastActiveTime, activity->second._record.message }};
+		}
+	}
+
 	if (auto userRecord = getStorage().get_no_throw<DB::UserActivity>(jid)) {
 		auto lastActiveTime = std::chrono::system_clock::from_time_t(userRecord->timepoint_message);
 		return {{ now - lastActiveTime, userRecord->message }};
@@ -214,4 +431,72 @@ TEST(LastSeen, GetLastStatus_OnlineOffline)
 	}
 }
 
+TEST(LastSeen, WriteBehind)
+{
+	LastSeenBot tb;
+	LastSeen test(&tb);
+
+	test.HandlePresence("test_user", "test@test.com", true);
+	for (int i = 0; i < 10; i++)
+		test.HandleMessage(ChatMessage("test_user", "test@test.com", "message " + std::to_string(i), false));
+
+	// Served from memory before anything is written
+	EXPECT_EQ(0, tb._storage.count<DB::UserActivity>());
+	EXPECT_EQ("message 9", test.GetLastActive("test@test.com")->what);
+	EXPECT_EQ(10, tb._metrics._seenWritesAvoided.Get());
+
+	test.Flush();
+	EXPECT_EQ(1, tb._storage.count<DB::UserActivity>());
+	EXPECT_EQ("message 9", tb._storage.get<DB::UserActivity>("test@test.com").message);
+	EXPECT_EQ("test@test.com", tb._storage.get<DB::Nick>("test_user").uniqueID);
+}
+
+TEST(LastSeen, Eviction)
+{
+	LastSeenBot tb;
+	LastSeen test(&tb);
+	test._cacheSize = 2;
+
+	for (int i = 0; i < 4; i++)
+		test.HandlePresence("user" + std::to_string(i), "user" + std::to_string(i) + "@test.com", true);
+	test.HandleMessage(ChatMessage("user0", "user0@test.com", "still here", false));
+
+	// Unsaved entries are never dropped
+	EXPECT_EQ(4, test._activity.size());
+
+	test.Flush();
+	EXPECT_EQ(2, test._activity.size());
+	EXPECT_EQ(2, test._nicks.size());
+	EXPECT_EQ(1, test._activity.count("user0@test.com")); // Recently used
+	EXPECT_EQ(1, test._activity.count("user3@test.com"));
+
+	// Evicted ones are read from storage
+	EXPECT_TRUE(test.GetLastStatus("user1")._error.empty());
+	EXPECT_EQ("user1@test.com", test.GetLastStatus("user1").jid);
+	EXPECT_EQ("still here", test.GetLastActive("user0@test.com")->what);
+
+	test.HandlePresence("user1", "user1@test.com", false);
+	EXPECT_FALSE(test._nicks["user1"]._dirty); // Same jid as stored, nothing to write
+}
+
+TEST(LastSeen, FailedFlush)
+{
+	LastSeenBot tb;
+	LastSeen test(&tb);
+
+	// Both times are known from the first message, even without presence
+	test.HandleMessage(ChatMessage("test_user", "test@test.com", "hello", false));
+	EXPECT_NE(0, test._activity["test@test.com"]._record.timepoint_status);
+
+	tb._storage.drop_table("useractivity");
+	test.Flush();
+	EXPECT_TRUE(test._activity["test@test.com"]._dirty);
+	EXPECT_TRUE(test._oldestChange.has_value());
+
+	tb._storage.sync_schema();
+	test.Flush();
+	EXPECT_FALSE(test._activity["test@test.com"]._dirty);
+	EXPECT_EQ("hello", tb._storage.get<DB::UserActivity>("test@test.com").message);
+}
+
 #endif // LCOV_EXCL_STOP
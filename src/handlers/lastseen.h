@@ -4,6 +4,13 @@
 
 #include <string>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef _BUILD_TESTS
 #include <gtest/gtest_prod.h>
@@ -13,6 +20,7 @@ class LastSeen : public LemonHandler
 {
 public:
 	explicit LastSeen(LemonBot *bot);
+	~LastSeen() override;
 	ProcessingResult HandleMessage(const ChatMessage &msg) final;
 
 	void HandlePresence(const std::string &from, const std::string &jid, bool connected) override;
@@ -36,13 +44,70 @@ private:
 		std::string what;
 	};
 
+	class CachedActivity
+	{
+	public:
+		DB::UserActivity _record;
+		bool _dirty = false;
+		std::uint64_t _used = 0;
+	};
+
+	class CachedNick
+	{
+	public:
+		std::string _jid;
+		bool _dirty = false;
+		std::uint64_t _used = 0;
+	};
+
+	/**
+	 * @brief Cached activity of the jid, loaded from storage on first use
+	 * Call with _cacheMutex held
+	 */
+	CachedActivity &GetActivity(const std::string &jid);
+	/**
+	 * @brief Cached nick, jid is loaded from storage on first use
+	 * Call with _cacheMutex held
+	 */
+	CachedNick &GetNick(const std::string &nick);
+	void MarkChanged(bool &dirty);
+
+	/**
+	 * @brief Write changed activity and nicks in one transaction and wait for it,
+	 * then drop least recently used saved entries above cache size
+	 */
+	void Flush();
+	/**
+	 * @brief Mark records of a failed flush dirty again
+	 */
+	void RestoreUnsaved(const std::vector<DB::UserActivity> &activities, const std::vector<DB::Nick> &nicks,
+						std::optional<std::chrono::steady_clock::time_point> oldestChange);
+	template <class Cache> void Evict(Cache &cache);
+	void FlushThread();
+
 	std::string GetStats();
 	std::string GetUserInfo(const std::string &wantedUser);
 
 	LastStatus GetLastStatus(const std::string &name);
 	std::optional<LastActivity> GetLastActive(const std::string &jid);
 
+	std::mutex _cacheMutex;
+	std::unordered_map<std::string, CachedActivity> _activity; // by jid
+	std::unordered_map<std::string, CachedNick> _nicks;
+	std::optional<std::chrono::steady_clock::time_point> _oldestChange;
+	std::uint64_t _useCounter = 0;
+
+	std::chrono::seconds _flushInterval;
+	std::chrono::seconds _maxStaleness;
+	size_t _cacheSize;
+	bool _isRunning = true;
+	std::condition_variable _flushWakeup;
+	std::thread _flushThread;
+
 #ifdef _BUILD_TESTS
 	FRIEND_TEST(LastSeen, GetLastStatus_OnlineOffline);
+	FRIEND_TEST(LastSeen, WriteBehind);
+	FRIEND_TEST(LastSeen, Eviction);
+	FRIEND_TEST(LastSeen, FailedFlush);
 #endif
 };
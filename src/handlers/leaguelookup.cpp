@@ -3,7 +3,6 @@
 #include <glog/logging.h>
 #include <json/reader.h>
 #include <json/value.h>
-#include <cpr/cpr.h>
 #include <cpr/util.h>
 
 #include "util/stringops.h"
@@ -15,6 +14,8 @@
 LeagueLookup::LeagueLookup(LemonBot *bot)
 	: LemonHandler("leaugelookup", bot)
 {
+	RegisterCommands({"!ll", "!addsummoner", "!delsummoner", "!listsummoners"});
+
 	if (bot)
 	{
 		_api._key = bot->GetRawConfigValue("LOL.ApiKey");
@@ -49,7 +50,7 @@ LemonHandler::ProcessingResult LeagueLookup::HandleMessage(const ChatMessage &ms
 		return ProcessingResult::KeepGoing;
 
 	std::string args;
-	if (getCommandArguments(msg._body, "!ll", args))
+	if (getCommandArguments(msg.Body(), "!ll", args))
 	{
 		if (!args.empty())
 			SendMessage(lookupCurrentGame(args));
@@ -65,19 +66,19 @@ LemonHandler::ProcessingResult LeagueLookup::HandleMessage(const ChatMessage &ms
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (getCommandArguments(msg._body, "!addsummoner", args))
+	if (getCommandArguments(msg.Body(), "!addsummoner", args))
 	{
 		SendMessage(AddSummoner(args));
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (getCommandArguments(msg._body, "!delsummoner", args))
+	if (getCommandArguments(msg.Body(), "!delsummoner", args))
 	{
 		DeleteSummoner(args);
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (msg._body == "!listsummoners")
+	if (msg.Body() == "!listsummoners")
 	{
 		SendMessage(ListSummoners());
 		return ProcessingResult::StopProcessing;
@@ -95,11 +96,11 @@ const std::string LeagueLookup::GetHelp() const
 		   "!listsummoners - list watchlist content";
 }
 
-LeagueLookup::RiotAPIResponse LeagueLookup::RiotAPIRequest(const std::string &request, Json::Value &output)
+LeagueLookup::RiotAPIResponse LeagueLookup::RiotAPIRequest(const std::string &request, Json::Value &output) const
 {
-	auto apiResponse = cpr::Get(request);
+	auto apiResponse = httpRequest({"GET", request}).get();
 
-	switch (apiResponse.status_code)
+	switch (apiResponse._status)
 	{
 	case 403:
 		return RiotAPIResponse::AccessDenied;
@@ -110,7 +111,7 @@ LeagueLookup::RiotAPIResponse LeagueLookup::RiotAPIRequest(const std::string &re
 		return RiotAPIResponse::RateLimitReached;
 	case 200:
 	{
-		const auto &strResponse = apiResponse.text;
+		const auto &strResponse = apiResponse._body;
 
 		Json::Reader reader;
 		if (!reader.parse(strResponse, output))
@@ -122,7 +123,7 @@ LeagueLookup::RiotAPIResponse LeagueLookup::RiotAPIRequest(const std::string &re
 		return RiotAPIResponse::OK;
 	}
 	default:
-		LOG(ERROR) << "RiotAPI unexpected response: " << apiResponse.status_code;
+		LOG(ERROR) << "RiotAPI unexpected response: " << apiResponse._status;
 		return RiotAPIResponse::UnexpectedResponseCode;
 	}
 }
@@ -286,7 +287,7 @@ void LeagueLookup::LookupAllSummoners(LeagueLookup *_parent, ApiOptions &api)
 				+ std::to_string(summoner.summonerID) + "?api_key=" + api._key;
 
 		Json::Value response;
-		switch (RiotAPIRequest(apiRequest, response))
+		switch (_parent->RiotAPIRequest(apiRequest, response))
 		{
 		case RiotAPIResponse::NotFound:
 			break;
@@ -343,7 +344,14 @@ std::string LeagueLookup::AddSummoner(const std::string &id)
 
 	DB::LLSummoner newSummoner = { -1, *summonerID, name };
 
-	if (getStorage().insert(newSummoner))
+	int rowID = 0;
+	try {
+		writeStorageAndWait([&rowID, &newSummoner](Storage &storage) { rowID = storage.insert(newSummoner); });
+	} catch (std::exception &e) {
+		LOG(ERROR) << "Failed to add summoner: " << e.what();
+	}
+
+	if (rowID)
 		return "Summoner with ID " + id + " added as " + name;
 	else
 		return "Failed to add summoner to database";
@@ -353,8 +361,10 @@ void LeagueLookup::DeleteSummoner(const std::string &id)
 {
 	using namespace sqlite_orm;
 	try {
-		getStorage().remove_all<DB::LLSummoner>(where(is_equal(&DB::LLSummoner::summonerID,
-															   from_string<int>(id).value_or(0))));
+		const int summonerID = from_string<int>(id).value_or(0);
+		writeStorageAndWait([summonerID](Storage &storage) {
+			storage.remove_all<DB::LLSummoner>(where(is_equal(&DB::LLSummoner::summonerID, summonerID)));
+		});
 		SendMessage("Summoner deleted");
 	} catch (std::exception &e) {
 		LOG(ERROR) << e.what();
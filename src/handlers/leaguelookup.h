@@ -51,7 +51,7 @@ private:
 		InvalidJSON,
 	};
 
-	static RiotAPIResponse RiotAPIRequest(const std::string &request, Json::Value &output);
+	RiotAPIResponse RiotAPIRequest(const std::string &request, Json::Value &output) const;
 
 	std::string lookupCurrentGame(const std::string &name) const;
 	int getSummonerIDFromName(const std::string &name) const;
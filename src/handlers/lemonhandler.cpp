@@ -2,7 +2,9 @@
 
 LemonHandler::LemonHandler(const std::string &moduleName, LemonBot *bot)
 	: _moduleName(moduleName)
+	, _internedName(internString(moduleName))
 	, _botPtr(bot)
+	, _handlerMetrics(&getMetrics().GetHandler(moduleName))
 {
 
 }
@@ -12,6 +14,11 @@ LemonHandler::~LemonHandler()
 
 }
 
+bool LemonHandler::ClaimsMessage(const ChatMessage &msg) const
+{
+	return _commands.count(msg.Features()->_command) > 0;
+}
+
 const std::string LemonHandler::GetHelp() const
 {
 	return "This module has no commands";
@@ -22,14 +29,46 @@ const std::string &LemonHandler::GetName() const
 	return _moduleName;
 }
 
+const std::set<std::string> &LemonHandler::GetCommands() const
+{
+	return _commands;
+}
+
+LemonHandler::PassiveTraffic LemonHandler::GetPassiveTraffic() const
+{
+	return _passiveTraffic;
+}
+
+unsigned LemonHandler::GetTriggers() const
+{
+	return _triggers;
+}
+
+unsigned LemonHandler::GetRequestedFeatures() const
+{
+	return _requestedFeatures | _triggers;
+}
+
+void LemonHandler::RegisterCommands(const std::set<std::string> &commands)
+{
+	_commands.insert(commands.begin(), commands.end());
+}
+
+void LemonHandler::SetPassiveTraffic(PassiveTraffic traffic, unsigned triggers)
+{
+	_passiveTraffic = traffic;
+	_triggers = triggers & MessageFeatures::TriggerMask;
+}
+
+void LemonHandler::RequestFeatures(unsigned features)
+{
+	_requestedFeatures |= features;
+}
+
 void LemonHandler::SendMessage(const std::string &text, const std::string &channel)
 {
 	if (_botPtr) {
-		ChatMessage msg;
-		msg._body = text;
-		msg._origin = ChatMessage::Origin::Bot;
-		msg._discordChannel = channel;
-		_botPtr->SendMessage(msg);
+		_botPtr->SendMessage(ChatMessage::FromBot(text, channel));
 	};
 }
 
@@ -43,7 +82,7 @@ void LemonHandler::SendMessage(const ChatMessage &message)
 void LemonHandler::TunnelMessage(const ChatMessage &msg)
 {
 	if (_botPtr) {
-		_botPtr->TunnelMessage(msg, _moduleName);
+		_botPtr->TunnelMessage(msg, _internedName);
 	};
 }
 
@@ -1,29 +1,44 @@
 #pragma once
 
 #include <string>
+#include <chrono>
 #include <list>
+#include <set>
 
-#include "../xmpphandler.h" // FIXME we need chatmessage only
+#include "../chatmessage.h"
+#include "../messagefeatures.h"
+#include "../identityregistry.h"
 
 #include "util/sqlite_db.h"
+#include "util/storageengine.h"
+#include "util/fulltextindex.h"
+#include "util/urlarchive.h"
+#include "util/httpclient.h"
+#include "util/metrics.h"
 
 class LemonBot
 {
 public:
 	explicit LemonBot(const std::string &storagePath)
 		: _storage(initStorage(storagePath))
-	{}
+	{
+		_storage.on_open = [this](sqlite3 *db) { profileQueries(db, _metrics._sqliteQueries); };
+	}
 
     virtual void SendMessage(const std::string &text, const std::string &channel) {}
 	virtual void SendMessage(const ChatMessage &msg) {
-        SendMessage(msg._body, "");
+        SendMessage(msg.Body(), "");
 	}
-	virtual void TunnelMessage(const ChatMessage &msg, const std::string &module_name) {}
+	virtual void TunnelMessage(const ChatMessage &msg, const InternedString &module_name) {}
 
 	virtual std::string GetRawConfigValue(const std::string &name) const { return ""; }
 	virtual std::string GetRawConfigValue(const std::string &table, const std::string &name) const { return ""; }
 	virtual std::string GetNickByJid(const std::string &jid)  const { return ""; }
 	virtual std::string GetJidByNick(const std::string &nick) const { return ""; }
+	/**
+	 * @brief Small permanent id of the jid, UnknownUser if it was never seen online
+	 */
+	virtual UserID GetUserID(const std::string &jid) const { return UnknownUser; }
 	virtual std::string GetOnlineUsers() const { return ""; }
 	virtual std::string GetDBPathPrefix() const { return "db/"; }
 	virtual ~LemonBot() {}
@@ -31,6 +46,23 @@ public:
     virtual void SendDiscordPresense(const std::string &nick, const std::string &userid, bool online) {}
 
 	Storage _storage;
+	Metrics _metrics;
+	/**
+	 * @brief Set in WAL storage mode, handlers then read through their own connections and write through its thread
+	 */
+	std::unique_ptr<StorageEngine> _storageEngine;
+	/**
+	 * @brief Not set for in-memory storage, handlers fall back to LIKE queries
+	 */
+	std::unique_ptr<FullTextIndex> _fullTextIndex;
+	/**
+	 * @brief Old url_log rows, not set for in-memory storage
+	 */
+	std::unique_ptr<UrlArchive> _urlArchive;
+	/**
+	 * @brief Shared by all handlers, test bots without it use a default one
+	 */
+	std::unique_ptr<HttpClient> _httpClient;
 };
 
 class LemonHandler
@@ -48,6 +80,15 @@ public:
 		StopProcessing,
 	};
 
+	/**
+	 * @brief Messages handler wants to receive besides its own commands
+	 */
+	enum class PassiveTraffic {
+		None,      // Only commands registered with RegisterCommands
+		PlainText, // Also messages that are not commands of other handlers
+		All,       // Every message, including commands of other handlers (with triggers)
+	};
+
 	/**
 	 * @brief Called once when module is enabled
 	 * @return True if init was successful
@@ -58,9 +99,15 @@ public:
 	 * @brief Receives and handles MUC messages
 	 * @param from Sender nickname
 	 * @param body Message body
-	 * @return True if message shoud not be passed to another handler
+	 * @return StopProcessing if message was handled, recipients are decided by ClaimsMessage though
 	 */
 	virtual ProcessingResult HandleMessage(const ChatMessage &msg) = 0;
+	/**
+	 * @brief Whether handler takes the message for itself, handlers after it don't get it then
+	 * Called on dispatching thread before message is queued, must be fast and not use handler state
+	 * @return True for own commands by default
+	 */
+	virtual bool ClaimsMessage(const ChatMessage &msg) const;
 	virtual void HandlePresence(const std::string &from, const std::string &jid, bool connected) { }
 
 	/**
@@ -71,7 +118,35 @@ public:
 
 	const std::string &GetName() const;
 
+	/**
+	 * @brief Commands (first word of a message, i.e. "!seen") owned by this handler
+	 */
+	const std::set<std::string> &GetCommands() const;
+	PassiveTraffic GetPassiveTraffic() const;
+	/**
+	 * @brief MessageFeatures bits messages of others must have to reach this handler, None for any
+	 */
+	unsigned GetTriggers() const;
+	/**
+	 * @brief MessageFeatures bits bot should compute before passing messages to this handler
+	 */
+	unsigned GetRequestedFeatures() const;
+
 protected:
+	/**
+	 * @brief Declare commands in your constructor, bot routes them directly to this handler
+	 * @param commands Command words, including "!"
+	 */
+	void RegisterCommands(const std::set<std::string> &commands);
+	/**
+	 * @param triggers Only receive messages, other than own commands, with any of these features, i.e. MessageFeatures::URLs
+	 */
+	void SetPassiveTraffic(PassiveTraffic traffic, unsigned triggers = MessageFeatures::None);
+	/**
+	 * @brief Ask for precomputed values available with msg.Features(), i.e. MessageFeatures::Lowercase
+	 */
+	void RequestFeatures(unsigned features);
+
 	/**
 	 * @brief Send reply to MUC
 	 * @param text
@@ -88,12 +163,52 @@ protected:
 	const std::string GetRawConfigValue(const std::string &name) const;
 	const std::string GetRawConfigValue(const std::string &table, const std::string &name) const;
 	const std::list<std::int64_t> GetIntList(const std::string &name) const;
+	/**
+	 * @brief Limits of HTTP requests made by the handler, set them in constructor
+	 */
+	void SetHttpLimits(const HttpClient::Limits &limits) { _httpLimits = limits; }
+
+	/**
+	 * @brief Make HTTP request through the shared client, latency and errors are recorded in handler metrics
+	 */
+	std::future<HttpResponse> httpRequest(HttpRequest request) const
+	{
+		return getHttpClient().Send(_moduleName, _httpLimits, std::move(request));
+	}
+
+	/**
+	 * @param callback Runs on HTTP client thread, may run after the handler is unregistered
+	 */
+	void httpRequest(HttpRequest request, HttpClient::Callback callback) const
+	{
+		getHttpClient().Send(_moduleName, _httpLimits, std::move(request), std::move(callback));
+	}
+
+	HttpClient &getHttpClient() const
+	{
+		if (_botPtr && _botPtr->_httpClient)
+			return *_botPtr->_httpClient;
+		else
+		{
+			static HttpClient client{HttpClient::Options()};
+			return client;
+		}
+	}
+
 	std::string _moduleName;
+	InternedString _internedName; // Module of tunneled messages
 	LemonBot *_botPtr;
+	HandlerMetrics *_handlerMetrics;
+
+	std::set<std::string> _commands;
+	PassiveTraffic _passiveTraffic = PassiveTraffic::None;
+	unsigned _triggers = MessageFeatures::None;
+	unsigned _requestedFeatures = MessageFeatures::None;
+	HttpClient::Limits _httpLimits;
 
 	Storage &getStorage() {
 		if (_botPtr)
-			return _botPtr->_storage;
+			return _botPtr->_storageEngine ? _botPtr->_storageEngine->GetReader() : _botPtr->_storage;
 		else
 		{
 			static Storage storage = initStorage(":memory:");
@@ -101,9 +216,65 @@ protected:
 		}
 	}
 
+	/**
+	 * @brief Run write in a transaction on the storage engine writer thread, or right away without one
+	 * Job runs later and on another thread, capture values, not references
+	 */
+	void writeStorage(const StorageEngine::WriteJob &job) {
+		if (_botPtr && _botPtr->_storageEngine)
+			_botPtr->_storageEngine->Write(job);
+		else
+		{
+			auto &storage = getStorage();
+			storage.transaction([&] {
+				job(storage);
+				return true;
+			});
+		}
+	}
+
+	/**
+	 * @brief Like writeStorage, but waits until job is done, for writes whose outcome is needed
+	 * Job may capture references, its exception is rethrown
+	 */
+	void writeStorageAndWait(const StorageEngine::WriteJob &job) {
+		if (_botPtr && _botPtr->_storageEngine)
+			_botPtr->_storageEngine->WriteAndWait(job);
+		else
+			writeStorage(job);
+	}
+
+	/**
+	 * @brief Full text index of the table, nullptr if there is none
+	 */
+	FullTextIndex *getFullTextIndex(const std::string &table) {
+		if (_botPtr && _botPtr->_fullTextIndex && _botPtr->_fullTextIndex->IsAttached(table))
+			return _botPtr->_fullTextIndex.get();
+		return nullptr;
+	}
+
+	/**
+	 * @brief Archive of old URLs, nullptr until it's ready
+	 */
+	UrlArchive *getUrlArchive() {
+		if (_botPtr && _botPtr->_urlArchive && _botPtr->_urlArchive->IsReady())
+			return _botPtr->_urlArchive.get();
+		return nullptr;
+	}
+
+	Metrics &getMetrics() {
+		if (_botPtr)
+			return _botPtr->_metrics;
+		else
+		{
+			static Metrics metrics;
+			return metrics;
+		}
+	}
+
 	const Storage &getStorage() const {
 		if (_botPtr)
-			return _botPtr->_storage;
+			return _botPtr->_storageEngine ? _botPtr->_storageEngine->GetReader() : _botPtr->_storage;
 		else
 		{
 			static Storage storage = initStorage(":memory:");
@@ -41,19 +41,20 @@ bool Pager::Message::operator==(const Pager::Message &rhs)
 Pager::Pager(LemonBot *bot)
 	: LemonHandler("pager", bot)
 {
+	RegisterCommands({"!pager", "!pager_stats"});
 	RestoreMessages();
 }
 
 LemonHandler::ProcessingResult Pager::HandleMessage(const ChatMessage &msg)
 {
-	if (msg._body == "!pager_stats")
+	if (msg.Body() == "!pager_stats")
 	{
 		SendMessage(GetPagerStats());
 		return ProcessingResult::StopProcessing;
 	}
 
 	std::string args;
-	if (!getCommandArguments(msg._body, "!pager", args))
+	if (!getCommandArguments(msg.Body(), "!pager", args))
 		return ProcessingResult::KeepGoing;
 
 	size_t space = args.find(' ');
@@ -65,8 +66,8 @@ LemonHandler::ProcessingResult Pager::HandleMessage(const ChatMessage &msg)
 
 	auto recepient = args.substr(0, space);
 	auto pagerMessage = args.substr(space + 1);
-	StoreMessage(recepient, msg._nick, pagerMessage);
-	SendMessage(msg._nick + ": message stored");
+	StoreMessage(recepient, msg.Nick(), pagerMessage);
+	SendMessage(msg.Nick() + ": message stored");
 
 	return ProcessingResult::StopProcessing;
 }
@@ -117,7 +118,8 @@ void Pager::StoreMessage(const std::string &to, const std::string &from, const s
 
 	DB::PagerMsg newMsg = { -1, to, msgtext, static_cast<int>(std::chrono::system_clock::to_time_t(_messages.back()._expiration)) };
 	try {
-		auto id = getStorage().insert(newMsg);
+		int id = 0;
+		writeStorageAndWait([&id, &newMsg](Storage &storage) { id = storage.insert(newMsg); });
 		_messages.emplace_back(id, to, msgtext);
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to save message: " << e.what();
@@ -127,7 +129,7 @@ void Pager::StoreMessage(const std::string &to, const std::string &from, const s
 void Pager::PurgeMessageFromDB(long long id)
 {
 	try {
-		getStorage().remove<DB::PagerMsg>(id);
+		writeStorage([id](Storage &storage) { storage.remove<DB::PagerMsg>(id); });
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to purge pager message with id: " << e.what() << id;
 	}
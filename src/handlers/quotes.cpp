@@ -2,6 +2,7 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <chrono>
 
 #include "util/stringops.h"
@@ -10,56 +11,56 @@ Quotes::Quotes(LemonBot *bot)
 	: LemonHandler("quotes", bot)
 	, _generator(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()))
 {
-
+	RegisterCommands({"!gq", "!aq", "!dq", "!fq", "!regenquotes"});
 }
 
 LemonHandler::ProcessingResult Quotes::HandleMessage(const ChatMessage &msg)
 {
 	std::string arg;
-	if (getCommandArguments(msg._body, "!gq", arg))
+	if (getCommandArguments(msg.Body(), "!gq", arg))
 	{
-		SendMessage(msg._nick + ": " + GetQuote(arg));
+		SendMessage(msg.Nick() + ": " + GetQuote(arg));
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (getCommandArguments(msg._body, "!aq", arg) && !arg.empty())
+	if (getCommandArguments(msg.Body(), "!aq", arg) && !arg.empty())
 	{
 		AddQuote(arg)
-				? SendMessage(msg._nick + ": quote added")
-				: SendMessage(msg._nick + ": can't add quote");
+				? SendMessage(msg.Nick() + ": quote added")
+				: SendMessage(msg.Nick() + ": can't add quote");
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (getCommandArguments(msg._body, "!dq", arg) && !arg.empty())
+	if (getCommandArguments(msg.Body(), "!dq", arg) && !arg.empty())
 	{
-		if (!msg._isAdmin)
+		if (!msg.IsAdmin())
 		{
-			SendMessage(msg._nick + ": only admin can delete quotes");
+			SendMessage(msg.Nick() + ": only admin can delete quotes");
 			return ProcessingResult::StopProcessing;
 		}
 
 		if (auto id = from_string<int>(arg)) {
 			DeleteQuote(*id)
-					? SendMessage(msg._nick + ": quote deleted")
-					: SendMessage(msg._nick + ": quote doesn't exist or access denied");
+					? SendMessage(msg.Nick() + ": quote deleted")
+					: SendMessage(msg.Nick() + ": quote doesn't exist or access denied");
 		} else {
 			SendMessage("Invalid ID");
 		}
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (getCommandArguments(msg._body, "!fq", arg) && !arg.empty())
+	if (getCommandArguments(msg.Body(), "!fq", arg) && !arg.empty())
 	{
 		auto searchResults = FindQuote(arg);
-		SendMessage(msg._nick + ": " + searchResults);
+		SendMessage(msg.Nick() + ": " + searchResults);
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (msg._body == "!regenquotes")
+	if (msg.Body() == "!regenquotes")
 	{
-		if (!msg._isAdmin)
+		if (!msg.IsAdmin())
 		{
-			SendMessage(msg._nick + ": only admin can regenerate index");
+			SendMessage(msg.Nick() + ": only admin can regenerate index");
 			return ProcessingResult::StopProcessing;
 		}
 
@@ -73,7 +74,7 @@ LemonHandler::ProcessingResult Quotes::HandleMessage(const ChatMessage &msg)
 const std::string Quotes::GetHelp() const
 {
 	return "!aq %text% - add quote, !dq %id% - delete quote\n"
-		   "!fq %regex% - find quote, !gq %id% - get quote, if id is empty then quote is random\n"
+		   "!fq %words% - find quote with all these words (as word starts), !gq %id% - get quote, if id is empty then quote is random\n"
 		   "!regenquotes - regenerate index";
 }
 
@@ -81,17 +82,17 @@ std::string Quotes::GetQuote(const std::string &id)
 {
 	using namespace sqlite_orm;
 
-	std::string LastID;
-	if (auto maxID = getStorage().max(&DB::Quote::humanIndex)) {
-		LastID = std::to_string(*maxID);
-	} else {
+	LoadCounters();
+	if (_quoteCount == 0)
 		return "No quotes";
-	}
 
+	const auto LastID = std::to_string(_lastIndex);
 	if (id.empty()) {
-		auto quotes = getStorage().get_all<DB::Quote>(order_by(sqlite_orm::random()));
+		auto quote = GetRandomQuote();
+		if (!quote)
+			return "No quotes";
 
-		return "(" + std::to_string(quotes.at(0).humanIndex) + "/" + LastID + ") " + quotes.at(0).quote;
+		return "(" + std::to_string(quote->humanIndex) + "/" + LastID + ") " + quote->quote;
 	}
 
 	auto quotes = getStorage().get_all<DB::Quote>(where(is_equal(&DB::Quote::humanIndex, from_string<int>(id).value_or(0))));
@@ -103,17 +104,53 @@ std::string Quotes::GetQuote(const std::string &id)
 	return FindQuote(id);
 }
 
-bool Quotes::AddQuote(const std::string &text)
+std::optional<DB::Quote> Quotes::GetRandomQuote()
 {
-	int newID = 1;
-	if (auto maxID = getStorage().max(&DB::Quote::humanIndex)) {
-		newID = *maxID + 1;
+	using namespace sqlite_orm;
+
+	// Quote numbers are dense after !regenquotes, deleted ones leave gaps until then.
+	// Picking a number until it exists keeps the choice uniform, each try is an index lookup
+	std::uniform_int_distribution<int> index(1, std::max(_lastIndex, 1));
+	for (int attempt = 0; attempt < maxRandomAttempts; attempt++)
+	{
+		auto quotes = getStorage().get_all<DB::Quote>(where(is_equal(&DB::Quote::humanIndex, index(_generator))));
+		if (!quotes.empty())
+			return quotes.front();
 	}
 
+	// Mostly gaps, take the quote following a random number
+	auto quotes = getStorage().get_all<DB::Quote>(where(greater_or_equal(&DB::Quote::humanIndex, index(_generator))),
+												  order_by(&DB::Quote::humanIndex), limit(1));
+	if (quotes.empty())
+		quotes = getStorage().get_all<DB::Quote>(limit(1));
+
+	if (quotes.empty())
+		return {};
+	return quotes.front();
+}
+
+void Quotes::LoadCounters()
+{
+	if (_countersLoaded)
+		return;
+
+	_quoteCount = getStorage().count<DB::Quote>();
+	auto maxID = getStorage().max(&DB::Quote::humanIndex);
+	_lastIndex = maxID ? *maxID : 0;
+	_countersLoaded = true;
+}
+
+bool Quotes::AddQuote(const std::string &text)
+{
+	LoadCounters();
+	const int newID = _lastIndex + 1;
+
 	DB::Quote newQuote = { -1, newID, text, "", "" };
 
 	try {
-		getStorage().insert(newQuote);
+		writeStorageAndWait([&newQuote](Storage &storage) { storage.insert(newQuote); });
+		_quoteCount++;
+		_lastIndex = newID;
 		return true;
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to add quote: " << std::string(e.what());
@@ -123,8 +160,16 @@ bool Quotes::AddQuote(const std::string &text)
 
 bool Quotes::DeleteQuote(int id)
 {
+	LoadCounters();
 	try {
-		getStorage().remove<DB::Quote>(id);
+		auto quote = getStorage().get_no_throw<DB::Quote>(id);
+		writeStorageAndWait([id](Storage &storage) { storage.remove<DB::Quote>(id); });
+		if (quote)
+		{
+			_quoteCount--;
+			if (quote->humanIndex == _lastIndex)
+				_countersLoaded = false; // find new last one on next use
+		}
 		return true;
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to delete quote: " << std::string(e.what());
@@ -135,15 +180,26 @@ bool Quotes::DeleteQuote(int id)
 std::string Quotes::FindQuote(const std::string &request) // FIXME const
 {
 	using namespace sqlite_orm;
-	std::string lastID;
-	if (auto maxID = getStorage().max(&DB::Quote::humanIndex)) {
-		lastID = std::to_string(*maxID);
-	} else {
+	LoadCounters();
+	if (_quoteCount == 0)
 		return "No matches";
-	}
 
-	auto quotes = getStorage().get_all<DB::Quote>(
-				where(like(&DB::Quote::quote, "%" + request + "%")));
+	const auto lastID = std::to_string(_lastIndex);
+
+	std::vector<DB::Quote> quotes;
+	if (auto index = getFullTextIndex("quotes"))
+	{
+		const auto matches = index->Count("quotes", request);
+		if (matches > maxMatches)
+			return "Too many matches (" + std::to_string(matches) + ")";
+
+		for (auto id : index->Search("quotes", request, maxMatches))
+			if (auto quote = getStorage().get_no_throw<DB::Quote>(static_cast<int>(id)))
+				quotes.push_back(*quote);
+	} else {
+		quotes = getStorage().get_all<DB::Quote>(
+					where(like(&DB::Quote::quote, "%" + request + "%")));
+	}
 
 	if (quotes.size() == 1)
 		return "(" + std::to_string(quotes.front().humanIndex) + "/" + lastID + ") " + quotes.front().quote;
@@ -162,20 +218,51 @@ std::string Quotes::FindQuote(const std::string &request) // FIXME const
 
 void Quotes::RegenerateIndex()
 {
-	int index = 0;
-	for (auto &quote : getStorage().get_all<DB::Quote>())
-	{
-		quote.humanIndex = ++index;
-		getStorage().update(quote);
+	using namespace sqlite_orm;
+
+	// Quotes are numbered in id order. Every run of quotes between two gaps moves by
+	// the same amount, so it's updated with one statement
+	int count = 0;
+	try {
+		writeStorageAndWait([&](Storage &storage) {
+			auto quotes = storage.select(columns(&DB::Quote::id, &DB::Quote::humanIndex), order_by(&DB::Quote::id));
+			const auto shift = [&quotes](size_t position) {
+				return std::get<1>(quotes[position]) - static_cast<int>(position + 1);
+			};
+
+			size_t runStart = 0;
+			for (size_t position = 1; position <= quotes.size(); position++)
+			{
+				if (position < quotes.size() && shift(position) == shift(runStart))
+					continue;
+
+				if (shift(runStart) != 0)
+					storage.update_all(set(assign(&DB::Quote::humanIndex, sub(&DB::Quote::humanIndex, shift(runStart)))),
+											where(greater_or_equal(&DB::Quote::id, std::get<0>(quotes[runStart]))
+												  and lesser_or_equal(&DB::Quote::id, std::get<0>(quotes[position - 1]))));
+				runStart = position;
+			}
+
+			count = static_cast<int>(quotes.size());
+		});
+	} catch (std::exception &e) {
+		LOG(ERROR) << "Failed to regenerate quote index: " << e.what();
+		SendMessage("Failed to regenerate index");
+		return;
 	}
 
-	SendMessage("Index regenerated. New count: " + std::to_string(index));
+	_quoteCount = count;
+	_lastIndex = count;
+	_countersLoaded = true;
+	SendMessage("Index regenerated. New count: " + std::to_string(count));
 }
 
 #ifdef _BUILD_TESTS // LCOV_EXCL_START
 
 #include <gtest/gtest.h>
 
+#include <set>
+
 class QuoteTestBot : public LemonBot
 {
 public:
@@ -248,4 +335,32 @@ TEST(QuotesTest, RegenIndex)
 	EXPECT_EQ("(2/2) testquote3", quote3);
 }
 
+TEST(QuotesTest, Random)
+{
+	QuoteTestBot tb;
+	Quotes q(&tb);
+
+	EXPECT_EQ("No quotes", q.GetQuote(""));
+
+	for (int i = 1; i <= 6; i++)
+		ASSERT_TRUE(q.AddQuote("testquote" + std::to_string(i)));
+
+	EXPECT_TRUE(q.DeleteQuote(2));
+	EXPECT_TRUE(q.DeleteQuote(3));
+	EXPECT_TRUE(q.DeleteQuote(6));
+
+	std::set<std::string> seen;
+	for (int i = 0; i < 200; i++)
+		seen.insert(q.GetQuote(""));
+	EXPECT_EQ(std::set<std::string>({"(1/5) testquote1", "(4/5) testquote4", "(5/5) testquote5"}), seen);
+
+	q.RegenerateIndex();
+	EXPECT_EQ("Index regenerated. New count: 3", tb._received.back());
+	EXPECT_EQ("(2/3) testquote4", q.GetQuote("2"));
+	EXPECT_EQ("(3/3) testquote5", q.GetQuote("3"));
+
+	ASSERT_TRUE(q.AddQuote("testquote7"));
+	EXPECT_EQ("(4/4) testquote7", q.GetQuote("4"));
+}
+
 #endif // LCOV_EXCL_STOP
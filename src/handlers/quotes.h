@@ -2,6 +2,7 @@
 
 #include "lemonhandler.h"
 
+#include <optional>
 #include <random>
 
 #ifdef _BUILD_TESTS
@@ -22,13 +23,25 @@ private:
 	std::string FindQuote(const std::string &request);
 	void RegenerateIndex();
 
+	/**
+	 * @brief Load quote count and last index once, they are kept up to date by this handler
+	 */
+	void LoadCounters();
+	std::optional<DB::Quote> GetRandomQuote();
+
 private:
 	std::mt19937_64 _generator;
 
+	bool _countersLoaded = false;
+	int _quoteCount = 0;
+	int _lastIndex = 0;
+
 	static constexpr int maxMatches = 10;
+	static constexpr int maxRandomAttempts = 8;
 #ifdef _BUILD_TESTS
 	FRIEND_TEST(QuotesTest, General);
 	FRIEND_TEST(QuotesTest, Search);
 	FRIEND_TEST(QuotesTest, RegenIndex);
+	FRIEND_TEST(QuotesTest, Random);
 #endif
 };
@@ -2,12 +2,12 @@
 
 #include <chrono>
 
-#include <cpr/cpr.h>
 #include <pugixml.hpp>
 
 #include <glog/logging.h>
 
 #include "util/stringops.h"
+#include "util/htmlentities.h"
 #include "util/thread_util.h"
 
 void UpdateThread(RSSWatcher *parent)
@@ -25,8 +25,13 @@ void UpdateThread(RSSWatcher *parent)
 RSSWatcher::RSSWatcher(LemonBot *bot)
 	: LemonHandler("rss", bot)
 {
+	RegisterCommands({"!addrss", "!delrss", "!listrss", "!updaterss", "!readrss"});
 	_updateSecondsMax = from_string<int>(GetRawConfigValue("RSS.UpdateSeconds")).value_or(60*60);
 
+	HttpClient::Limits limits;
+	limits._timeout = std::chrono::milliseconds(2000);
+	SetHttpLimits(limits);
+
 	UpdateFeeds();
 
 	_updateThread = std::thread(&UpdateThread, this);
@@ -42,25 +47,25 @@ RSSWatcher::~RSSWatcher()
 LemonHandler::ProcessingResult RSSWatcher::HandleMessage(const ChatMessage &msg)
 {
 	std::string args;
-	if (getCommandArguments(msg._body, "!addrss", args)
-			&& msg._isAdmin)
+	if (getCommandArguments(msg.Body(), "!addrss", args)
+			&& msg.IsAdmin())
 	{
 		RegisterFeed(args);
 		UpdateFeeds();
 		return ProcessingResult::StopProcessing;
-	} else if (getCommandArguments(msg._body, "!delrss", args)
-			   && msg._isAdmin) {
+	} else if (getCommandArguments(msg.Body(), "!delrss", args)
+			   && msg.IsAdmin()) {
 		auto feedID = from_string<int>(args);
 		if (feedID)
 			UnregisterFeed(*feedID);
 		return ProcessingResult::StopProcessing;
-	} else if (msg._body == "!listrss") {
+	} else if (msg.Body() == "!listrss") {
 		SendMessage(ListRSSFeeds());
-	} else if (msg._body == "!updaterss"
-			   && msg._isAdmin) {
+	} else if (msg.Body() == "!updaterss"
+			   && msg.IsAdmin()) {
 		UpdateFeeds();
 		return ProcessingResult::StopProcessing;
-	} else if (getCommandArguments(msg._body, "!readrss", args)) {
+	} else if (getCommandArguments(msg.Body(), "!readrss", args)) {
 		if (auto item = GetLatestItem(args)) {
 			SendMessage(item->Format());
 		} else {
@@ -93,7 +98,7 @@ void RSSWatcher::RegisterFeed(const std::string &feed)
 
 	try {
 		DB::RssFeed newFeed { -1, feed };
-		getStorage().insert(newFeed);
+		writeStorageAndWait([&newFeed](Storage &storage) { storage.insert(newFeed); });
 	} catch (std::exception &e) {
 		SendMessage("Can't insert feed: " + std::string(e.what()));
 		return;
@@ -105,7 +110,7 @@ void RSSWatcher::RegisterFeed(const std::string &feed)
 void RSSWatcher::UnregisterFeed(int id)
 {
 	try {
-		getStorage().remove<DB::RssFeed>(id);
+		writeStorageAndWait([id](Storage &storage) { storage.remove<DB::RssFeed>(id); });
 	} catch (std::exception &e) {
 		SendMessage("Failed to remove feed: " + std::string(e.what()));
 	}
@@ -132,7 +137,7 @@ void RSSWatcher::UpdateFeeds()
 		if (item && item->guid != feed.GUID)
 		{
 			feed.GUID = item->guid;
-			getStorage().update(feed);
+			writeStorage([feed](Storage &storage) { storage.update(feed); });
 			SendMessage(item->Format());
 		}
 	}
@@ -150,14 +155,14 @@ std::optional<RSSItem> RSSWatcher::GetLatestItem(const std::string &feedURL) con
 
 std::optional<std::string> RSSWatcher::fetchRawRSS(const std::string &feedURL) const
 {
-	auto feedContent = cpr::Get(cpr::Url(feedURL), cpr::Timeout(2000));
-	if (feedContent.status_code != 200)
+	auto feedContent = httpRequest({"GET", feedURL}).get();
+	if (feedContent._status != 200)
 	{
-		LOG(WARNING) << "Status code is not 200 OK: " + std::to_string(feedContent.status_code) + " | " + feedContent.error.message;
+		LOG(WARNING) << "Status code is not 200 OK: " + std::to_string(feedContent._status) + " | " + feedContent._error;
 		return {};
 	}
 
-	return feedContent.text;
+	return feedContent._body;
 }
 
 std::optional<RSSItem> RSSWatcher::parseRawRSS(const std::string &rawRSS) const
@@ -171,11 +176,12 @@ std::optional<RSSItem> RSSWatcher::parseRawRSS(const std::string &rawRSS) const
 
 	try {
 		auto items = doc.child("rss").child("channel").children("item");
+		// Feeds escape HTML once more inside XML, entities are left after parsing
 		return RSSItem{
-			items.begin()->child_value("title"),
+			decodeHTMLEntities(items.begin()->child_value("title")),
 			items.begin()->child_value("pubDate"),
 			items.begin()->child_value("link"),
-			items.begin()->child_value("description"),
+			decodeHTMLEntities(items.begin()->child_value("description")),
 			items.begin()->child_value("guid")
 		};
 	} catch (std::exception &e) {
@@ -1,29 +1,32 @@
 #include "urlpreview.h"
 
-#include <map>
-#include <regex>
 #include <chrono>
 
 #include <glog/logging.h>
 #include <boost/algorithm/string.hpp>
-#include <boost/locale/encoding.hpp>
-#include <boost/locale/encoding_utf.hpp>
-#include <cpr/cpr.h>
 
 #include "util/stringops.h"
-
-std::string formatHTMLchars(std::string input);
+#include "util/htmlentities.h"
+#include "util/charset.h"
 
 UrlPreview::UrlPreview(LemonBot *bot)
 	: LemonHandler("url", bot)
+	, _titleCache(readTitleCacheOptions(), &getMetrics())
 {
-
+	RegisterCommands({"!url", "!!!url", "!wlisturl", "!blisturl", "!delisturl", "!urlrules"});
+	SetPassiveTraffic(PassiveTraffic::All, MessageFeatures::URLs); // links in commands (i.e. !aq) are previewed and logged too
+
+	HttpClient::Limits limits;
+	limits._timeout = std::chrono::milliseconds(2000);
+	limits._concurrency = from_string<size_t>(GetRawConfigValue("URL.ParallelFetches")).value_or(8);
+	limits._maxBodySize = from_string<size_t>(GetRawConfigValue("URL.MaxPageKB")).value_or(512) * 1024;
+	SetHttpLimits(limits);
 }
 
 LemonHandler::ProcessingResult UrlPreview::HandleMessage(const ChatMessage &msg)
 {
 	std::string args;
-	auto &body = msg._body;
+	auto &body = msg.Body();
 	if (getCommandArguments(body, "!url", args))
 	{
 		SendMessage(concatenateURLs(findUrlsInHistory(args), false));
@@ -66,125 +69,199 @@ LemonHandler::ProcessingResult UrlPreview::HandleMessage(const ChatMessage &msg)
 		return ProcessingResult::StopProcessing;
 	}
 
-	if (msg._hasDiscordEmbed) {
+	if (msg.HasDiscordEmbed()) {
 		return ProcessingResult::KeepGoing;
 	}
 
-	auto sites = findURLs(body);
+	const auto features = msg.Features();
+	const auto &sites = features->_urls;
 	if (sites.empty())
 		return ProcessingResult::KeepGoing;
 
+	const bool fetchTitles = GetRawConfigValue("URL.FetchTitles") != "false";
+	const size_t parallelFetches = std::max<size_t>(1, from_string<size_t>(GetRawConfigValue("URL.MessageParallelFetches")).value_or(5));
+
+	// Titles are fetched concurrently and posted in message order, as soon as the ones before are posted
+	std::vector<std::shared_future<TitleCache::Entry>> titles;
+	auto nextFetch = sites.begin();
+	const auto startFetches = [&](size_t count) {
+		while (fetchTitles && nextFetch != sites.end() && titles.size() < count)
+			titles.push_back(lookupTitle((nextFetch++)->_url));
+	};
+	startFetches(parallelFetches);
+
+	// Old records are moved to archive by UrlArchive, see URL.KeepFullDays
+	const long now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	std::vector<DB::LoggedURL> records;
+
 	int urlsFound = 0;
 	for (auto &site : sites)
 	{
-		auto acceptLanguage = GetRawConfigValue("URL.AcceptLanguage");
-		auto page = cpr::Get(cpr::Url{site._url},
-							 cpr::Timeout{2000},
-							 cpr::Header{{"Accept-Language",
-										  acceptLanguage.empty() ? "ru,en" : acceptLanguage}});
-
 		std::string title = "";
-		if (page.status_code != 200)
+		if (fetchTitles)
 		{
-			LOG(INFO) << "URL: " << site._url << " | Status code: " << page.status_code
-					  << " | Error: " << page.error.message;
-		} else {
-			const auto &siteContent = page.text;
-			title = getTitle(siteContent);
+			title = titles[urlsFound].get()._title;
+			startFetches(urlsFound + 1 + parallelFetches);
 		}
 
-		// FIXME: should we ever delete urls now?
-		auto now = std::chrono::system_clock::now();
-		DB::LoggedURL record = { -1, site._url, title,
-								 std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count(),
-							   site._url + " " + title};
-
-		getStorage().insert(record);
+		records.push_back({ -1, site._url, title, now, site._url + " " + title });
 
 		if (shouldPrintTitle(site._url) && urlsFound < maxURLsInOneMessage) {
-			auto formattedTitle = formatHTMLchars(title);
+			auto formattedTitle = decodeHTMLEntities(title);
 			if (!formattedTitle.empty()) {
-				SendMessage(formattedTitle, msg._discordChannel);
+				SendMessage(formattedTitle, msg.DiscordChannel());
 			}
 		}
 
 		urlsFound++;
 	}
 
+	writeStorage([records](Storage &storage) {
+		for (const auto &record : records)
+			storage.insert(record);
+	});
+
 	return ProcessingResult::KeepGoing;
 }
 
 const std::string UrlPreview::GetHelp() const
 {
-	return "!url %regex% - search in URL history by title or url\n"
+	return "!url %words% - search in URL history by title or url, every word must match as a word start\n"
 		   "!wlisturl %regex% and !blisturl %regex% - enable/disable notifications for specific urls\n"
 		   "!delisturl %id% - delete existing rules. !urlrules - print existing rules and their ids";
 }
 
-std::string UrlPreview::getTitle(const std::string &content) const
+std::shared_future<TitleCache::Entry> UrlPreview::lookupTitle(const std::string &url)
 {
-	// FIXME: maybe should use actual HTML parser here?
-	const std::string titleOp("<title>");
-	const std::string titleClose("</title>");
-	auto titleBegin = content.find(titleOp);
-	if (titleBegin == content.npos)
-		return "";
-
-	auto titleEnd = content.find(titleClose, titleBegin);
-	if (titleEnd == content.npos)
-		return "";
-
-	auto title = content.substr(titleBegin + titleOp.size(), titleEnd - titleBegin - titleOp.size());
-	boost::trim(title);
-
-	if (title.length() > 360) {
-		return "Title is too long";
+	std::optional<TitleCache::Entry> stored;
+	if (!_titleCache.Find(url))
+	{
+		// Cache is empty after restart, titles stored recently are as good as fetched ones
+		stored = findStoredTitle(url);
+		if (stored && _titleCache.IsFresh(*stored))
+			_titleCache.Put(url, *stored);
 	}
 
-	try {
-		return boost::locale::conv::utf_to_utf<char>(title.c_str(), boost::locale::conv::stop);
-	} catch (boost::locale::conv::conversion_error &e) {
-		LOG(INFO) << "Non-unicode header: " + std::string(e.what()) + "}";
-	}
+	return _titleCache.Lookup(url, [this, stored](const std::string &url, TitleCache::Done done) {
+		fetchTitle(url, stored, std::move(done));
+	});
+}
 
-	auto codepage = getMetaCodepage(content);
+void UrlPreview::fetchTitle(const std::string &url, const std::optional<TitleCache::Entry> &stored, TitleCache::Done done) const
+{
+	auto acceptLanguage = GetRawConfigValue("URL.AcceptLanguage");
+	HttpRequest request{"GET", url, {"Accept-Language: " + (acceptLanguage.empty() ? "ru,en" : acceptLanguage)}};
 
-	if (!codepage.empty()) {
-		try {
-			return boost::locale::conv::to_utf<char>(title.c_str(), codepage);
-		} catch (boost::locale::conv::conversion_error &e) {
-			LOG(INFO) << "Failed to convert from " + codepage + ": " + std::string(e.what()) + "}";
+	// Only the head is needed, it's parsed as it arrives and transfer stops once it's over
+	auto head = std::make_shared<HtmlHeadParser>();
+	request._onData = [head](const HttpResponse &response, const char *data, size_t size) {
+		return isHtml(response._contentType) && head->Feed(std::string_view(data, size));
+	};
+
+	httpRequest(std::move(request), [this, url, stored, head, done](HttpResponse page) {
+		TitleCache::Entry entry;
+		entry._status = page._status;
+		entry._fetched = std::chrono::system_clock::now();
+		if (page._status != 200)
+		{
+			LOG(INFO) << "URL: " << url << " | Status code: " << page._status
+					  << " | Error: " << page._error;
+			// Keep showing the last known title while the site is down
+			if (stored)
+				entry._title = stored->_title;
+		} else {
+			entry._title = getTitle(head->GetHead(), charsetFromContentType(page._contentType));
 		}
-	}
 
-	return "{ Unsupported code page in title }";
+		done(std::move(entry));
+	});
+}
+
+bool UrlPreview::isHtml(const std::string &contentType)
+{
+	// Servers not sending content type are given a chance
+	return contentType.empty()
+			|| boost::istarts_with(contentType, "text/html")
+			|| boost::istarts_with(contentType, "application/xhtml+xml");
+}
+
+std::optional<TitleCache::Entry> UrlPreview::findStoredTitle(const std::string &url)
+{
+	using namespace sqlite_orm;
+	auto records = getStorage().get_all<DB::LoggedURL>(
+				where(is_equal(&DB::LoggedURL::URL, url) and is_not_equal(&DB::LoggedURL::title, "")),
+				order_by(&DB::LoggedURL::id).desc(),
+				limit(1));
+	if (records.empty())
+		return {};
+
+	TitleCache::Entry entry;
+	entry._title = records.front().title;
+	entry._status = 200;
+	entry._fetched = std::chrono::system_clock::time_point(std::chrono::seconds(records.front().timestamp));
+	return entry;
 }
 
-std::string UrlPreview::getMetaCodepage(const std::string &content) const
+TitleCache::Options UrlPreview::readTitleCacheOptions() const
 {
-	// Hack to support some old Russian websites
-	const std::string metaOp = "meta charset=\"";
-	auto codepageBegin = content.find(metaOp);
-	if (codepageBegin == content.npos)
-		return "";
+	TitleCache::Options options;
+	options._maxEntries = from_string<size_t>(GetRawConfigValue("URL.TitleCacheSize")).value_or(options._maxEntries);
+	options._ttl = std::chrono::seconds(from_string<int>(GetRawConfigValue("URL.TitleCacheSec")).value_or(static_cast<int>(options._ttl.count())));
+	options._failureTtl = std::chrono::seconds(from_string<int>(GetRawConfigValue("URL.FailedTitleCacheSec")).value_or(static_cast<int>(options._failureTtl.count())));
+	return options;
+}
+
+std::string UrlPreview::getTitle(const HtmlHead &head, const std::string &charset) const
+{
+	// Pages without title often have OpenGraph one for previews
+	auto title = head._title.empty() ? head._ogTitle : head._title;
+	boost::trim(title);
+
+	if (title.length() > 360) {
+		return "Title is too long";
+	}
+
+	if (isValidUtf8(title))
+		return title;
+
+	for (const auto &codepage : {charset, head._charset})
+	{
+		if (codepage.empty())
+			continue;
 
-	auto codepageEnd = content.find("\"", codepageBegin + metaOp.size());
-	if (codepageEnd == content.npos)
-		return "";
+		if (auto converted = convertToUtf8(title, codepage))
+			return *converted;
 
-	auto codepage = content.substr(codepageBegin + metaOp.size(), codepageEnd - codepageBegin - metaOp.size());
-	boost::trim(codepage);
+		LOG(INFO) << "Failed to convert title from " << codepage;
+	}
 
-	return codepage;
+	return "{ Unsupported code page in title }";
 }
 
 std::vector<DB::LoggedURL> UrlPreview::findUrlsInHistory(const std::string &request)
 {
 	using namespace sqlite_orm;
-	return getStorage().get_all<DB::LoggedURL>(
-				where(like(&DB::LoggedURL::fullText, "%" + request + "%")),
-				order_by(&DB::LoggedURL::id).desc(),
-				limit(maxURLsInSearch));
+	std::vector<DB::LoggedURL> urls;
+	if (auto index = getFullTextIndex("url_log"))
+	{
+		for (auto id : index->Search("url_log", request, maxURLsInSearch))
+			if (auto url = getStorage().get_no_throw<DB::LoggedURL>(static_cast<int>(id)))
+				urls.push_back(*url);
+	} else {
+		urls = getStorage().get_all<DB::LoggedURL>(
+					where(like(&DB::LoggedURL::fullText, "%" + request + "%")),
+					order_by(&DB::LoggedURL::id).desc(),
+					limit(maxURLsInSearch));
+	}
+
+	// Older URLs are only in archive, ids of archived ones are negative
+	const size_t maxURLs = maxURLsInSearch;
+	auto archive = getUrlArchive();
+	if (archive && urls.size() < maxURLs)
+		for (const auto &entry : archive->Search(request, maxURLs - urls.size()))
+			urls.push_back({ -static_cast<int>(entry._id), entry._url, entry._title, static_cast<long>(entry._lastSeen), "" });
+
+	return urls;
 }
 
 std::string UrlPreview::concatenateURLs(const std::vector<DB::LoggedURL> &urls, bool withIndices) const
@@ -197,38 +274,36 @@ std::string UrlPreview::concatenateURLs(const std::vector<DB::LoggedURL> &urls,
 	for (const auto &url : urls)
 	{
 		searchResults += withIndices
-				? (std::to_string(url.id) + ") " + url.URL + " " + url.title + "\n")
+				? ((url.id < 0 ? "a" + std::to_string(-url.id) : std::to_string(url.id)) + ") " + url.URL + " " + url.title + "\n")
 				: (url.URL + " " + url.title + "\n");
 	}
 
 	return searchResults;
 }
 
-bool UrlPreview::shouldPrintTitle(const std::string &url) // FIXME const
+bool UrlPreview::shouldPrintTitle(const std::string &url)
 {
-	bool blacklisted = false;
-	bool whitelisted = false;
-
-	for (const auto &rule : getStorage().get_all<DB::URLRule>())
+	// Compiled on first use after rules change
+	if (!_urlRules)
 	{
-		std::smatch regexMatch;
-		auto searchRegex = std::regex(toLower(rule.rule));
-		auto doesMatch = std::regex_search(url, regexMatch, searchRegex);
-
-		if (doesMatch) {
-			LOG(INFO) << "URL is found in rule: " << getStorage().dump(rule);
-			rule.blacklist ? blacklisted = true : whitelisted = true;
-		}
+		std::vector<UrlRuleSet::Rule> rules;
+		for (const auto &rule : getStorage().get_all<DB::URLRule>())
+			rules.push_back({rule.id, rule.rule, rule.blacklist});
+		_urlRules = std::make_unique<UrlRuleSet>(rules);
 	}
 
-	return !blacklisted || whitelisted;
+	return _urlRules->ShouldPrint(url);
 }
 
 bool UrlPreview::addRuleToRuleset(const std::string &rule, bool blacklist)
 {
+	if (!UrlRuleSet::IsValid(rule))
+		return false;
+
 	DB::URLRule newRule = { -1, rule, blacklist };
 	try {
-		getStorage().insert(newRule);
+		writeStorageAndWait([&newRule](Storage &storage) { storage.insert(newRule); });
+		_urlRules.reset();
 		return true;
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to add rule: " << e.what();
@@ -239,7 +314,8 @@ bool UrlPreview::addRuleToRuleset(const std::string &rule, bool blacklist)
 bool UrlPreview::delRuleFromRuleset(int ruleID)
 {
 	try {
-		getStorage().remove<DB::URLRule>(ruleID);
+		writeStorageAndWait([ruleID](Storage &storage) { storage.remove<DB::URLRule>(ruleID); });
+		_urlRules.reset();
 		return true;
 	} catch (std::exception &e) {
 		LOG(ERROR) << "Failed to delete rule: " << e.what();
@@ -256,35 +332,6 @@ std::string UrlPreview::ShowURLRules()
 	return result;
 }
 
-std::string formatHTMLchars(std::string input)
-{
-	std::map<std::string, std::string> chars
-			= {{"&quot;", "\""},
-			   {"&amp;", "&"},
-			   {"&lt;", "<"},
-			   {"&gt;", ">"},
-			   {"&apos;", "'"},
-			   {"&#39;", "'"},
-			   {"&bull;", "•"},
-			   {"&mdash;", "—"},
-			   {"&ndash;", "–"},
-			  };
-
-	for (auto &specialCharPair : chars)
-	{
-		auto &coded = specialCharPair.first;
-		auto &decoded = specialCharPair.second;
-		size_t pos = input.find(coded);
-		while (pos != input.npos)
-		{
-			input.replace(pos, coded.length(), decoded);
-			pos = input.find(coded);
-		}
-	}
-
-	return input;
-}
-
 #ifdef _BUILD_TESTS // LCOV_EXCL_START
 
 #include <gtest/gtest.h>
@@ -309,7 +356,7 @@ void UrlPreviewTestBot::SendMessage(const std::string &text)
 TEST(URLPreview, HTMLSpecialChars)
 {
 	std::string input = "&quot;&amp;&gt;&lt;";
-	EXPECT_EQ("\"&><", formatHTMLchars(input));
+	EXPECT_EQ("\"&><", decodeHTMLEntities(input));
 }
 
 TEST(URLPreview, GetTitle)
@@ -321,8 +368,10 @@ TEST(URLPreview, GetTitle)
 						"<head><title>This is a test title</title></head>\n"
 						"<body><p>Test</p></body>"
 						"</html>\n");
-	std::string title = testUnit.getTitle(content);
-	EXPECT_EQ("This is a test title", formatHTMLchars(title));
+	HtmlHeadParser parser;
+	parser.Feed(content);
+	std::string title = testUnit.getTitle(parser.GetHead(), "");
+	EXPECT_EQ("This is a test title", decodeHTMLEntities(title));
 }
 
 TEST(URLPreview, History)
@@ -346,4 +395,68 @@ TEST(URLPreview, History)
 	}
 }
 
+TEST(URLPreview, StoredTitle)
+{
+	UrlPreviewTestBot testBot;
+	UrlPreview t(&testBot);
+
+	const long now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	testBot._storage.insert(DB::LoggedURL{-1, "http://example.com/stored", "Old title", now - 7200, ""});
+	testBot._storage.insert(DB::LoggedURL{-1, "http://example.com/stored", "Stored title", now - 60, ""});
+	testBot._storage.insert(DB::LoggedURL{-1, "http://example.com/stored", "", now - 30, ""});
+
+	// Recently stored title is used instead of fetching the page
+	EXPECT_EQ("Stored title", t.lookupTitle("http://example.com/stored").get()._title);
+	EXPECT_EQ("Stored title", t.lookupTitle("http://example.com/stored").get()._title);
+
+	const auto stats = t._titleCache.GetStats();
+	EXPECT_EQ(0u, stats._misses);
+	EXPECT_EQ(2u, stats._hits);
+	EXPECT_FALSE(t.findStoredTitle("http://example.com/missing"));
+}
+
+TEST(URLPreview, Rules)
+{
+	UrlPreviewTestBot testBot;
+	UrlPreview t(&testBot);
+
+	EXPECT_TRUE(t.shouldPrintTitle("https://youtube.com/channel/x"));
+	EXPECT_TRUE(t.addRuleToRuleset("youtube\\.com", true));
+	EXPECT_FALSE(t.addRuleToRuleset("(", true));
+	EXPECT_FALSE(t.shouldPrintTitle("https://youtube.com/channel/x"));
+
+	EXPECT_TRUE(t.addRuleToRuleset("youtube\\.com/watch", false));
+	EXPECT_TRUE(t.shouldPrintTitle("https://youtube.com/watch?v=x"));
+
+	for (const auto &rule : testBot._storage.get_all<DB::URLRule>())
+		EXPECT_TRUE(t.delRuleFromRuleset(rule.id));
+	EXPECT_TRUE(t.shouldPrintTitle("https://youtube.com/channel/x"));
+}
+
+TEST(URLPreview, TitleCharset)
+{
+	UrlPreviewTestBot testBot;
+	UrlPreview t(&testBot);
+
+	EXPECT_TRUE(t.isHtml("text/html; charset=utf-8"));
+	EXPECT_TRUE(t.isHtml(""));
+	EXPECT_FALSE(t.isHtml("image/png"));
+
+	HtmlHead head;
+	head._title = " Заголовок ";
+	EXPECT_EQ("Заголовок", t.getTitle(head, "windows-1251"));
+
+	// Header charset goes first, meta is the fallback
+	head._title = "\xc7\xe0\xe3\xee\xeb\xee\xe2\xee\xea";
+	head._charset = "windows-1251";
+	EXPECT_EQ("Заголовок", t.getTitle(head, ""));
+	EXPECT_EQ("Заголовок", t.getTitle(head, "no-such-charset"));
+	head._charset.clear();
+	EXPECT_EQ("{ Unsupported code page in title }", t.getTitle(head, ""));
+
+	head._title.clear();
+	head._ogTitle = "OpenGraph title";
+	EXPECT_EQ("OpenGraph title", t.getTitle(head, ""));
+}
+
 #endif // LCOV_EXCL_STOP
@@ -1,6 +1,11 @@
 #pragma once
 
 #include "lemonhandler.h"
+#include "util/htmlhead.h"
+#include "util/titlecache.h"
+#include "util/urlruleset.h"
+
+#include <optional>
 
 #ifdef _BUILD_TESTS
 #include <gtest/gtest_prod.h>
@@ -15,8 +20,27 @@ public:
 	const std::string GetHelp() const override;
 
 private:
-	std::string getTitle(const std::string &content) const;
-	std::string getMetaCodepage(const std::string &content) const;
+	/**
+	 * @brief Title to show, converted to UTF-8
+	 * @param charset From Content-Type header, takes priority over meta
+	 */
+	std::string getTitle(const HtmlHead &head, const std::string &charset) const;
+
+	/**
+	 * @brief Cached title of the URL, or the one being fetched
+	 */
+	std::shared_future<TitleCache::Entry> lookupTitle(const std::string &url);
+	/**
+	 * @brief Fetch page until its head is read, HTML only. Done runs on HTTP client thread
+	 * @param stored Title shown if page can't be fetched
+	 */
+	void fetchTitle(const std::string &url, const std::optional<TitleCache::Entry> &stored, TitleCache::Done done) const;
+	static bool isHtml(const std::string &contentType);
+	/**
+	 * @brief Latest non-empty title of the URL in url_log
+	 */
+	std::optional<TitleCache::Entry> findStoredTitle(const std::string &url);
+	TitleCache::Options readTitleCacheOptions() const;
 
 	std::vector<DB::LoggedURL> findUrlsInHistory(const std::string &request);
 	std::string concatenateURLs(const std::vector<DB::LoggedURL> &urls, bool withIndices) const;
@@ -32,9 +56,15 @@ private:
 	static constexpr int maxURLsInOneMessage = 5;
 	static constexpr int maxURLsInSearch = 15;
 
+	TitleCache _titleCache;
+	std::unique_ptr<UrlRuleSet> _urlRules;
+
 #ifdef _BUILD_TESTS
 	FRIEND_TEST(URLPreview, History);
 	FRIEND_TEST(URLPreview, GetTitle);
 	FRIEND_TEST(URLPreview, ConfigReader);
+	FRIEND_TEST(URLPreview, StoredTitle);
+	FRIEND_TEST(URLPreview, TitleCharset);
+	FRIEND_TEST(URLPreview, Rules);
 #endif
 };
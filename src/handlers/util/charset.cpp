@@ -0,0 +1,216 @@
+#include "charset.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#include <iconv.h>
+
+bool isValidUtf8(std::string_view text)
+{
+	size_t position = 0;
+	while (position < text.size())
+	{
+		const auto lead = static_cast<unsigned char>(text[position]);
+		size_t length;
+		std::uint32_t codePoint;
+		if (lead < 0x80)
+		{
+			position++;
+			continue;
+		} else if ((lead & 0xE0) == 0xC0) {
+			length = 2;
+			codePoint = lead & 0x1F;
+		} else if ((lead & 0xF0) == 0xE0) {
+			length = 3;
+			codePoint = lead & 0x0F;
+		} else if ((lead & 0xF8) == 0xF0) {
+			length = 4;
+			codePoint = lead & 0x07;
+		} else {
+			return false;
+		}
+
+		if (position + length > text.size())
+			return false;
+
+		for (size_t i = 1; i < length; i++)
+		{
+			const auto next = static_cast<unsigned char>(text[position + i]);
+			if ((next & 0xC0) != 0x80)
+				return false;
+			codePoint = (codePoint << 6) | (next & 0x3F);
+		}
+
+		// Overlong forms, surrogates and values past Unicode
+		static constexpr std::uint32_t minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+		if (codePoint < minimum[length] || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF)
+			return false;
+
+		position += length;
+	}
+
+	return true;
+}
+
+namespace {
+
+class ConverterCache
+{
+public:
+	~ConverterCache()
+	{
+		for (auto &converter : _converters)
+			iconv_close(converter.second);
+	}
+
+	std::optional<std::string> Convert(std::string_view text, const std::string &charset)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto converter = _converters.find(charset);
+		if (converter != _converters.end())
+			return Convert(converter->second, text);
+
+		auto opened = iconv_open("UTF-8", charset.c_str());
+		if (opened == invalid())
+			return {};
+
+		// Only charsets iconv knows are kept, and only so many of them
+		if (_converters.size() < maxConverters)
+			return Convert(_converters.emplace(charset, opened).first->second, text);
+
+		auto result = Convert(opened, text);
+		iconv_close(opened);
+		return result;
+	}
+
+private:
+	static constexpr size_t maxConverters = 32;
+
+	static iconv_t invalid() { return reinterpret_cast<iconv_t>(-1); }
+
+	// Bytes that are invalid in the charset are skipped, as a truncated or mislabeled title is still worth showing
+	static std::string Convert(iconv_t converter, std::string_view text)
+	{
+		iconv(converter, nullptr, nullptr, nullptr, nullptr);
+
+		std::string output(text.size() * 4 + 4, '\0');
+		char *in = const_cast<char *>(text.data());
+		size_t inLeft = text.size();
+		size_t written = 0;
+		while (true)
+		{
+			char *out = &output[written];
+			size_t outLeft = output.size() - written;
+			const auto result = inLeft > 0
+					? iconv(converter, &in, &inLeft, &out, &outLeft)
+					: iconv(converter, nullptr, nullptr, &out, &outLeft);
+			const auto error = errno;
+			written = output.size() - outLeft;
+
+			if (result != static_cast<size_t>(-1))
+			{
+				if (inLeft == 0)
+					break;
+			} else if (error == E2BIG) {
+				output.resize(output.size() * 2);
+			} else if (error == EILSEQ && inLeft > 0) {
+				in++;
+				inLeft--;
+			} else {
+				break; // Incomplete sequence at the end
+			}
+		}
+
+		output.resize(written);
+		return output;
+	}
+
+	std::mutex _mutex;
+	std::map<std::string, iconv_t> _converters;
+};
+
+bool isCharsetName(const std::string &name)
+{
+	static constexpr size_t maxLength = 40;
+	return !name.empty() && name.size() <= maxLength && std::all_of(name.begin(), name.end(), [](unsigned char c) {
+		return std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == ':';
+	});
+}
+
+}
+
+std::optional<std::string> convertToUtf8(std::string_view text, const std::string &charset)
+{
+	static ConverterCache converters;
+
+	std::string name;
+	std::transform(charset.begin(), charset.end(), std::back_inserter(name), [](unsigned char c) { return std::tolower(c); });
+	if (!isCharsetName(name))
+		return {};
+
+	if ((name == "utf-8" || name == "utf8") && isValidUtf8(text))
+		return std::string(text);
+
+	return converters.Convert(text, name);
+}
+
+std::string charsetFromContentType(std::string_view contentType)
+{
+	std::string lower;
+	std::transform(contentType.begin(), contentType.end(), std::back_inserter(lower), [](unsigned char c) { return std::tolower(c); });
+
+	auto parameter = lower.find("charset=");
+	if (parameter == lower.npos)
+		return "";
+
+	auto begin = parameter + 8;
+	while (begin < lower.size() && (lower[begin] == '"' || lower[begin] == '\'' || lower[begin] == ' '))
+		begin++;
+
+	auto end = begin;
+	while (end < lower.size() && lower[end] != '"' && lower[end] != '\'' && lower[end] != ';' && lower[end] != ' ')
+		end++;
+
+	return lower.substr(begin, end - begin);
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+TEST(Charset, Utf8)
+{
+	EXPECT_TRUE(isValidUtf8("plain ascii"));
+	EXPECT_TRUE(isValidUtf8("Заголовок 😀"));
+	EXPECT_FALSE(isValidUtf8("\xc7\xe0\xe3"));
+	EXPECT_FALSE(isValidUtf8("\xc0\xaf")); // overlong '/'
+	EXPECT_FALSE(isValidUtf8("\xed\xa0\x80")); // surrogate
+	EXPECT_FALSE(isValidUtf8("\xe2\x82"));
+}
+
+TEST(Charset, Convert)
+{
+	EXPECT_EQ("Заголовок", convertToUtf8("\xc7\xe0\xe3\xee\xeb\xee\xe2\xee\xea", "windows-1251"));
+	EXPECT_EQ("Заголовок", convertToUtf8("\xc7\xe0\xe3\xee\xeb\xee\xe2\xee\xea", "Windows-1251"));
+	EXPECT_EQ("Заголовок", convertToUtf8("\xfa\xc1\xc7\xcf\xcc\xcf\xd7\xcf\xcb", "koi8-r"));
+	EXPECT_EQ("café", convertToUtf8("caf\xe9", "iso-8859-1"));
+	EXPECT_FALSE(convertToUtf8("text", "no-such-charset"));
+	EXPECT_FALSE(convertToUtf8("text", std::string(4096, 'a')));
+	EXPECT_FALSE(convertToUtf8("text", "utf-8\n"));
+
+	// Invalid bytes are skipped rather than failing whole text
+	EXPECT_EQ("ab", convertToUtf8("a\xff" "b", "utf-8"));
+	EXPECT_EQ("Заг", convertToUtf8("\xc7\xe0\x98\xe3", "windows-1251")); // 0x98 is unassigned
+	EXPECT_EQ("Заг", convertToUtf8("\xc7\xe0\xe3", "WINDOWS-1251"));
+
+	EXPECT_EQ("windows-1251", charsetFromContentType("text/html; charset=Windows-1251"));
+	EXPECT_EQ("utf-8", charsetFromContentType("text/html;charset=\"utf-8\"; foo=bar"));
+	EXPECT_EQ("", charsetFromContentType("text/html"));
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+bool isValidUtf8(std::string_view text);
+
+/**
+ * @brief Convert text from charset (any name iconv knows) to UTF-8, skipping invalid bytes
+ * Converters are opened once per charset and kept
+ * @return Nothing if charset is unknown
+ */
+std::optional<std::string> convertToUtf8(std::string_view text, const std::string &charset);
+
+/**
+ * @brief Value of charset parameter of Content-Type, lower case, empty if there is none
+ */
+std::string charsetFromContentType(std::string_view contentType);
@@ -0,0 +1,282 @@
+#include "fulltextindex.h"
+
+#include <glog/logging.h>
+
+#include <sstream>
+#include <stdexcept>
+
+FullTextIndex::FullTextIndex(const std::string &path)
+{
+	if (sqlite3_open(path.c_str(), &_db) != SQLITE_OK)
+	{
+		LOG(ERROR) << "Failed to open " << path << " for full text search: " << sqlite3_errmsg(_db);
+		sqlite3_close(_db);
+		_db = nullptr;
+		return;
+	}
+
+	sqlite3_busy_timeout(_db, 5000);
+}
+
+FullTextIndex::~FullTextIndex()
+{
+	for (auto &statement : _statements)
+		sqlite3_finalize(statement.second);
+
+	if (_db)
+		sqlite3_close(_db);
+}
+
+bool FullTextIndex::Attach(const std::string &table)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_db || !Exists("table", table + "_fts"))
+		return false;
+
+	_attached.insert(table);
+	return true;
+}
+
+bool FullTextIndex::IsAttached(const std::string &table) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _attached.count(table) > 0;
+}
+
+std::vector<std::int64_t> FullTextIndex::Search(const std::string &table, const std::string &request, size_t limit)
+{
+	std::vector<std::int64_t> ids;
+	const auto query = MakeQuery(request);
+	if (query.empty())
+		return ids;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto index = table + "_fts";
+	auto statement = GetStatement("SELECT rowid FROM " + index + " WHERE " + index + " MATCH ? ORDER BY rank LIMIT ?");
+	if (!statement)
+		return ids;
+
+	sqlite3_bind_text(statement, 1, query.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(statement, 2, static_cast<sqlite3_int64>(limit));
+
+	int result;
+	while ((result = sqlite3_step(statement)) == SQLITE_ROW)
+		ids.push_back(sqlite3_column_int64(statement, 0));
+
+	if (result != SQLITE_DONE)
+		LOG(ERROR) << "Full text search in " << table << " failed: " << sqlite3_errmsg(_db);
+
+	sqlite3_reset(statement);
+	return ids;
+}
+
+size_t FullTextIndex::Count(const std::string &table, const std::string &request)
+{
+	const auto query = MakeQuery(request);
+	if (query.empty())
+		return 0;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto index = table + "_fts";
+	auto statement = GetStatement("SELECT count(*) FROM " + index + " WHERE " + index + " MATCH ?");
+	if (!statement)
+		return 0;
+
+	sqlite3_bind_text(statement, 1, query.c_str(), -1, SQLITE_TRANSIENT);
+
+	size_t count = 0;
+	if (sqlite3_step(statement) == SQLITE_ROW)
+		count = static_cast<size_t>(sqlite3_column_int64(statement, 0));
+	else
+		LOG(ERROR) << "Full text count in " << table << " failed: " << sqlite3_errmsg(_db);
+
+	sqlite3_reset(statement);
+	return count;
+}
+
+std::string FullTextIndex::MakeQuery(const std::string &request)
+{
+	std::istringstream words(request);
+	std::string word;
+	std::string query;
+	while (words >> word)
+	{
+		std::string quoted = "\"";
+		for (char c : word)
+		{
+			if (c == '"')
+				quoted += '"';
+			quoted += c;
+		}
+		quoted += "\"*";
+
+		if (!query.empty())
+			query += ' ';
+		query += quoted;
+	}
+	return query;
+}
+
+std::string FullTextIndex::CreateSql(const std::string &table, const std::string &column)
+{
+	const auto index = table + "_fts";
+	const auto insertRow = "INSERT INTO " + index + "(rowid, " + column + ") VALUES (new.id, new." + column + ");";
+	// Removing a row that isn't in external content index corrupts it
+	const auto deleteRow = "INSERT INTO " + index + "(" + index + ", rowid, " + column + ") SELECT 'delete', old.id, old." + column
+			+ " WHERE EXISTS (SELECT 1 FROM " + index + "_docsize WHERE id = old.id);";
+
+	return "CREATE VIRTUAL TABLE IF NOT EXISTS " + index + " USING fts5(" + column + ", content='" + table + "', content_rowid='id');"
+			"DROP TRIGGER IF EXISTS " + index + "_insert;"
+			"DROP TRIGGER IF EXISTS " + index + "_delete;"
+			"DROP TRIGGER IF EXISTS " + index + "_update;"
+			"CREATE TRIGGER " + index + "_insert AFTER INSERT ON " + table + " BEGIN " + insertRow + " END;"
+			"CREATE TRIGGER " + index + "_delete AFTER DELETE ON " + table + " BEGIN " + deleteRow + " END;"
+			"CREATE TRIGGER " + index + "_update AFTER UPDATE ON " + table + " BEGIN " + deleteRow + insertRow + " END;";
+}
+
+size_t FullTextIndex::IndexBatch(sqlite3 *db, const std::string &table, const std::string &column, std::int64_t &position, size_t batchSize)
+{
+	const auto index = table + "_fts";
+
+	sqlite3_stmt *range = nullptr;
+	sqlite3_prepare_v2(db, ("SELECT count(*), max(id) FROM (SELECT id FROM " + table + " WHERE id > ? ORDER BY id LIMIT ?)").c_str(), -1, &range, nullptr);
+	sqlite3_bind_int64(range, 1, position);
+	sqlite3_bind_int64(range, 2, static_cast<sqlite3_int64>(batchSize));
+
+	size_t visited = 0;
+	std::int64_t last = position;
+	if (sqlite3_step(range) == SQLITE_ROW)
+	{
+		visited = static_cast<size_t>(sqlite3_column_int64(range, 0));
+		last = sqlite3_column_int64(range, 1);
+	}
+	sqlite3_finalize(range);
+
+	if (visited == 0)
+		return 0;
+
+	sqlite3_stmt *insert = nullptr;
+	sqlite3_prepare_v2(db, ("INSERT INTO " + index + "(rowid, " + column + ") SELECT id, " + column + " FROM " + table
+							+ " WHERE id > ? AND id <= ? AND id NOT IN (SELECT id FROM " + index + "_docsize)").c_str(), -1, &insert, nullptr);
+	sqlite3_bind_int64(insert, 1, position);
+	sqlite3_bind_int64(insert, 2, last);
+	const auto result = sqlite3_step(insert);
+	sqlite3_finalize(insert);
+
+	if (result != SQLITE_DONE)
+	{
+		LOG(ERROR) << "Failed to index " << table << " rows after " << position << ": " << sqlite3_errmsg(db);
+		throw std::runtime_error(sqlite3_errmsg(db));
+	}
+
+	position = last;
+	return visited;
+}
+
+sqlite3_stmt *FullTextIndex::GetStatement(const std::string &sql)
+{
+	if (!_db)
+		return nullptr;
+
+	auto cached = _statements.find(sql);
+	if (cached != _statements.end())
+		return cached->second;
+
+	sqlite3_stmt *statement = nullptr;
+	if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, nullptr) != SQLITE_OK)
+	{
+		LOG(ERROR) << "Failed to prepare \"" << sql << "\": " << sqlite3_errmsg(_db);
+		sqlite3_finalize(statement);
+		return nullptr;
+	}
+
+	_statements[sql] = statement;
+	return statement;
+}
+
+bool FullTextIndex::Exists(const std::string &type, const std::string &name)
+{
+	auto statement = GetStatement("SELECT 1 FROM sqlite_master WHERE type = ? AND name = ?");
+	if (!statement)
+		return false;
+
+	sqlite3_bind_text(statement, 1, type.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(statement, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+	const bool exists = sqlite3_step(statement) == SQLITE_ROW;
+	sqlite3_reset(statement);
+	return exists;
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+TEST(FullTextIndex, MakeQuery)
+{
+	EXPECT_EQ("", FullTextIndex::MakeQuery("  "));
+	EXPECT_EQ("\"git\"*", FullTextIndex::MakeQuery("git"));
+	EXPECT_EQ("\"git\"* \"hub\"*", FullTextIndex::MakeQuery(" git  hub "));
+	EXPECT_EQ("\"say\"\"hi\"*", FullTextIndex::MakeQuery("say\"hi"));
+}
+
+TEST(FullTextIndex, SearchAndSync)
+{
+	const std::string path = "fulltextindex_test.db";
+	std::remove(path.c_str());
+
+	const auto exec = [](sqlite3 *db, const std::string &sql) {
+		ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+	};
+
+	sqlite3 *db = nullptr;
+	sqlite3_open(path.c_str(), &db);
+	exec(db, "CREATE TABLE quotes (id INTEGER PRIMARY KEY AUTOINCREMENT, quote TEXT);"
+			 "INSERT INTO quotes (quote) VALUES ('the quick brown fox');"
+			 "INSERT INTO quotes (quote) VALUES ('fox fox fox jumps');"
+			 "INSERT INTO quotes (quote) VALUES ('lazy dog');");
+
+	{
+		FullTextIndex index(path);
+		EXPECT_FALSE(index.Attach("quotes"));
+
+		exec(db, FullTextIndex::CreateSql("quotes", "quote"));
+
+		// Rows written and removed while old ones are being indexed
+		exec(db, "INSERT INTO quotes (quote) VALUES ('sleepy cat');"
+				 "DELETE FROM quotes WHERE id = 3;");
+
+		std::int64_t position = 0;
+		EXPECT_EQ(2, FullTextIndex::IndexBatch(db, "quotes", "quote", position, 2));
+		EXPECT_EQ(2, position);
+		EXPECT_EQ(1, FullTextIndex::IndexBatch(db, "quotes", "quote", position, 2));
+		EXPECT_EQ(0, FullTextIndex::IndexBatch(db, "quotes", "quote", position, 2));
+
+		ASSERT_TRUE(index.Attach("quotes"));
+		EXPECT_TRUE(index.IsAttached("quotes"));
+		EXPECT_FALSE(index.IsAttached("url_log"));
+
+		EXPECT_EQ(std::vector<std::int64_t>({2, 1}), index.Search("quotes", "fox", 10));
+		EXPECT_EQ(std::vector<std::int64_t>({2}), index.Search("quotes", "fox", 1));
+		EXPECT_EQ(std::vector<std::int64_t>({1}), index.Search("quotes", "qui bro", 10));
+		EXPECT_EQ(std::vector<std::int64_t>({4}), index.Search("quotes", "cat", 10));
+		EXPECT_EQ(2, index.Count("quotes", "fox"));
+		EXPECT_TRUE(index.Search("quotes", "dog", 10).empty());
+		EXPECT_TRUE(index.Search("quotes", "", 10).empty());
+
+		// Writes from other connections are indexed by triggers
+		exec(db, "DELETE FROM quotes WHERE id = 4;"
+				 "UPDATE quotes SET quote = 'slow turtle' WHERE id = 1;");
+
+		EXPECT_TRUE(index.Search("quotes", "cat", 10).empty());
+		EXPECT_EQ(std::vector<std::int64_t>({2}), index.Search("quotes", "fox", 10));
+		EXPECT_EQ(std::vector<std::int64_t>({1}), index.Search("quotes", "turtle", 10));
+		exec(db, "INSERT INTO quotes_fts(quotes_fts) VALUES ('integrity-check');");
+	}
+
+	sqlite3_close(db);
+	std::remove(path.c_str());
+}
+
+#endif // LCOV_EXCL_STOP
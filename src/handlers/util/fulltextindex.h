@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sqlite3.h>
+
+/**
+ * FTS5 indexes over text columns of storage tables. Index of "table" is an
+ * external content table "table_fts", kept in sync by triggers, so rows
+ * written through sqlite_orm are indexed without handlers knowing about it
+ *
+ * Triggers only remove rows that are indexed, so old rows can be indexed
+ * in batches while new ones are written
+ *
+ * Has its own connection, sqlite_orm doesn't know about virtual tables
+ */
+class FullTextIndex
+{
+public:
+	explicit FullTextIndex(const std::string &path);
+	~FullTextIndex();
+
+	/**
+	 * @brief Use index of the table for searches, it's created by schema migrations
+	 * @param table Table with integer primary key "id"
+	 * @return False if database can't be opened or has no index for the table
+	 */
+	bool Attach(const std::string &table);
+	bool IsAttached(const std::string &table) const;
+
+	/**
+	 * @brief Ids of rows matching all words of request (as prefixes), best matches (bm25) first
+	 */
+	std::vector<std::int64_t> Search(const std::string &table, const std::string &request, size_t limit);
+	size_t Count(const std::string &table, const std::string &request);
+
+	/**
+	 * @brief Turn user input into FTS5 query, every word is quoted and matched as prefix
+	 */
+	static std::string MakeQuery(const std::string &request);
+
+	/**
+	 * @brief Statements creating index of the table column and triggers keeping it in sync
+	 * Rows written before are not indexed, see IndexBatch
+	 */
+	static std::string CreateSql(const std::string &table, const std::string &column);
+
+	/**
+	 * @brief Index next rows written before index was created
+	 * @param position Last visited id, 0 at start
+	 * @return Number of visited rows, 0 when everything is indexed
+	 */
+	static size_t IndexBatch(sqlite3 *db, const std::string &table, const std::string &column, std::int64_t &position, size_t batchSize);
+
+private:
+	/**
+	 * @brief Prepared once per query text, reset for reuse. Call with _mutex held
+	 */
+	sqlite3_stmt *GetStatement(const std::string &sql);
+	bool Exists(const std::string &type, const std::string &name);
+
+	sqlite3 *_db = nullptr;
+	mutable std::mutex _mutex;
+	std::set<std::string> _attached;
+	std::unordered_map<std::string, sqlite3_stmt *> _statements;
+};
@@ -0,0 +1,218 @@
+#include "htmlentities.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#include "htmlentities_table.h"
+
+namespace {
+
+constexpr bool isSortedByName()
+{
+	for (size_t i = 1; i < std::size(htmlEntities); i++)
+		if (!(htmlEntities[i - 1]._name < htmlEntities[i]._name))
+			return false;
+	return true;
+}
+
+static_assert(isSortedByName(), "htmlEntities must be sorted by name for binary search");
+
+constexpr size_t MaxLegacyEntityLength = 6;
+
+bool isAlnum(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+int hexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+// Numeric references to C1 controls mean windows-1252 characters, see HTML5 spec
+std::uint32_t fixCodePoint(std::uint32_t codePoint)
+{
+	static constexpr std::uint32_t windows1252[32] = {
+		0x20AC, 0x81, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x8D, 0x017D, 0x8F,
+		0x90, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x9D, 0x017E, 0x0178,
+	};
+
+	if (codePoint == 0 || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+		return 0xFFFD;
+	if (codePoint >= 0x80 && codePoint <= 0x9F)
+		return windows1252[codePoint - 0x80];
+	return codePoint;
+}
+
+void appendUtf8(std::string &output, std::uint32_t codePoint)
+{
+	if (codePoint < 0x80)
+		output += static_cast<char>(codePoint);
+	else if (codePoint < 0x800)
+	{
+		output += static_cast<char>(0xC0 | (codePoint >> 6));
+		output += static_cast<char>(0x80 | (codePoint & 0x3F));
+	} else if (codePoint < 0x10000) {
+		output += static_cast<char>(0xE0 | (codePoint >> 12));
+		output += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		output += static_cast<char>(0x80 | (codePoint & 0x3F));
+	} else {
+		output += static_cast<char>(0xF0 | (codePoint >> 18));
+		output += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+		output += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		output += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+}
+
+/**
+ * @return Length of reference starting with "&#" at position, 0 if there is none
+ */
+size_t decodeNumeric(std::string_view input, size_t position, std::string &output)
+{
+	size_t digits = position + 2;
+	const bool hex = digits < input.size() && (input[digits] == 'x' || input[digits] == 'X');
+	if (hex)
+		digits++;
+
+	std::uint32_t codePoint = 0;
+	size_t end = digits;
+	for (; end < input.size(); end++)
+	{
+		const int value = hex ? hexValue(input[end]) : (input[end] >= '0' && input[end] <= '9' ? input[end] - '0' : -1);
+		if (value < 0)
+			break;
+
+		// Too large ones are replaced anyway, stop growing
+		if (codePoint <= 0x10FFFF)
+			codePoint = codePoint * (hex ? 16 : 10) + static_cast<std::uint32_t>(value);
+	}
+
+	if (end == digits)
+		return 0;
+
+	if (end < input.size() && input[end] == ';')
+		end++;
+
+	appendUtf8(output, fixCodePoint(codePoint));
+	return end - position;
+}
+
+/**
+ * @return Length of named reference starting with "&" at position, 0 if there is none
+ */
+size_t decodeNamed(std::string_view input, size_t position, std::string &output)
+{
+	const size_t name = position + 1;
+	size_t end = name;
+	while (end < input.size() && end - name < MaxHtmlEntityLength && isAlnum(input[end]))
+		end++;
+
+	if (end == name)
+		return 0;
+
+	if (end < input.size() && input[end] == ';')
+	{
+		if (auto value = findHTMLEntity(input.substr(name, end + 1 - name)))
+		{
+			output += *value;
+			return end + 1 - position;
+		}
+	}
+
+	// Legacy references go without ';', the longest one wins: "&notit" is "¬it"
+	for (size_t length = std::min(end - name, MaxLegacyEntityLength); length >= 2; length--)
+	{
+		if (auto value = findHTMLEntity(input.substr(name, length)))
+		{
+			output += *value;
+			return length + 1;
+		}
+	}
+
+	return 0;
+}
+
+}
+
+std::optional<std::string_view> findHTMLEntity(std::string_view name)
+{
+	auto entity = std::lower_bound(std::begin(htmlEntities), std::end(htmlEntities), name,
+								   [](const HtmlEntity &entity, std::string_view name) { return entity._name < name; });
+	if (entity == std::end(htmlEntities) || entity->_name != name)
+		return {};
+
+	return entity->_value;
+}
+
+std::string decodeHTMLEntities(std::string_view input)
+{
+	std::string output;
+	output.reserve(input.size());
+
+	size_t position = 0;
+	while (position < input.size())
+	{
+		auto ampersand = static_cast<const char *>(std::memchr(input.data() + position, '&', input.size() - position));
+		if (!ampersand)
+		{
+			output.append(input.substr(position));
+			break;
+		}
+
+		const size_t reference = static_cast<size_t>(ampersand - input.data());
+		output.append(input.substr(position, reference - position));
+
+		const bool numeric = reference + 1 < input.size() && input[reference + 1] == '#';
+		const size_t length = numeric ? decodeNumeric(input, reference, output) : decodeNamed(input, reference, output);
+		if (length == 0)
+		{
+			output += '&';
+			position = reference + 1;
+		} else {
+			position = reference + length;
+		}
+	}
+
+	return output;
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+TEST(HTMLEntities, Named)
+{
+	EXPECT_EQ("\"&><'", decodeHTMLEntities("&quot;&amp;&gt;&lt;&apos;"));
+	EXPECT_EQ("a — b • c", decodeHTMLEntities("a &mdash; b &bull; c"));
+	EXPECT_EQ("∉ ≂̸", decodeHTMLEntities("&notin; &NotEqualTilde;"));
+	EXPECT_EQ("&lt;", decodeHTMLEntities("&amp;lt;"));
+	EXPECT_EQ("&unknown; & &; &", decodeHTMLEntities("&unknown; & &; &"));
+
+	// Legacy ones work without ';'
+	EXPECT_EQ("Tom & Jerry © ¬it", decodeHTMLEntities("Tom &amp Jerry &copy ¬it"));
+	EXPECT_EQ("¬it", decodeHTMLEntities("&notit"));
+	EXPECT_EQ("&mdash", decodeHTMLEntities("&mdash"));
+
+	EXPECT_EQ("&", *findHTMLEntity("amp;"));
+	EXPECT_FALSE(findHTMLEntity("mdash"));
+}
+
+TEST(HTMLEntities, Numeric)
+{
+	EXPECT_EQ("' ' €", decodeHTMLEntities("&#39; &#x27; &#8364;"));
+	EXPECT_EQ("😀x", decodeHTMLEntities("&#x1F600;x"));
+	EXPECT_EQ("AB", decodeHTMLEntities("&#65&#X42;"));
+	EXPECT_EQ("– —", decodeHTMLEntities("&#150; &#151;"));
+	EXPECT_EQ("\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd", decodeHTMLEntities("&#0;&#xD800;&#99999999999;"));
+	EXPECT_EQ("&# &#x; &#z", decodeHTMLEntities("&# &#x; &#z"));
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Replace HTML character references (all HTML5 named ones, &#NNN; and &#xHH;) with UTF-8
+ * Unknown references are kept as they are
+ */
+std::string decodeHTMLEntities(std::string_view input);
+
+/**
+ * @brief UTF-8 value of named reference, name includes ';' if it was there
+ */
+std::optional<std::string_view> findHTMLEntity(std::string_view name);
@@ -0,0 +1,421 @@
+#include "htmlhead.h"
+
+#include <algorithm>
+
+#include "charset.h"
+
+namespace {
+
+char toLowerAscii(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+std::string toLowerAscii(std::string_view text)
+{
+	std::string result(text);
+	std::transform(result.begin(), result.end(), result.begin(), [](char c) { return toLowerAscii(c); });
+	return result;
+}
+
+bool startsWithNoCase(std::string_view text, std::string_view prefix)
+{
+	if (text.size() < prefix.size())
+		return false;
+
+	for (size_t i = 0; i < prefix.size(); i++)
+		if (toLowerAscii(text[i]) != prefix[i])
+			return false;
+
+	return true;
+}
+
+bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+bool isLetter(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+std::string_view trim(std::string_view text)
+{
+	while (!text.empty() && isSpace(text.front()))
+		text.remove_prefix(1);
+	while (!text.empty() && isSpace(text.back()))
+		text.remove_suffix(1);
+	return text;
+}
+
+void appendText(std::string &destination, std::string_view text)
+{
+	if (destination.size() < HtmlHeadParser::MaxTextLength)
+		destination.append(text.substr(0, HtmlHeadParser::MaxTextLength - destination.size()));
+}
+
+/**
+ * @return Position of '>' closing the tag, quoted values may contain it
+ */
+size_t findTagEnd(std::string_view tag)
+{
+	char quote = 0;
+	for (size_t i = 1; i < tag.size(); i++)
+	{
+		if (quote)
+		{
+			if (tag[i] == quote)
+				quote = 0;
+		} else if (tag[i] == '"' || tag[i] == '\'') {
+			quote = tag[i];
+		} else if (tag[i] == '>') {
+			return i;
+		}
+	}
+
+	return tag.npos;
+}
+
+// Tags which may be met in head, anything else starts body
+bool isHeadTag(std::string_view name)
+{
+	static constexpr std::string_view headTags[] = {
+		"base", "basefont", "bgsound", "head", "html", "link", "meta", "noscript", "script", "style", "template", "title",
+	};
+
+	return std::find(std::begin(headTags), std::end(headTags), name) != std::end(headTags);
+}
+
+}
+
+bool HtmlHeadParser::Feed(std::string_view chunk)
+{
+	if (_complete)
+		return false;
+
+	_bytes += chunk.size();
+
+	if (_pending.empty())
+	{
+		const auto consumed = Parse(chunk);
+		_pending.assign(chunk.substr(consumed));
+	} else {
+		_pending.append(chunk);
+		const auto consumed = Parse(_pending);
+		_pending.erase(0, consumed);
+	}
+
+	if (_complete)
+		_pending.clear();
+
+	return !_complete;
+}
+
+size_t HtmlHeadParser::Parse(std::string_view data)
+{
+	size_t position = 0;
+	while (!_complete && position < data.size())
+	{
+		if (_state == State::Comment)
+		{
+			const auto end = data.find("-->", position);
+			if (end == data.npos)
+				return std::max(position, data.size() - std::min<size_t>(data.size(), 2));
+
+			position = end + 3;
+			_state = State::Data;
+			continue;
+		}
+
+		const auto open = data.find('<', position);
+		if (_state == State::Title && _titleSeen)
+			appendText(_head._title, data.substr(position, std::min(open, data.size()) - position));
+
+		if (open == data.npos)
+			return data.size();
+
+		position = open;
+		const auto rest = data.substr(open);
+
+		if (_state == State::Title || _state == State::RawText)
+		{
+			// Only own closing tag ends these, other '<' are text
+			const std::string_view end = _state == State::Title ? std::string_view("</title") : std::string_view(_rawTextEnd);
+			if (rest.size() <= end.size())
+				return position;
+
+			const auto next = rest[end.size()];
+			if (!startsWithNoCase(rest, end) || !(isSpace(next) || next == '/' || next == '>'))
+			{
+				if (_state == State::Title && _titleSeen)
+					appendText(_head._title, "<");
+				position++;
+				continue;
+			}
+		} else {
+			if (rest.size() < 4 && std::string_view("<!--").substr(0, rest.size()) == rest)
+				return position;
+
+			if (rest.substr(0, 4) == "<!--")
+			{
+				position += 4;
+				_state = State::Comment;
+				continue;
+			}
+
+			if (rest.size() < 2)
+				return position;
+
+			const auto next = rest[1];
+			if (!isLetter(next) && next != '/' && next != '!' && next != '?')
+			{
+				position++;
+				continue;
+			}
+		}
+
+		const auto end = findTagEnd(rest);
+		if (end == rest.npos)
+		{
+			if (rest.size() <= MaxTagLength)
+				return position;
+
+			if (_state == State::Title && _titleSeen)
+				appendText(_head._title, "<");
+			position++;
+			continue;
+		}
+
+		HandleTag(rest.substr(1, end - 1));
+		position += end + 1;
+	}
+
+	return _complete ? data.size() : position;
+}
+
+void HtmlHeadParser::HandleTag(std::string_view tag)
+{
+	const bool closing = !tag.empty() && tag.front() == '/';
+	if (closing)
+		tag.remove_prefix(1);
+
+	// <!DOCTYPE ...> and <?xml ...?>
+	if (!tag.empty() && (tag.front() == '!' || tag.front() == '?'))
+		return;
+
+	size_t nameEnd = 0;
+	while (nameEnd < tag.size() && !isSpace(tag[nameEnd]) && tag[nameEnd] != '/')
+		nameEnd++;
+
+	const auto name = toLowerAscii(tag.substr(0, nameEnd));
+
+	if (closing)
+	{
+		if (_state == State::Title || _state == State::RawText)
+			_state = State::Data;
+		else if (name == "head" || name == "html" || !isHeadTag(name))
+			_complete = true;
+
+		if (name == "title")
+			_titleSeen = false;
+		return;
+	}
+
+	if (!isHeadTag(name))
+	{
+		_complete = true;
+		return;
+	}
+
+	if (name == "title")
+	{
+		// Only first title is taken, next ones are skipped as text
+		_titleSeen = _head._title.empty();
+		_state = State::Title;
+	} else if (name == "script" || name == "style" || name == "noscript") {
+		// Noscript in head is raw text for browsers with scripting, its <img> fallbacks don't start body
+		_rawTextEnd = "</" + name;
+		_state = State::RawText;
+	} else if (name == "meta") {
+		HandleMeta(ParseAttributes(tag.substr(nameEnd)));
+	}
+}
+
+void HtmlHeadParser::HandleMeta(const Attributes &attributes)
+{
+	auto find = [&attributes](std::string_view name) -> const std::string * {
+		for (const auto &attribute : attributes)
+			if (attribute.first == name)
+				return &attribute.second;
+		return nullptr;
+	};
+
+	const auto content = find("content");
+
+	if (auto charset = find("charset"))
+	{
+		if (_head._charset.empty())
+			_head._charset = toLowerAscii(trim(*charset));
+	} else if (auto httpEquiv = find("http-equiv"); httpEquiv && content) {
+		if (_head._charset.empty() && toLowerAscii(trim(*httpEquiv)) == "content-type")
+			_head._charset = charsetFromContentType(*content);
+	}
+
+	if (!content)
+		return;
+
+	// OpenGraph uses property, but name is common too
+	auto property = find("property");
+	if (!property)
+		property = find("name");
+	if (!property)
+		return;
+
+	const auto key = toLowerAscii(trim(*property));
+	if (key == "og:title" && _head._ogTitle.empty())
+		appendText(_head._ogTitle, trim(*content));
+	else if (key == "og:description" && _head._ogDescription.empty())
+		appendText(_head._ogDescription, trim(*content));
+}
+
+HtmlHeadParser::Attributes HtmlHeadParser::ParseAttributes(std::string_view tag)
+{
+	Attributes attributes;
+	size_t position = 0;
+	while (true)
+	{
+		while (position < tag.size() && (isSpace(tag[position]) || tag[position] == '/'))
+			position++;
+		if (position >= tag.size())
+			break;
+
+		const auto nameBegin = position;
+		while (position < tag.size() && !isSpace(tag[position]) && tag[position] != '=' && tag[position] != '/')
+			position++;
+		auto name = toLowerAscii(tag.substr(nameBegin, position - nameBegin));
+
+		while (position < tag.size() && isSpace(tag[position]))
+			position++;
+
+		std::string_view value;
+		if (position < tag.size() && tag[position] == '=')
+		{
+			position++;
+			while (position < tag.size() && isSpace(tag[position]))
+				position++;
+
+			if (position < tag.size() && (tag[position] == '"' || tag[position] == '\''))
+			{
+				const auto quote = tag[position++];
+				const auto end = std::min(tag.find(quote, position), tag.size());
+				value = tag.substr(position, end - position);
+				position = end + 1;
+			} else {
+				const auto valueBegin = position;
+				while (position < tag.size() && !isSpace(tag[position]))
+					position++;
+				value = tag.substr(valueBegin, position - valueBegin);
+			}
+		}
+
+		attributes.emplace_back(std::move(name), std::string(value));
+	}
+
+	return attributes;
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+namespace {
+
+HtmlHead parseInChunks(std::string_view page, size_t chunkSize)
+{
+	HtmlHeadParser parser;
+	for (size_t i = 0; i < page.size() && parser.Feed(page.substr(i, chunkSize)); i += chunkSize)
+		;
+	return parser.GetHead();
+}
+
+}
+
+TEST(HtmlHead, Parse)
+{
+	const std::string page = "<!DOCTYPE html>\n<HTML lang=en><Head>\n"
+							 "<!-- <title>Commented out</title> -->\n"
+							 "<meta content=\"text/html; charset=Windows-1251\" HTTP-EQUIV=\"Content-Type\">\n"
+							 "<script>if (a < b && c > d) document.write('<title>no</title>');</script>\n"
+							 "<style>p > a { color: red }</style>\n"
+							 "<title>\n  Test &amp; <b>title</b> </title>\n"
+							 "<title>Second</title>\n"
+							 "<META CONTENT='OG \"title\"' Property=og:title />\n"
+							 "<meta name=\"og:description\" content=\" Description > here \">\n"
+							 "</head><body><title>Body</title><meta property=og:title content=Body></body></HTML>";
+
+	// Every split must give the same result
+	for (size_t chunkSize = 1; chunkSize <= page.size(); chunkSize++)
+	{
+		const auto head = parseInChunks(page, chunkSize);
+		ASSERT_EQ("\n  Test &amp; <b>title</b> ", head._title) << chunkSize;
+		ASSERT_EQ("OG \"title\"", head._ogTitle) << chunkSize;
+		ASSERT_EQ("Description > here", head._ogDescription) << chunkSize;
+		ASSERT_EQ("windows-1251", head._charset) << chunkSize;
+	}
+
+	HtmlHeadParser parser;
+	EXPECT_TRUE(parser.Feed(page.substr(0, 100)));
+	EXPECT_FALSE(parser.IsComplete());
+	EXPECT_FALSE(parser.Feed(page.substr(100)));
+	EXPECT_TRUE(parser.IsComplete());
+	EXPECT_FALSE(parser.Feed("<title>More</title>"));
+	EXPECT_EQ(page.size(), parser.GetBytes());
+}
+
+TEST(HtmlHead, Complete)
+{
+	{
+		HtmlHeadParser parser;
+		EXPECT_TRUE(parser.Feed("<html><head><meta charset=\"UTF-8\"><title>Test</title>"));
+		EXPECT_EQ("utf-8", parser.GetHead()._charset);
+		EXPECT_FALSE(parser.Feed("<link rel=icon href=x></head>"));
+	}
+
+	{
+		// No head at all, body content ends it
+		HtmlHeadParser parser;
+		EXPECT_FALSE(parser.Feed("<title>Test</title><div>text</div><meta property=og:title content=x>"));
+		EXPECT_EQ("Test", parser.GetHead()._title);
+		EXPECT_EQ("", parser.GetHead()._ogTitle);
+	}
+
+	{
+		// Unclosed title is still taken
+		HtmlHeadParser parser;
+		EXPECT_TRUE(parser.Feed("<title>a < b"));
+		EXPECT_TRUE(parser.Feed(" and b > c</tit"));
+		EXPECT_EQ("a < b and b > c", parser.GetHead()._title);
+		EXPECT_TRUE(parser.Feed("le>"));
+		EXPECT_EQ("a < b and b > c", parser.GetHead()._title);
+	}
+
+	{
+		// '<' without '>' doesn't block parsing forever
+		HtmlHeadParser parser;
+		EXPECT_TRUE(parser.Feed("<meta content=\"" + std::string(HtmlHeadParser::MaxTagLength, 'x')));
+		EXPECT_TRUE(parser.Feed("<title>Test</title>"));
+		EXPECT_EQ("Test", parser.GetHead()._title);
+	}
+
+	{
+		// Tracking pixels in noscript don't end head
+		HtmlHeadParser parser;
+		EXPECT_TRUE(parser.Feed("<head><noscript><img src=\"pixel.gif\"><title>no</title></NoScript>"));
+		EXPECT_TRUE(parser.Feed("<meta property=og:title content=Test>"));
+		EXPECT_EQ("Test", parser.GetHead()._ogTitle);
+		EXPECT_EQ("", parser.GetHead()._title);
+	}
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class HtmlHead
+{
+public:
+	// As found in page: entities are not decoded, charset is not applied
+	std::string _title;
+	std::string _ogTitle;
+	std::string _ogDescription;
+	std::string _charset; // lower case, from meta charset or http-equiv Content-Type
+};
+
+/**
+ * Incremental tokenizer of HTML head: feed the page in chunks as they
+ * arrive, it stops at the end of head. Tag and attribute names are case
+ * insensitive, attributes may go in any order. Comments, scripts, styles
+ * and noscript are skipped, a tag that can't be in head ends it like in browsers
+ */
+class HtmlHeadParser
+{
+public:
+	static constexpr size_t MaxTagLength = 8192; // '<' not closed within this is text
+	static constexpr size_t MaxTextLength = 4096; // title and meta values are cut
+
+	/**
+	 * @brief Parse next chunk of page
+	 * @return false once head is over, later chunks are ignored
+	 */
+	bool Feed(std::string_view chunk);
+
+	bool IsComplete() const { return _complete; }
+	const HtmlHead &GetHead() const { return _head; }
+	size_t GetBytes() const { return _bytes; }
+
+private:
+	enum class State
+	{
+		Data,
+		Comment,
+		Title, // text up to </title>
+		RawText, // script, style or noscript, up to its closing tag
+	};
+
+	typedef std::vector<std::pair<std::string, std::string>> Attributes;
+
+	/**
+	 * @return Number of bytes consumed, the rest is an incomplete token
+	 */
+	size_t Parse(std::string_view data);
+	void HandleTag(std::string_view tag);
+	void HandleMeta(const Attributes &attributes);
+	static Attributes ParseAttributes(std::string_view tag);
+
+	State _state = State::Data;
+	std::string _rawTextEnd;
+	bool _titleSeen = false;
+	bool _complete = false;
+	size_t _bytes = 0;
+	std::string _pending;
+	HtmlHead _head;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "metrics.h"
+
+class HttpResponse
+{
+public:
+	bool IsOk() const { return _status >= 200 && _status < 300; }
+
+	long _status = 0; // 0 if request failed, see _error
+	std::string _body;
+	std::string _error;
+	std::string _contentType;
+	std::string _effectiveUrl; // after redirects
+	std::chrono::steady_clock::duration _elapsed{0};
+	std::uint64_t _downloaded = 0; // bytes of body as transferred, before decompression
+};
+
+class HttpRequest
+{
+public:
+	/**
+	 * @brief Gets decoded body as it arrives, with status and content type already set in response
+	 * Returning false stops the transfer, response then ends without error
+	 */
+	typedef std::function<bool(const HttpResponse &response, const char *data, size_t size)> DataCallback;
+
+	std::string _method = "GET";
+	std::string _url;
+	std::vector<std::string> _headers; // "Name: value"
+	std::string _body;
+	std::chrono::milliseconds _timeout{0}; // 0 uses timeout of the module
+	DataCallback _onData; // if set, body is passed here instead of response _body, on client thread
+};
+
+/**
+ * HTTP requests of all modules, made by one thread with curl multi
+ * interface. Connections are kept alive and reused per host, HTTP/2
+ * requests to the same host share a connection, resolved names are cached
+ *
+ * Every module has its own limit of requests in flight, requests over it
+ * wait in the module queue. Latency and errors are recorded per module and
+ * per host
+ */
+class HttpClient
+{
+public:
+	class Options
+	{
+	public:
+		long _maxConnections = 64; // open at once, for all hosts
+		long _maxHostConnections = 6;
+		long _maxIdleConnections = 32; // kept alive after requests are done
+		bool _http2 = true;
+		long _dnsCacheTimeout = 300; // seconds
+		std::string _userAgent = "lemongrab";
+	};
+
+	class Limits
+	{
+	public:
+		size_t _concurrency = 4; // requests in flight
+		std::chrono::milliseconds _timeout{5000};
+		std::chrono::milliseconds _connectTimeout{2000};
+		size_t _maxBodySize = 10 * 1024 * 1024; // longer responses fail
+		bool _followRedirects = true;
+	};
+
+	typedef std::function<void(HttpResponse response)> Callback;
+
+	/**
+	 * @param metrics If set, requests are recorded in handler and host metrics there
+	 */
+	HttpClient(const Options &options, Metrics *metrics = nullptr);
+	/**
+	 * @brief Cancels requests in flight, their callbacks get "Cancelled" error
+	 */
+	~HttpClient();
+
+	/**
+	 * @brief Cancel requests in flight and stop the client thread, later requests fail with "Cancelled" right away
+	 * Client stays valid for threads still using it. Must not be called from a callback
+	 */
+	void Shutdown();
+
+	/**
+	 * @brief Queue request, never blocks
+	 * @param limits Limits of the module, latest ones are used
+	 * @param callback Runs on client thread, hand long work over to another thread
+	 */
+	void Send(const std::string &module, const Limits &limits, HttpRequest request, Callback callback);
+	std::future<HttpResponse> Send(const std::string &module, const Limits &limits, HttpRequest request);
+
+	class Stats
+	{
+	public:
+		size_t _active = 0;
+		size_t _queued = 0;
+	};
+
+	Stats GetStats() const;
+
+	/**
+	 * @brief application/x-www-form-urlencoded body of the fields
+	 */
+	static std::string FormBody(const std::vector<std::pair<std::string, std::string>> &fields);
+	static std::string GetHost(const std::string &url);
+
+private:
+	class Transfer
+	{
+	public:
+		std::string _module;
+		Limits _limits;
+		HttpRequest _request;
+		Callback _callback;
+
+		CURL *_handle = nullptr;
+		curl_slist *_headers = nullptr;
+		HttpResponse _response;
+		bool _tooLarge = false;
+		bool _stopped = false; // by _onData
+		size_t _received = 0;
+		std::chrono::steady_clock::time_point _started;
+	};
+
+	class ModuleQueue
+	{
+	public:
+		Limits _limits;
+		size_t _active = 0;
+		std::deque<std::unique_ptr<Transfer>> _queued;
+	};
+
+	void EventLoop();
+	void StartQueued();
+	void Start(std::unique_ptr<Transfer> transfer);
+	void Finish(CURL *handle, CURLcode result);
+	void Complete(std::unique_ptr<Transfer> transfer);
+
+	static void ReadHeaders(CURL *handle, HttpResponse &response);
+	static size_t WriteBody(char *data, size_t size, size_t count, void *transfer);
+
+	const Options _options;
+	Metrics *_metrics;
+	CURLM *_multi = nullptr;
+
+	mutable std::mutex _queueMutex;
+	bool _isRunning = true;
+	std::deque<std::unique_ptr<Transfer>> _submitted;
+	std::map<std::string, ModuleQueue> _modules;
+	std::unordered_map<CURL *, std::unique_ptr<Transfer>> _active;
+
+	std::thread _thread;
+};
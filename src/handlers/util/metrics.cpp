@@ -0,0 +1,408 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration duration)
+{
+	auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+	Record(static_cast<std::uint64_t>(std::max<decltype(microseconds)>(microseconds, 0)));
+}
+
+void LatencyHistogram::Record(std::uint64_t microseconds)
+{
+	_buckets[BucketIndex(microseconds)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(microseconds, std::memory_order_relaxed);
+
+	auto max = _max.load(std::memory_order_relaxed);
+	while (microseconds > max && !_max.compare_exchange_weak(max, microseconds, std::memory_order_relaxed))
+		;
+}
+
+std::uint64_t LatencyHistogram::GetPercentile(double percentile) const
+{
+	const auto count = GetCount();
+	if (count == 0)
+		return 0;
+
+	const auto target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(count * percentile / 100.0)));
+
+	std::uint64_t seen = 0;
+	for (size_t index = 0; index < BucketCount; index++)
+	{
+		seen += _buckets[index].load(std::memory_order_relaxed);
+		if (seen >= target)
+			return std::min(BucketUpperBound(index), GetMax());
+	}
+
+	// Buckets were updated after count was read
+	return GetMax();
+}
+
+std::vector<std::uint64_t> LatencyHistogram::GetCumulativeCounts(const std::vector<std::uint64_t> &bounds) const
+{
+	std::vector<std::uint64_t> result(bounds.size(), 0);
+
+	std::uint64_t seen = 0;
+	size_t bound = 0;
+	for (size_t index = 0; index < BucketCount && bound < bounds.size(); index++)
+	{
+		while (bound < bounds.size() && BucketUpperBound(index) > bounds[bound])
+			result[bound++] = seen;
+
+		seen += _buckets[index].load(std::memory_order_relaxed);
+	}
+
+	while (bound < bounds.size())
+		result[bound++] = seen;
+
+	return result;
+}
+
+size_t LatencyHistogram::BucketIndex(std::uint64_t microseconds)
+{
+	if (microseconds < SubBuckets)
+		return microseconds;
+
+	unsigned exponent = 63 - __builtin_clzll(microseconds);
+	if (exponent >= MaxExponent)
+		return BucketCount - 1;
+
+	const auto shift = exponent - SubBucketBits;
+	const auto subBucket = (microseconds >> shift) & (SubBuckets - 1);
+	return SubBuckets + shift * SubBuckets + subBucket;
+}
+
+std::uint64_t LatencyHistogram::BucketUpperBound(size_t index)
+{
+	if (index < SubBuckets)
+		return index;
+
+	const auto shift = (index - SubBuckets) / SubBuckets;
+	const auto subBucket = (index - SubBuckets) % SubBuckets;
+	return ((SubBuckets + subBucket + 1) << shift) - 1;
+}
+
+void RateMeter::Mark(std::chrono::steady_clock::time_point now)
+{
+	const auto second = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+	const auto slot = second % Window;
+
+	auto slotSecond = _seconds[slot].load(std::memory_order_relaxed);
+	if (slotSecond != second && _seconds[slot].compare_exchange_strong(slotSecond, second, std::memory_order_relaxed))
+	{
+		_counts[slot].store(1, std::memory_order_relaxed);
+		return;
+	}
+
+	_counts[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+double RateMeter::GetRate(std::chrono::steady_clock::time_point now) const
+{
+	const auto second = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+
+	std::uint64_t total = 0;
+	for (std::int64_t slot = 0; slot < Window; slot++)
+	{
+		const auto slotSecond = _seconds[slot].load(std::memory_order_relaxed);
+		if (slotSecond < second && slotSecond >= second - Window)
+			total += _counts[slot].load(std::memory_order_relaxed);
+	}
+
+	return static_cast<double>(total) / Window;
+}
+
+HandlerMetrics &Metrics::GetHandler(const std::string &name)
+{
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	auto &metrics = _handlers[name];
+	if (!metrics)
+		metrics = std::make_unique<HandlerMetrics>();
+	return *metrics;
+}
+
+std::vector<std::pair<std::string, const HandlerMetrics *>> Metrics::GetHandlers() const
+{
+	std::vector<std::pair<std::string, const HandlerMetrics *>> result;
+
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	for (const auto &handler : _handlers)
+		result.emplace_back(handler.first, handler.second.get());
+
+	return result;
+}
+
+HostMetrics &Metrics::GetHttpHost(const std::string &host)
+{
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	auto existing = _httpHosts.find(host);
+	if (existing != _httpHosts.end())
+		return *existing->second;
+
+	auto &metrics = _httpHosts[_httpHosts.size() < MaxHttpHosts ? host : "other"];
+	if (!metrics)
+		metrics = std::make_unique<HostMetrics>();
+	return *metrics;
+}
+
+std::vector<std::pair<std::string, const HostMetrics *>> Metrics::GetHttpHosts() const
+{
+	std::vector<std::pair<std::string, const HostMetrics *>> result;
+
+	std::lock_guard<std::mutex> lock(_registryMutex);
+	for (const auto &host : _httpHosts)
+		result.emplace_back(host.first, host.second.get());
+
+	return result;
+}
+
+static void FormatCounter(std::string &output, const std::string &name, const std::string &labels, std::uint64_t value)
+{
+	output += name + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(value) + "\n";
+}
+
+static void FormatHistogram(std::string &output, const std::string &name, const std::string &labels, const LatencyHistogram &histogram)
+{
+	static const std::vector<std::uint64_t> bounds = {
+		1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+	};
+	static const std::vector<std::string> boundLabels = {
+		"0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10"
+	};
+
+	const auto separator = labels.empty() ? "" : ",";
+
+	// Count is read first, so +Inf never undercounts buckets
+	const auto count = histogram.GetCount();
+	const auto sum = histogram.GetSum();
+	const auto cumulative = histogram.GetCumulativeCounts(bounds);
+	for (size_t i = 0; i < bounds.size(); i++)
+		output += name + "_bucket{" + labels + separator + "le=\"" + boundLabels[i] + "\"} "
+				+ std::to_string(std::min(cumulative[i], count)) + "\n";
+
+	output += name + "_bucket{" + labels + separator + "le=\"+Inf\"} " + std::to_string(count) + "\n";
+	output += name + "_sum" + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(sum / 1e6) + "\n";
+	FormatCounter(output, name + "_count", labels, count);
+}
+
+std::string Metrics::FormatPrometheus() const
+{
+	std::string output;
+	const auto handlers = GetHandlers();
+
+	output += "# TYPE lemongrab_inbound_messages_total counter\n";
+	FormatCounter(output, "lemongrab_inbound_messages_total", "", _inboundMessages.Get());
+
+	output += "# TYPE lemongrab_outbound_queue_depth gauge\n";
+	output += "lemongrab_outbound_queue_depth " + std::to_string(_outboundDepth.Get()) + "\n";
+	output += "# TYPE lemongrab_outbound_sent_total counter\n";
+	FormatCounter(output, "lemongrab_outbound_sent_total", "", _outboundSent.Get());
+	output += "# TYPE lemongrab_outbound_dropped_total counter\n";
+	FormatCounter(output, "lemongrab_outbound_dropped_total", "", _outboundDropped.Get());
+	output += "# TYPE lemongrab_outbound_latency_seconds histogram\n";
+	FormatHistogram(output, "lemongrab_outbound_latency_seconds", "", _outboundLatency);
+
+	output += "# TYPE lemongrab_handler_calls_total counter\n";
+	for (const auto &handler : handlers)
+		FormatCounter(output, "lemongrab_handler_calls_total", "handler=\"" + handler.first + "\"", handler.second->_calls.Get());
+
+	output += "# TYPE lemongrab_handler_errors_total counter\n";
+	for (const auto &handler : handlers)
+		FormatCounter(output, "lemongrab_handler_errors_total", "handler=\"" + handler.first + "\"", handler.second->_errors.Get());
+
+	output += "# TYPE lemongrab_handler_latency_seconds histogram\n";
+	for (const auto &handler : handlers)
+		FormatHistogram(output, "lemongrab_handler_latency_seconds", "handler=\"" + handler.first + "\"", handler.second->_latency);
+
+	output += "# TYPE lemongrab_http_request_seconds histogram\n";
+	for (const auto &handler : handlers)
+		if (handler.second->_httpLatency.GetCount() > 0)
+			FormatHistogram(output, "lemongrab_http_request_seconds", "module=\"" + handler.first + "\"", handler.second->_httpLatency);
+
+	output += "# TYPE lemongrab_http_errors_total counter\n";
+	for (const auto &handler : handlers)
+		if (handler.second->_httpLatency.GetCount() > 0)
+			FormatCounter(output, "lemongrab_http_errors_total", "module=\"" + handler.first + "\"", handler.second->_httpErrors.Get());
+
+	output += "# TYPE lemongrab_http_downloaded_bytes_total counter\n";
+	for (const auto &handler : handlers)
+		if (handler.second->_httpLatency.GetCount() > 0)
+			FormatCounter(output, "lemongrab_http_downloaded_bytes_total", "module=\"" + handler.first + "\"", handler.second->_httpDownloaded.Get());
+
+	const auto hosts = GetHttpHosts();
+	output += "# TYPE lemongrab_http_host_requests_total counter\n";
+	for (const auto &host : hosts)
+		FormatCounter(output, "lemongrab_http_host_requests_total", "host=\"" + host.first + "\"", host.second->_requests.Get());
+	output += "# TYPE lemongrab_http_host_errors_total counter\n";
+	for (const auto &host : hosts)
+		FormatCounter(output, "lemongrab_http_host_errors_total", "host=\"" + host.first + "\"", host.second->_errors.Get());
+	output += "# TYPE lemongrab_http_host_request_seconds histogram\n";
+	for (const auto &host : hosts)
+		FormatHistogram(output, "lemongrab_http_host_request_seconds", "host=\"" + host.first + "\"", host.second->_latency);
+
+	output += "# TYPE lemongrab_sqlite_query_seconds histogram\n";
+	FormatHistogram(output, "lemongrab_sqlite_query_seconds", "", _sqliteQueries);
+	output += "# TYPE lemongrab_sqlite_write_queue_depth gauge\n";
+	output += "lemongrab_sqlite_write_queue_depth " + std::to_string(_sqliteWriteQueue.Get()) + "\n";
+	output += "# TYPE lemongrab_sqlite_writes_total counter\n";
+	FormatCounter(output, "lemongrab_sqlite_writes_total", "", _sqliteWrites.Get());
+	output += "# TYPE lemongrab_sqlite_commits_total counter\n";
+	FormatCounter(output, "lemongrab_sqlite_commits_total", "", _sqliteCommits.Get());
+
+	output += "# TYPE lemongrab_discord_rest_failures_total counter\n";
+	FormatCounter(output, "lemongrab_discord_rest_failures_total", "", _discordRestFailures.Get());
+
+	output += "# TYPE lemongrab_seen_writes_avoided_total counter\n";
+	FormatCounter(output, "lemongrab_seen_writes_avoided_total", "", _seenWritesAvoided.Get());
+
+	output += "# TYPE lemongrab_url_title_cache_lookups_total counter\n";
+	FormatCounter(output, "lemongrab_url_title_cache_lookups_total", "result=\"hit\"", _titleCacheHits.Get());
+	FormatCounter(output, "lemongrab_url_title_cache_lookups_total", "result=\"miss\"", _titleCacheMisses.Get());
+	FormatCounter(output, "lemongrab_url_title_cache_lookups_total", "result=\"shared\"", _titleCacheShared.Get());
+	output += "# TYPE lemongrab_url_title_cache_entries gauge\n";
+	output += "lemongrab_url_title_cache_entries " + std::to_string(_titleCacheEntries.Get()) + "\n";
+	output += "# TYPE lemongrab_url_title_cache_bytes gauge\n";
+	output += "lemongrab_url_title_cache_bytes " + std::to_string(_titleCacheBytes.Get()) + "\n";
+
+	return output;
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+TEST(Metrics, HistogramBuckets)
+{
+	for (std::uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull})
+	{
+		auto index = LatencyHistogram::BucketIndex(value);
+		EXPECT_LE(value, LatencyHistogram::BucketUpperBound(index));
+		if (index > 0) {
+			EXPECT_GT(value, LatencyHistogram::BucketUpperBound(index - 1));
+		}
+	}
+
+	EXPECT_EQ(LatencyHistogram::BucketCount - 1, LatencyHistogram::BucketIndex(~0ull));
+}
+
+TEST(Metrics, HistogramPercentiles)
+{
+	LatencyHistogram histogram;
+	EXPECT_EQ(0, histogram.GetPercentile(50));
+
+	for (std::uint64_t value = 1; value <= 1000; value++)
+		histogram.Record(value);
+
+	EXPECT_EQ(1000, histogram.GetCount());
+	EXPECT_EQ(500500, histogram.GetSum());
+	EXPECT_EQ(1000, histogram.GetMax());
+
+	for (double percentile : {50.0, 90.0, 99.0})
+	{
+		auto value = histogram.GetPercentile(percentile);
+		EXPECT_GE(value, percentile * 10);
+		EXPECT_LE(value, percentile * 10 * 1.0625);
+	}
+
+	EXPECT_EQ(1000, histogram.GetPercentile(100));
+}
+
+TEST(Metrics, HistogramConcurrent)
+{
+	LatencyHistogram histogram;
+	std::vector<std::thread> threads;
+	for (int thread = 0; thread < 4; thread++)
+		threads.emplace_back([&histogram, thread]{
+			for (int i = 0; i < 10000; i++)
+				histogram.Record(std::chrono::microseconds(thread * 100 + i % 10));
+		});
+
+	for (auto &thread : threads)
+		thread.join();
+
+	EXPECT_EQ(40000, histogram.GetCount());
+	EXPECT_EQ(309, histogram.GetMax());
+}
+
+TEST(Metrics, RateMeter)
+{
+	RateMeter meter;
+	std::chrono::steady_clock::time_point start(std::chrono::hours(1));
+
+	for (int i = 0; i < 120; i++)
+		meter.Mark(start + std::chrono::milliseconds(i * 500));
+
+	// Two events per second for the whole minute before
+	EXPECT_DOUBLE_EQ(2.0, meter.GetRate(start + std::chrono::seconds(60)));
+	EXPECT_DOUBLE_EQ(1.0, meter.GetRate(start + std::chrono::seconds(90)));
+	EXPECT_DOUBLE_EQ(0.0, meter.GetRate(start + std::chrono::seconds(200)));
+}
+
+TEST(Metrics, Registry)
+{
+	Metrics metrics;
+	auto &url = metrics.GetHandler("url");
+	url._calls.Increment();
+	EXPECT_EQ(&url, &metrics.GetHandler("url"));
+
+	metrics.GetHandler("seen");
+	auto handlers = metrics.GetHandlers();
+	ASSERT_EQ(2, handlers.size());
+	EXPECT_EQ("seen", handlers[0].first);
+	EXPECT_EQ("url", handlers[1].first);
+	EXPECT_EQ(1, handlers[1].second->_calls.Get());
+}
+
+TEST(Metrics, HttpHosts)
+{
+	Metrics metrics;
+	auto &github = metrics.GetHttpHost("github.com");
+	EXPECT_EQ(&github, &metrics.GetHttpHost("github.com"));
+
+	for (size_t i = 1; i < Metrics::MaxHttpHosts; i++)
+		metrics.GetHttpHost("host" + std::to_string(i));
+
+	auto &other = metrics.GetHttpHost("example.com");
+	EXPECT_EQ(&other, &metrics.GetHttpHost("example.org"));
+	EXPECT_EQ(&github, &metrics.GetHttpHost("github.com"));
+	EXPECT_EQ(Metrics::MaxHttpHosts + 1, metrics.GetHttpHosts().size());
+
+	github._requests.Increment();
+	EXPECT_NE(std::string::npos, metrics.FormatPrometheus().find("lemongrab_http_host_requests_total{host=\"github.com\"} 1\n"));
+}
+
+TEST(Metrics, Prometheus)
+{
+	Metrics metrics;
+	metrics._inboundMessages.Increment(3);
+	metrics._outboundDepth.Set(2);
+
+	auto &url = metrics.GetHandler("url");
+	url._calls.Increment();
+	url._latency.Record(std::chrono::milliseconds(3));
+	url._latency.Record(std::chrono::seconds(20));
+	metrics.GetHandler("seen");
+
+	const auto output = metrics.FormatPrometheus();
+	auto contains = [&output](const std::string &line) { return output.find(line + "\n") != std::string::npos; };
+
+	EXPECT_TRUE(contains("lemongrab_inbound_messages_total 3"));
+	EXPECT_TRUE(contains("lemongrab_outbound_queue_depth 2"));
+	EXPECT_TRUE(contains("lemongrab_handler_calls_total{handler=\"url\"} 1"));
+	EXPECT_TRUE(contains("lemongrab_handler_latency_seconds_bucket{handler=\"url\",le=\"0.001\"} 0"));
+	EXPECT_TRUE(contains("lemongrab_handler_latency_seconds_bucket{handler=\"url\",le=\"0.005\"} 1"));
+	EXPECT_TRUE(contains("lemongrab_handler_latency_seconds_bucket{handler=\"url\",le=\"10\"} 1"));
+	EXPECT_TRUE(contains("lemongrab_handler_latency_seconds_bucket{handler=\"url\",le=\"+Inf\"} 2"));
+	EXPECT_TRUE(contains("lemongrab_handler_latency_seconds_count{handler=\"url\"} 2"));
+	EXPECT_TRUE(contains("lemongrab_handler_calls_total{handler=\"seen\"} 0"));
+	EXPECT_TRUE(contains("lemongrab_sqlite_query_seconds_count 0"));
+
+	// Handlers without HTTP traffic are not reported
+	EXPECT_EQ(std::string::npos, output.find("lemongrab_http_request_seconds_count"));
+}
+
+#endif // LCOV_EXCL_STOP
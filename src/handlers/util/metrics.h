@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Metrics are written from hot paths: all updates are relaxed atomic
+ * operations, only registration of a new name takes a lock
+ */
+
+class Counter
+{
+public:
+	void Increment(std::uint64_t value = 1) { _value.fetch_add(value, std::memory_order_relaxed); }
+	std::uint64_t Get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<std::uint64_t> _value{0};
+};
+
+class Gauge
+{
+public:
+	void Set(std::int64_t value) { _value.store(value, std::memory_order_relaxed); }
+	std::int64_t Get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<std::int64_t> _value{0};
+};
+
+/**
+ * @brief Log-linear (HDR-style) histogram of latencies in microseconds
+ * Every power of two is split into 16 buckets, so reported percentiles
+ * are within 6.25% of the real value
+ */
+class LatencyHistogram
+{
+public:
+	static constexpr unsigned SubBucketBits = 4;
+	static constexpr std::uint64_t SubBuckets = 1 << SubBucketBits;
+	static constexpr unsigned MaxExponent = 36; // ~19 hours, longer values are clamped
+	static constexpr size_t BucketCount = SubBuckets + (MaxExponent - SubBucketBits) * SubBuckets;
+
+	void Record(std::chrono::steady_clock::duration duration);
+	void Record(std::uint64_t microseconds);
+
+	std::uint64_t GetCount() const { return _count.load(std::memory_order_relaxed); }
+	std::uint64_t GetSum() const { return _sum.load(std::memory_order_relaxed); }
+	std::uint64_t GetMax() const { return _max.load(std::memory_order_relaxed); }
+
+	/**
+	 * @param percentile 0..100
+	 * @return Upper bound of the bucket containing the percentile, in microseconds
+	 */
+	std::uint64_t GetPercentile(double percentile) const;
+
+	/**
+	 * @brief Number of values not greater than each of (ascending) bounds, in microseconds
+	 * Values sharing a bucket with a bound are counted in the next one
+	 */
+	std::vector<std::uint64_t> GetCumulativeCounts(const std::vector<std::uint64_t> &bounds) const;
+
+	static size_t BucketIndex(std::uint64_t microseconds);
+	static std::uint64_t BucketUpperBound(size_t index);
+
+private:
+	std::array<std::atomic<std::uint64_t>, BucketCount> _buckets{};
+	std::atomic<std::uint64_t> _count{0};
+	std::atomic<std::uint64_t> _sum{0};
+	std::atomic<std::uint64_t> _max{0};
+};
+
+/**
+ * @brief Event rate over the last minute, in one-second slots
+ * Slot rollover is not synchronized, so an event landing exactly on it may be lost
+ */
+class RateMeter
+{
+public:
+	static constexpr std::int64_t Window = 60;
+
+	void Mark(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+	/**
+	 * @brief Events per second over the last Window complete seconds
+	 */
+	double GetRate(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
+
+private:
+	std::array<std::atomic<std::uint64_t>, Window> _counts{};
+	std::array<std::atomic<std::int64_t>, Window> _seconds{};
+};
+
+class HandlerMetrics
+{
+public:
+	Counter _calls;
+	Counter _errors;
+	LatencyHistogram _latency;
+
+	// Outgoing HTTP requests made by the handler
+	LatencyHistogram _httpLatency;
+	Counter _httpErrors;
+	Counter _httpDownloaded; // bytes
+};
+
+class HostMetrics
+{
+public:
+	Counter _requests;
+	Counter _errors;
+	LatencyHistogram _latency;
+};
+
+class Metrics
+{
+public:
+	static constexpr size_t MaxHttpHosts = 100; // later hosts are counted together as "other"
+
+	/**
+	 * @brief Get or create metrics of a handler
+	 * Takes a lock, look it up once and keep the reference, it stays valid
+	 */
+	HandlerMetrics &GetHandler(const std::string &name);
+	std::vector<std::pair<std::string, const HandlerMetrics *>> GetHandlers() const;
+
+	/**
+	 * @brief Get or create metrics of requests to a host, same rules as GetHandler
+	 */
+	HostMetrics &GetHttpHost(const std::string &host);
+	std::vector<std::pair<std::string, const HostMetrics *>> GetHttpHosts() const;
+
+	/**
+	 * @brief Everything in Prometheus text exposition format
+	 */
+	std::string FormatPrometheus() const;
+
+	Counter _inboundMessages;
+	RateMeter _inboundRate;
+
+	Gauge _outboundDepth;
+	Counter _outboundSent;
+	Counter _outboundDropped;
+	LatencyHistogram _outboundLatency;
+
+	LatencyHistogram _sqliteQueries;
+	Gauge _sqliteWriteQueue;
+	Counter _sqliteWrites;
+	Counter _sqliteCommits;
+	Counter _discordRestFailures;
+	Counter _seenWritesAvoided;
+
+	Counter _titleCacheHits;
+	Counter _titleCacheMisses;
+	Counter _titleCacheShared;
+	Gauge _titleCacheEntries;
+	Gauge _titleCacheBytes;
+
+private:
+	mutable std::mutex _registryMutex;
+	std::map<std::string, std::unique_ptr<HandlerMetrics>> _handlers;
+	std::map<std::string, std::unique_ptr<HostMetrics>> _httpHosts;
+};
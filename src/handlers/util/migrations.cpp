@@ -0,0 +1,327 @@
+#include "migrations.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "fulltextindex.h"
+#include "thread_util.h"
+#include "urlarchive.h"
+
+SchemaMigrations::SchemaMigrations(const std::string &path, const Options &options)
+	: _options(options)
+{
+	if (sqlite3_open(path.c_str(), &_db) != SQLITE_OK)
+	{
+		LOG(ERROR) << "Failed to open " << path << " for schema migrations: " << sqlite3_errmsg(_db);
+		sqlite3_close(_db);
+		_db = nullptr;
+		return;
+	}
+
+	sqlite3_busy_timeout(_db, 5000);
+	Exec("CREATE TABLE IF NOT EXISTS schema_migrations ("
+		 "version INTEGER PRIMARY KEY NOT NULL, "
+		 "description TEXT NOT NULL, "
+		 "applied INTEGER NOT NULL, "
+		 "position INTEGER NOT NULL DEFAULT 0)");
+}
+
+SchemaMigrations::~SchemaMigrations()
+{
+	_stop = true;
+	if (_background.joinable())
+		_background.join();
+
+	if (_db)
+		sqlite3_close(_db);
+}
+
+bool SchemaMigrations::Run(const std::vector<Migration> &migrations, std::function<void()> onFinished)
+{
+	if (!_db)
+		return false;
+
+	if (_background.joinable())
+		_background.join();
+
+	const auto version = GetVersion();
+	std::vector<Migration> pending;
+	std::copy_if(migrations.begin(), migrations.end(), std::back_inserter(pending), [version](const Migration &migration) {
+		return migration._version > version;
+	});
+	std::sort(pending.begin(), pending.end(), [](const Migration &lhs, const Migration &rhs) {
+		return lhs._version < rhs._version;
+	});
+
+	for (auto migration = pending.begin(); migration != pending.end(); ++migration)
+	{
+		if (GetPosition(migration->_version) < 0 && !ApplyQuickPart(*migration))
+			return false;
+
+		if (migration->_batch)
+		{
+			_running = true;
+			_background = std::thread(&SchemaMigrations::BackgroundThread, this, std::vector<Migration>(migration, pending.end()), onFinished);
+			nameThread(_background, "Migrations");
+			return true;
+		}
+	}
+
+	if (onFinished)
+		onFinished();
+	return true;
+}
+
+int SchemaMigrations::GetVersion()
+{
+	int version = 0;
+	sqlite3_stmt *statement = nullptr;
+	if (sqlite3_prepare_v2(_db, "SELECT coalesce(max(version), 0) FROM schema_migrations WHERE applied = 1", -1, &statement, nullptr) == SQLITE_OK
+			&& sqlite3_step(statement) == SQLITE_ROW)
+		version = sqlite3_column_int(statement, 0);
+	sqlite3_finalize(statement);
+	return version;
+}
+
+bool SchemaMigrations::Exec(const std::string &sql)
+{
+	char *error = nullptr;
+	if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+	{
+		LOG(ERROR) << "Schema migration statement failed: " << (error ? error : "unknown error");
+		sqlite3_free(error);
+		return false;
+	}
+	return true;
+}
+
+bool SchemaMigrations::ApplyQuickPart(const Migration &migration)
+{
+	if (!Exec("BEGIN IMMEDIATE"))
+		return false;
+
+	bool success = migration._sql.empty() || Exec(migration._sql);
+	if (success)
+	{
+		sqlite3_stmt *statement = nullptr;
+		sqlite3_prepare_v2(_db, "INSERT INTO schema_migrations (version, description, applied, position) VALUES (?, ?, ?, 0)", -1, &statement, nullptr);
+		sqlite3_bind_int(statement, 1, migration._version);
+		sqlite3_bind_text(statement, 2, migration._description.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int(statement, 3, migration._batch ? 0 : 1);
+		success = sqlite3_step(statement) == SQLITE_DONE;
+		sqlite3_finalize(statement);
+	}
+
+	if (!success || !Exec("COMMIT"))
+	{
+		LOG(ERROR) << "Schema migration " << migration._version << " (" << migration._description << ") failed";
+		Exec("ROLLBACK");
+		return false;
+	}
+
+	LOG(INFO) << "Schema migration " << migration._version << " (" << migration._description << ")"
+			  << (migration._batch ? " started" : " applied");
+	return true;
+}
+
+bool SchemaMigrations::ApplyBatches(const Migration &migration)
+{
+	auto position = GetPosition(migration._version);
+	while (!_stop)
+	{
+		if (!Exec("BEGIN IMMEDIATE"))
+			return false;
+
+		size_t processed = 0;
+		try {
+			processed = migration._batch(_db, position, _options._batchSize);
+		} catch (std::exception &e) {
+			LOG(ERROR) << "Schema migration " << migration._version << " batch failed: " << e.what();
+			Exec("ROLLBACK");
+			return false;
+		}
+
+		sqlite3_stmt *statement = nullptr;
+		sqlite3_prepare_v2(_db, "UPDATE schema_migrations SET position = ?, applied = ? WHERE version = ?", -1, &statement, nullptr);
+		sqlite3_bind_int64(statement, 1, position);
+		sqlite3_bind_int(statement, 2, processed == 0 ? 1 : 0);
+		sqlite3_bind_int(statement, 3, migration._version);
+		const bool saved = sqlite3_step(statement) == SQLITE_DONE;
+		sqlite3_finalize(statement);
+
+		if (!saved || !Exec("COMMIT"))
+		{
+			Exec("ROLLBACK");
+			return false;
+		}
+
+		if (processed == 0)
+		{
+			LOG(INFO) << "Schema migration " << migration._version << " (" << migration._description << ") applied";
+			return true;
+		}
+
+		std::this_thread::sleep_for(_options._pause);
+	}
+
+	return false;
+}
+
+void SchemaMigrations::BackgroundThread(std::vector<Migration> migrations, std::function<void()> onFinished)
+{
+	for (const auto &migration : migrations)
+	{
+		if (GetPosition(migration._version) < 0 && !ApplyQuickPart(migration))
+			break;
+
+		if (migration._batch && !ApplyBatches(migration))
+			break; // Stopped or failed, resumes on next start
+
+		if (&migration == &migrations.back() && onFinished)
+			onFinished();
+	}
+
+	_running = false;
+}
+
+std::int64_t SchemaMigrations::GetPosition(int version)
+{
+	std::int64_t position = -1;
+	sqlite3_stmt *statement = nullptr;
+	sqlite3_prepare_v2(_db, "SELECT position FROM schema_migrations WHERE version = ?", -1, &statement, nullptr);
+	sqlite3_bind_int(statement, 1, version);
+	if (sqlite3_step(statement) == SQLITE_ROW)
+		position = sqlite3_column_int64(statement, 0);
+	sqlite3_finalize(statement);
+	return position;
+}
+
+std::vector<SchemaMigrations::Migration> storageMigrations()
+{
+	const auto fullTextIndex = [](const std::string &table, const std::string &column) {
+		return [table, column](sqlite3 *db, std::int64_t &position, size_t batchSize) {
+			return FullTextIndex::IndexBatch(db, table, column, position, batchSize);
+		};
+	};
+
+	return {
+		{1, "Initial schema",
+			"CREATE TABLE IF NOT EXISTS 'rss' ('id' INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, 'URL' TEXT NOT NULL, 'GUID' TEXT NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'url_rules' ('id' INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, 'rule' TEXT NOT NULL, 'blacklist' INTEGER NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'url_log' ('id' INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, 'URL' TEXT NOT NULL, 'title' TEXT NOT NULL, 'time' INTEGER NOT NULL, 'fulltext' TEXT NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'quotes' ('id' INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, 'index' INTEGER NOT NULL, 'quote' TEXT NOT NULL, 'author' TEXT NOT NULL, 'author_id' TEXT NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'pager' ('id' INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, 'recepient' TEXT NOT NULL, 'message' TEXT NOT NULL, 'timepoint' INTEGER NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'summoners' ('id' INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, 'summonerID' INTEGER NOT NULL, 'nick' TEXT NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'nicks' ('nick' TEXT PRIMARY KEY NOT NULL, 'uniqueID' TEXT NOT NULL);"
+			"CREATE TABLE IF NOT EXISTS 'useractivity' ('uniqueID' TEXT PRIMARY KEY NOT NULL, 'nick' TEXT NOT NULL, 'message' TEXT NOT NULL, 'timepoint_status' INTEGER NOT NULL, 'timepoint_message' INTEGER NOT NULL);",
+			{}},
+		{2, "Full text index of url_log", FullTextIndex::CreateSql("url_log", "fulltext"), fullTextIndex("url_log", "fulltext")},
+		{3, "Full text index of quotes", FullTextIndex::CreateSql("quotes", "quote"), fullTextIndex("quotes", "quote")},
+		{4, "Index of quote numbers", "CREATE INDEX IF NOT EXISTS quotes_index ON quotes('index');", {}},
+		{5, "Archive of old URLs", UrlArchive::CreateSql(), {}},
+		{6, "Index of logged URLs", "CREATE INDEX IF NOT EXISTS url_log_url ON url_log(URL);", {}},
+	};
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "sqlite_db.h"
+
+static int countRows(const std::string &path, const std::string &table)
+{
+	sqlite3 *db = nullptr;
+	sqlite3_open(path.c_str(), &db);
+	sqlite3_stmt *statement = nullptr;
+	sqlite3_prepare_v2(db, ("SELECT count(*) FROM " + table).c_str(), -1, &statement, nullptr);
+	int count = sqlite3_step(statement) == SQLITE_ROW ? sqlite3_column_int(statement, 0) : -1;
+	sqlite3_finalize(statement);
+	sqlite3_close(db);
+	return count;
+}
+
+TEST(SchemaMigrations, QuickAndBatches)
+{
+	const std::string path = "migrations_test.db";
+	std::remove(path.c_str());
+
+	std::vector<SchemaMigrations::Migration> migrations = {
+		{1, "Table", "CREATE TABLE items (id INTEGER PRIMARY KEY, value INTEGER);"
+					 "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 25) INSERT INTO items SELECT i, 0 FROM n;", {}},
+		{2, "Backfill", "", [](sqlite3 *db, std::int64_t &position, size_t batchSize) -> size_t {
+			const auto sql = "UPDATE items SET value = 1 WHERE id > " + std::to_string(position) + " AND id <= " + std::to_string(position + batchSize);
+			sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr);
+			position += batchSize;
+			return static_cast<size_t>(sqlite3_changes(db));
+		}},
+		{3, "Copy", "CREATE TABLE copy AS SELECT * FROM items WHERE value = 1;", {}},
+	};
+
+	SchemaMigrations::Options options;
+	options._batchSize = 10;
+	options._pause = std::chrono::milliseconds(0);
+
+	{
+		SchemaMigrations schema(path, options);
+		EXPECT_EQ(0, schema.GetVersion());
+
+		std::atomic<bool> finished{false};
+		ASSERT_TRUE(schema.Run({migrations[0]}, [&] { finished = true; }));
+		EXPECT_TRUE(finished);
+		EXPECT_EQ(1, schema.GetVersion());
+
+		finished = false;
+		ASSERT_TRUE(schema.Run(migrations, [&] { finished = true; }));
+		while (schema.IsRunningInBackground())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		EXPECT_TRUE(finished);
+		EXPECT_EQ(3, schema.GetVersion());
+		EXPECT_EQ(25, countRows(path, "copy"));
+	}
+
+	{
+		// Nothing to do on next start
+		SchemaMigrations schema(path, options);
+		bool finished = false;
+		ASSERT_TRUE(schema.Run(migrations, [&] { finished = true; }));
+		EXPECT_TRUE(finished);
+		EXPECT_FALSE(schema.IsRunningInBackground());
+	}
+
+	std::remove(path.c_str());
+}
+
+TEST(SchemaMigrations, StorageSchema)
+{
+	const std::string path = "migrations_storage_test.db";
+	std::remove(path.c_str());
+
+	{
+		SchemaMigrations schema(path, SchemaMigrations::Options());
+		ASSERT_TRUE(schema.Run(storageMigrations()));
+		while (schema.IsRunningInBackground())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		EXPECT_EQ(storageMigrations().back()._version, schema.GetVersion());
+		EXPECT_EQ(0, countRows(path, "url_log_fts"));
+		EXPECT_EQ(0, countRows(path, "quotes_fts"));
+	}
+
+	{
+		// Tables created by migrations must match what storage maps, or sync_schema would rebuild them
+		auto storage = initStorage(path);
+		const auto tables = storage.sync_schema_simulate();
+		EXPECT_FALSE(tables.empty());
+		for (const auto &table : tables)
+			EXPECT_EQ(sqlite_orm::sync_schema_result::already_in_sync, table.second) << table.first;
+	}
+
+	std::remove(path.c_str());
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+
+/**
+ * Versioned schema changes. Applied versions are recorded in schema_migrations,
+ * so startup with an up to date database is a single query
+ *
+ * Quick parts of migrations run at startup, each in its own transaction. Once
+ * a migration with batches is reached, its batches and every later migration
+ * continue on a background thread, one transaction per batch, and resume after
+ * restart from the saved position
+ */
+class SchemaMigrations
+{
+public:
+	class Migration
+	{
+	public:
+		int _version;
+		std::string _description;
+		std::string _sql; // quick schema change
+		/**
+		 * @brief Heavy part run after _sql, called until it returns 0
+		 * @param position Saved with each batch, 0 at start
+		 * @return Number of processed rows
+		 */
+		std::function<size_t(sqlite3 *db, std::int64_t &position, size_t batchSize)> _batch;
+	};
+
+	class Options
+	{
+	public:
+		size_t _batchSize = 1000;
+		std::chrono::milliseconds _pause{50}; // between batches, lets the bot write
+	};
+
+	SchemaMigrations(const std::string &path, const Options &options);
+	~SchemaMigrations();
+
+	/**
+	 * @brief Apply pending migrations in version order
+	 * @param onFinished Called when every migration is applied, right away if there were none pending
+	 * @return False if a quick part failed, later migrations are not applied
+	 */
+	bool Run(const std::vector<Migration> &migrations, std::function<void()> onFinished = {});
+
+	/**
+	 * @brief Version of the last fully applied migration, 0 for a new database
+	 */
+	int GetVersion();
+	bool IsRunningInBackground() const { return _running; }
+
+private:
+	bool Exec(const std::string &sql);
+	bool ApplyQuickPart(const Migration &migration);
+	bool ApplyBatches(const Migration &migration);
+	void BackgroundThread(std::vector<Migration> migrations, std::function<void()> onFinished);
+
+	/**
+	 * @brief Position of a migration whose batches are in progress, -1 if it wasn't started
+	 */
+	std::int64_t GetPosition(int version);
+
+	sqlite3 *_db = nullptr;
+	const Options _options;
+	std::atomic<bool> _running{false};
+	std::atomic<bool> _stop{false};
+	std::thread _background;
+};
+
+/**
+ * @brief Migrations of the bot storage (local.db), in version order
+ * Version 1 is the schema as sqlite_orm created it, change it only with new migrations
+ */
+std::vector<SchemaMigrations::Migration> storageMigrations();
@@ -2,6 +2,8 @@
 
 #include <sqlite_orm/sqlite_orm.h>
 
+#include "metrics.h"
+
 namespace DB
 {
 	class RssFeed
@@ -143,3 +145,14 @@ inline auto initStorage(const std::string &path)
 }
 
 typedef decltype(initStorage("")) Storage;
+
+/**
+ * @brief Record execution time of every statement run on the connection
+ */
+inline void profileQueries(sqlite3 *db, LatencyHistogram &histogram)
+{
+	sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, [](unsigned, void *context, void *, void *nanoseconds) {
+		static_cast<LatencyHistogram *>(context)->Record(static_cast<std::uint64_t>(*static_cast<sqlite3_int64 *>(nanoseconds) / 1000));
+		return 0;
+	}, &histogram);
+}
@@ -0,0 +1,362 @@
+#include "storageengine.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <exception>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_util.h"
+
+namespace {
+
+std::string describeError(const std::exception_ptr &error)
+{
+	try {
+		std::rethrow_exception(error);
+	} catch (std::exception &e) {
+		return e.what();
+	} catch (...) {
+		return "unknown error";
+	}
+}
+
+}
+
+class StorageEngine::Readers
+{
+public:
+	std::mutex _mutex;
+	std::unordered_map<std::thread::id, std::unique_ptr<Storage>> _connections;
+};
+
+// Closes connections of the thread in every engine still alive when it exits
+class StorageEngine::ThreadReaders
+{
+public:
+	~ThreadReaders()
+	{
+		for (auto &engineReaders : _engines)
+		{
+			if (auto readers = engineReaders.lock())
+			{
+				std::unique_ptr<Storage> connection;
+				std::lock_guard<std::mutex> lock(readers->_mutex);
+				auto reader = readers->_connections.find(std::this_thread::get_id());
+				if (reader != readers->_connections.end())
+				{
+					connection = std::move(reader->second);
+					readers->_connections.erase(reader);
+				}
+			}
+		}
+	}
+
+	std::vector<std::weak_ptr<Readers>> _engines;
+};
+
+StorageEngine::StorageEngine(const std::string &path, const Options &options, Metrics *metrics)
+	: _path(path)
+	, _options(options)
+	, _metrics(metrics)
+	, _readers(std::make_shared<Readers>())
+{
+	_writer = std::thread(&StorageEngine::WriterThread, this);
+	nameThread(_writer, "SQLite writer");
+}
+
+StorageEngine::~StorageEngine()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wakeup.notify_one();
+
+	if (_writer.joinable())
+		_writer.join();
+}
+
+Storage &StorageEngine::GetReader()
+{
+	thread_local ThreadReaders threadReaders;
+
+	std::lock_guard<std::mutex> lock(_readers->_mutex);
+	auto &reader = _readers->_connections[std::this_thread::get_id()];
+	if (!reader)
+	{
+		reader = OpenConnection();
+
+		// Engines which are gone don't need to be remembered
+		auto &engines = threadReaders._engines;
+		engines.erase(std::remove_if(engines.begin(), engines.end(), [](const auto &engine) { return engine.expired(); }), engines.end());
+		engines.push_back(_readers);
+	}
+	return *reader;
+}
+
+void StorageEngine::Write(WriteJob job)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back({std::move(job), nullptr});
+		_queued++;
+		if (_metrics)
+			_metrics->_sqliteWriteQueue.Set(static_cast<std::int64_t>(_jobs.size()));
+	}
+	_wakeup.notify_one();
+}
+
+void StorageEngine::WriteAndWait(const WriteJob &job)
+{
+	std::exception_ptr error;
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_jobs.push_back({[&job](Storage &storage) { job(storage); }, &error});
+	// Jobs are committed in queue order
+	const auto sequence = ++_queued;
+	if (_metrics)
+		_metrics->_sqliteWriteQueue.Set(static_cast<std::int64_t>(_jobs.size()));
+	_wakeup.notify_one();
+
+	_committed.wait(lock, [this, sequence] { return _written >= sequence; });
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void StorageEngine::Flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_committed.wait(lock, [this] { return _jobs.empty() && !_writing; });
+}
+
+StorageEngine::Stats StorageEngine::GetStats() const
+{
+	Stats stats;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		stats._pending = _jobs.size();
+		stats._written = _written;
+		stats._commits = _commits;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_readers->_mutex);
+		stats._readers = _readers->_connections.size();
+	}
+	return stats;
+}
+
+void StorageEngine::ConfigureConnection(sqlite3 *db, const Options &options)
+{
+	static const std::set<std::string> synchronousModes = {"OFF", "NORMAL", "FULL", "EXTRA"};
+	const auto synchronous = synchronousModes.count(options._synchronous) > 0 ? options._synchronous : "NORMAL";
+
+	std::string pragmas = "PRAGMA journal_mode=WAL;"
+						  "PRAGMA synchronous=" + synchronous + ";"
+						  "PRAGMA mmap_size=" + std::to_string(options._mmapSize) + ";";
+	if (options._cacheSize > 0)
+		pragmas += "PRAGMA cache_size=-" + std::to_string(options._cacheSize) + ";"; // negative is KiB
+
+	sqlite3_busy_timeout(db, options._busyTimeout);
+
+	char *error = nullptr;
+	if (sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+	{
+		LOG(ERROR) << "Failed to configure SQLite connection: " << (error ? error : "unknown error");
+		sqlite3_free(error);
+	}
+}
+
+std::unique_ptr<Storage> StorageEngine::OpenConnection(sqlite3 **handle)
+{
+	auto storage = std::make_unique<Storage>(initStorage(_path));
+	storage->on_open = [this, handle](sqlite3 *db) {
+		if (handle)
+			*handle = db;
+		ConfigureConnection(db, _options);
+		if (_metrics)
+			profileQueries(db, _metrics->_sqliteQueries);
+	};
+	storage->open_forever();
+	return storage;
+}
+
+void StorageEngine::WriterThread()
+{
+	sqlite3 *db = nullptr;
+	auto storage = OpenConnection(&db);
+
+	// Transaction and savepoints are managed here, sqlite_orm statements run inside them on the same connection
+	const auto exec = [&db](const char *sql) -> std::exception_ptr {
+		if (db && sqlite3_exec(db, sql, nullptr, nullptr, nullptr) == SQLITE_OK)
+			return nullptr;
+		return std::make_exception_ptr(std::runtime_error(std::string(sql) + ": " + (db ? sqlite3_errmsg(db) : "no connection")));
+	};
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_wakeup.wait(lock, [this] { return _stop || !_jobs.empty(); });
+		if (_jobs.empty())
+			break; // Stopping with nothing left to write
+
+		// Everything that piled up while previous transaction was committing goes into this one
+		std::vector<QueuedWrite> batch;
+		while (!_jobs.empty() && batch.size() < _options._maxBatch)
+		{
+			batch.push_back(std::move(_jobs.front()));
+			_jobs.pop_front();
+		}
+		_writing = true;
+		if (_metrics)
+			_metrics->_sqliteWriteQueue.Set(static_cast<std::int64_t>(_jobs.size()));
+		lock.unlock();
+
+		auto commitError = exec("BEGIN");
+		if (!commitError)
+		{
+			for (auto &write : batch)
+			{
+				std::exception_ptr error = exec("SAVEPOINT write_job");
+				if (!error)
+				{
+					try {
+						write._job(*storage);
+					} catch (...) {
+						error = std::current_exception();
+					}
+
+					// Partial changes of a failed job are not committed with the rest
+					if (error)
+						exec("ROLLBACK TO write_job");
+					exec("RELEASE write_job");
+				}
+
+				if (error)
+				{
+					LOG(ERROR) << "Storage write failed: " << describeError(error);
+					if (write._error)
+						*write._error = error;
+				}
+			}
+
+			commitError = exec("COMMIT");
+			if (commitError)
+				exec("ROLLBACK");
+		}
+
+		if (commitError)
+		{
+			LOG(ERROR) << "Failed to commit " << batch.size() << " storage writes: " << describeError(commitError);
+			for (auto &write : batch)
+				if (write._error && !*write._error)
+					*write._error = commitError;
+		}
+
+		if (_metrics)
+		{
+			_metrics->_sqliteWrites.Increment(batch.size());
+			if (!commitError)
+				_metrics->_sqliteCommits.Increment();
+		}
+
+		lock.lock();
+		_written += batch.size();
+		if (!commitError)
+			_commits++;
+		_writing = false;
+		_committed.notify_all();
+	}
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+TEST(StorageEngine, WriteAndRead)
+{
+	const std::string path = "storageengine_test.db";
+	std::remove(path.c_str());
+
+	{
+		auto storage = initStorage(path);
+		storage.sync_schema();
+	}
+
+	{
+		StorageEngine engine(path, StorageEngine::Options());
+
+		for (int i = 0; i < 100; i++)
+			engine.Write([i](Storage &storage) {
+				storage.insert(DB::Quote{-1, i, "quote " + std::to_string(i), "author", ""});
+			});
+
+		engine.Flush();
+
+		const auto stats = engine.GetStats();
+		EXPECT_EQ(0, stats._pending);
+		EXPECT_EQ(100, stats._written);
+		EXPECT_GE(100, stats._commits);
+
+		// Reader on another thread sees committed writes through its own connection
+		int count = 0;
+		std::thread reader([&] { count = engine.GetReader().count<DB::Quote>(); });
+		reader.join();
+		EXPECT_EQ(100, count);
+		// and closes it on exit
+		EXPECT_EQ(0, engine.GetStats()._readers);
+
+		EXPECT_EQ(100, engine.GetReader().count<DB::Quote>());
+		EXPECT_EQ(1, engine.GetStats()._readers);
+	}
+
+	std::remove(path.c_str());
+	std::remove((path + "-wal").c_str());
+	std::remove((path + "-shm").c_str());
+}
+
+TEST(StorageEngine, WriteAndWait)
+{
+	const std::string path = "storageengine_wait_test.db";
+	std::remove(path.c_str());
+
+	{
+		auto storage = initStorage(path);
+		storage.sync_schema();
+	}
+
+	{
+		StorageEngine engine(path, StorageEngine::Options());
+
+		int id = 0;
+		engine.WriteAndWait([&id](Storage &storage) {
+			id = storage.insert(DB::Quote{-1, 1, "quote", "author", ""});
+		});
+		EXPECT_NE(0, id);
+
+		// Committed by the time it returns
+		EXPECT_EQ(1, engine.GetReader().count<DB::Quote>());
+
+		EXPECT_THROW(engine.WriteAndWait([](Storage &) { throw std::runtime_error("failure"); }), std::runtime_error);
+		EXPECT_EQ(2, engine.GetStats()._written);
+
+		// Failed job is rolled back, jobs batched with it are still committed
+		engine.Write([](Storage &storage) { storage.insert(DB::Quote{-1, 2, "before", "author", ""}); });
+		EXPECT_THROW(engine.WriteAndWait([](Storage &storage) {
+			storage.insert(DB::Quote{-1, 3, "partial", "author", ""});
+			throw std::runtime_error("failure");
+		}), std::runtime_error);
+		engine.WriteAndWait([](Storage &storage) { storage.insert(DB::Quote{-1, 4, "after", "author", ""}); });
+		EXPECT_EQ(3, engine.GetReader().count<DB::Quote>());
+	}
+
+	std::remove(path.c_str());
+	std::remove((path + "-wal").c_str());
+	std::remove((path + "-shm").c_str());
+}
+
+#endif // LCOV_EXCL_STOP
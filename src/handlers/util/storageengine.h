@@ -0,0 +1,120 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "sqlite_db.h"
+#include "metrics.h"
+
+/**
+ * WAL mode storage: every thread reads through its own connection, writes
+ * are queued to a single writer thread which commits everything queued so
+ * far in one transaction. Each write runs in its own savepoint, a failed
+ * one is rolled back without affecting the rest of the batch
+ *
+ * Connections stay open while their thread lives, sqlite_orm otherwise opens
+ * the file and reparses the schema for every statement
+ */
+class StorageEngine
+{
+public:
+	typedef std::function<void(Storage &storage)> WriteJob;
+
+	class Options
+	{
+	public:
+		std::string _synchronous = "NORMAL"; // OFF, NORMAL, FULL or EXTRA
+		std::int64_t _mmapSize = 0;          // bytes, 0 disables memory mapped I/O
+		std::int64_t _cacheSize = 0;         // page cache per connection in KiB, 0 keeps SQLite default
+		int _busyTimeout = 5000;             // milliseconds to wait for a lock
+		size_t _maxBatch = 256;              // writes committed in one transaction
+	};
+
+	/**
+	 * @param path Database file, in-memory databases can't be shared between connections
+	 * @param metrics If set, queries of all connections and commits are recorded there
+	 */
+	StorageEngine(const std::string &path, const Options &options, Metrics *metrics = nullptr);
+	~StorageEngine();
+
+	/**
+	 * @brief Connection of the calling thread, opened on first use and closed when thread exits
+	 */
+	Storage &GetReader();
+
+	/**
+	 * @brief Queue write for the writer thread, never blocks
+	 */
+	void Write(WriteJob job);
+
+	/**
+	 * @brief Queue write and wait until it's committed, exception thrown by job or failed commit is rethrown here
+	 * Job may capture references. Must not be called from a write job
+	 */
+	void WriteAndWait(const WriteJob &job);
+
+	/**
+	 * @brief Wait until everything queued so far is committed
+	 */
+	void Flush();
+
+	class Stats
+	{
+	public:
+		size_t _pending = 0;
+		std::uint64_t _written = 0;
+		std::uint64_t _commits = 0;
+		size_t _readers = 0;
+	};
+
+	Stats GetStats() const;
+
+	/**
+	 * @brief Apply journal mode and tuning pragmas to a connection
+	 */
+	static void ConfigureConnection(sqlite3 *db, const Options &options);
+
+private:
+	class Readers;
+	class ThreadReaders;
+
+	class QueuedWrite
+	{
+	public:
+		WriteJob _job;
+		std::exception_ptr *_error = nullptr; // Set by writer if job or its commit fails, for waiting writes
+	};
+
+	/**
+	 * @param handle If set, receives SQLite handle of the connection
+	 */
+	std::unique_ptr<Storage> OpenConnection(sqlite3 **handle = nullptr);
+	void WriterThread();
+
+	const std::string _path;
+	const Options _options;
+	Metrics *_metrics;
+
+	// Shared with threads, which close their connections on exit
+	const std::shared_ptr<Readers> _readers;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::condition_variable _committed;
+	std::deque<QueuedWrite> _jobs;
+	bool _writing = false;
+	bool _stop = false;
+	std::uint64_t _queued = 0;
+	std::uint64_t _written = 0;
+	std::uint64_t _commits = 0;
+
+	std::thread _writer;
+};
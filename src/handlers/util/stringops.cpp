@@ -1,5 +1,8 @@
 #include "stringops.h"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <regex>
 #include <boost/locale.hpp>
 
@@ -81,7 +84,91 @@ std::vector<std::string> tokenize(const std::string &input, char separator, int
 	return tokens;
 }
 
+namespace {
+
+class UrlCharacters
+{
+public:
+	UrlCharacters()
+	{
+		for (int c = 0; c < 256; c++)
+			_host[c] = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.';
+
+		_path = _host;
+		for (unsigned char c : std::string("-_~:/?#[]@!$&'()*+,;=%"))
+			_path[c] = true;
+	}
+
+	bool IsHost(char c) const { return _host[static_cast<unsigned char>(c)]; }
+	bool IsPath(char c) const { return _path[static_cast<unsigned char>(c)]; }
+
+private:
+	std::array<bool, 256> _host{};
+	std::array<bool, 256> _path{};
+};
+
+}
+
 std::list<URL> findURLs(const std::string &input)
+{
+	static const UrlCharacters characters;
+
+	std::list<URL> output;
+	const char *data = input.data();
+	const size_t size = input.size();
+
+	// Scheme separators are rare in chat, memchr finds them a vector at a time
+	size_t position = 0;
+	size_t searchFrom = 0;
+	while (searchFrom < size)
+	{
+		auto colon = static_cast<const char *>(std::memchr(data + searchFrom, ':', size - searchFrom));
+		if (!colon)
+			break;
+
+		const size_t separator = static_cast<size_t>(colon - data);
+		searchFrom = separator + 1;
+		if (separator + 3 > size || data[separator + 1] != '/' || data[separator + 2] != '/')
+			continue;
+
+		size_t start;
+		if (separator >= position + 5 && input.compare(separator - 5, 5, "https") == 0)
+			start = separator - 5;
+		else if (separator >= position + 4 && input.compare(separator - 4, 4, "http") == 0)
+			start = separator - 4;
+		else
+			continue;
+
+		// Same as "(?:www.)?" in the old regex: prefix is skipped only if host goes on after it
+		size_t host = separator + 3;
+		if (host + 4 < size && input.compare(host, 3, "www") == 0
+				&& data[host + 3] != '\n' && data[host + 3] != '\r' && characters.IsHost(data[host + 4]))
+			host += 4;
+
+		size_t end = host;
+		while (end < size && characters.IsHost(data[end]))
+			end++;
+		if (end == host)
+			continue;
+
+		const size_t hostEnd = end;
+		while (end < size && characters.IsPath(data[end]))
+			end++;
+
+		auto anchor = static_cast<const char *>(std::memchr(data + start, '#', end - start));
+		const size_t urlEnd = anchor ? static_cast<size_t>(anchor - data) : end;
+		output.push_back(URL(input.substr(start, urlEnd - start), input.substr(host, hostEnd - host)));
+
+		position = end;
+		searchFrom = end;
+	}
+
+	output.erase(std::unique(output.begin(), output.end()), output.end());
+
+	return output;
+}
+
+std::list<URL> findURLsRegex(const std::string &input)
 {
 	std::list<URL> output;
 
@@ -148,6 +235,8 @@ std::optional<size_t> from_string<size_t>(const std::string &input)
 
 #include <gtest/gtest.h>
 
+#include <random>
+
 TEST(StringOps, toLower_ruRU)
 {
 	boost::locale::generator gen;
@@ -181,6 +270,37 @@ TEST(StringOps, findURLs)
 	EXPECT_EQ("youtube.com", urls.begin()->_hostname);
 }
 
+TEST(StringOps, findURLsMatchesRegex)
+{
+	// Pieces likely to hit edge cases of the old regex
+	const std::vector<std::string> pieces = {
+		"http://", "https://", "http:/", "https:", "htt", "s://", "://", "www", "www.", "wwwx", ".",
+		"example", "com", "ru", "42", "/", "?", "#", "&", "=", "-", "_", "~", "%20", "[", "]", "(", ")",
+		" ", "\n", "\r", "\t", ",", "\"", "<", ">", "^", "|", "\\", "тест", "\xff", "\x80", "HTTP://",
+	};
+
+	std::mt19937 generator(7);
+	std::uniform_int_distribution<size_t> pick(0, pieces.size() - 1);
+	std::uniform_int_distribution<int> length(0, 40);
+	for (int i = 0; i < 20000; i++)
+	{
+		std::string input;
+		for (int count = length(generator); count > 0; count--)
+			input += pieces[pick(generator)];
+
+		const auto expected = findURLsRegex(input);
+		auto urls = findURLs(input);
+		ASSERT_EQ(expected.size(), urls.size()) << input;
+		auto url = urls.begin();
+		for (const auto &expectedUrl : expected)
+		{
+			EXPECT_EQ(expectedUrl._url, url->_url) << input;
+			EXPECT_EQ(expectedUrl._hostname, url->_hostname) << input;
+			url++;
+		}
+	}
+}
+
 TEST(StringOps, beginsWith)
 {
 	EXPECT_TRUE(beginsWith("!test", "!test"));
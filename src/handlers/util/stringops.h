@@ -34,7 +34,14 @@ public:
 	}
 };
 
+/**
+ * @brief http(s) links in the text, anchors stripped, consecutive duplicates removed
+ */
 std::list<URL> findURLs(const std::string &input);
+/**
+ * @brief Same as findURLs, with the std::regex it used to be. Reference for tests and benchmarks
+ */
+std::list<URL> findURLsRegex(const std::string &input);
 
 std::string CustomTimeFormat(std::chrono::system_clock::duration input);
 
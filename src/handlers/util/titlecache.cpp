@@ -0,0 +1,269 @@
+#include "titlecache.h"
+
+#include <glog/logging.h>
+
+TitleCache::TitleCache(const Options &options, Metrics *metrics)
+	: _options(options)
+	, _metrics(metrics)
+{
+}
+
+std::shared_future<TitleCache::Entry> TitleCache::Lookup(const std::string &url, const AsyncFetch &fetch)
+{
+	auto promise = std::make_shared<std::promise<Entry>>();
+	std::shared_future<Entry> result = promise->get_future().share();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto cached = _entries.find(url);
+		if (cached != _entries.end() && IsFresh(cached->second->second))
+		{
+			_lru.splice(_lru.begin(), _lru, cached->second);
+			_stats._hits++;
+			if (_metrics)
+				_metrics->_titleCacheHits.Increment();
+			promise->set_value(cached->second->second);
+			return result;
+		}
+
+		auto pending = _inFlight.find(url);
+		if (pending != _inFlight.end())
+		{
+			_stats._shared++;
+			if (_metrics)
+				_metrics->_titleCacheShared.Increment();
+			return pending->second;
+		}
+
+		_inFlight.emplace(url, result);
+		_stats._misses++;
+		if (_metrics)
+			_metrics->_titleCacheMisses.Increment();
+	}
+
+	auto done = [this, url, promise](Entry entry) {
+		if (entry._fetched == std::chrono::system_clock::time_point())
+			entry._fetched = std::chrono::system_clock::now();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			Insert(url, entry);
+			_inFlight.erase(url);
+		}
+
+		promise->set_value(std::move(entry));
+	};
+
+	try {
+		fetch(url, done);
+	} catch (std::exception &e) {
+		LOG(ERROR) << "Failed to fetch title of " << url << ": " << e.what();
+		done(Entry());
+	}
+
+	return result;
+}
+
+TitleCache::Entry TitleCache::Get(const std::string &url, const Fetch &fetch)
+{
+	return Lookup(url, [&fetch](const std::string &url, Done done) { done(fetch(url)); }).get();
+}
+
+std::optional<TitleCache::Entry> TitleCache::Find(const std::string &url) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto cached = _entries.find(url);
+	if (cached == _entries.end() || !IsFresh(cached->second->second))
+		return {};
+
+	return cached->second->second;
+}
+
+void TitleCache::Put(const std::string &url, Entry entry)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto cached = _entries.find(url);
+	if (cached != _entries.end() && cached->second->second._fetched > entry._fetched)
+		return;
+
+	Insert(url, std::move(entry));
+}
+
+bool TitleCache::IsFresh(const Entry &entry, std::chrono::system_clock::time_point now) const
+{
+	return now - entry._fetched < (entry.IsOk() ? _options._ttl : _options._failureTtl);
+}
+
+TitleCache::Stats TitleCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+size_t TitleCache::EntrySize(const std::string &url, const Entry &entry)
+{
+	// List node, hash map node and the key stored in both of them
+	constexpr size_t overhead = sizeof(LruList::value_type) + 2 * sizeof(void *)
+			+ sizeof(std::pair<const std::string, LruList::iterator>) + 2 * sizeof(void *);
+	return overhead + 2 * url.capacity() + entry._title.capacity();
+}
+
+void TitleCache::Insert(const std::string &url, Entry entry)
+{
+	auto cached = _entries.find(url);
+	if (cached != _entries.end())
+	{
+		_stats._bytes -= EntrySize(url, cached->second->second);
+		cached->second->second = std::move(entry);
+		_stats._bytes += EntrySize(url, cached->second->second);
+		_lru.splice(_lru.begin(), _lru, cached->second);
+	} else {
+		_lru.emplace_front(url, std::move(entry));
+		_entries.emplace(url, _lru.begin());
+		_stats._bytes += EntrySize(url, _lru.front().second);
+	}
+
+	while (_lru.size() > _options._maxEntries)
+	{
+		const auto &oldest = _lru.back();
+		_stats._bytes -= EntrySize(oldest.first, oldest.second);
+		_entries.erase(oldest.first);
+		_lru.pop_back();
+	}
+
+	_stats._entries = _lru.size();
+	UpdateGauges();
+}
+
+void TitleCache::UpdateGauges()
+{
+	if (!_metrics)
+		return;
+
+	_metrics->_titleCacheEntries.Set(static_cast<std::int64_t>(_stats._entries));
+	_metrics->_titleCacheBytes.Set(static_cast<std::int64_t>(_stats._bytes));
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(TitleCache, ExpiryAndEviction)
+{
+	TitleCache::Options options;
+	options._maxEntries = 2;
+	TitleCache cache(options);
+
+	int fetches = 0;
+	auto fetch = [&](const std::string &url) {
+		fetches++;
+		TitleCache::Entry entry;
+		entry._status = url == "http://broken/" ? 0 : 200;
+		entry._title = "Title of " + url;
+		return entry;
+	};
+
+	EXPECT_EQ("Title of http://a/", cache.Get("http://a/", fetch)._title);
+	EXPECT_EQ("Title of http://a/", cache.Get("http://a/", fetch)._title);
+	EXPECT_EQ(1, fetches);
+
+	// Failures are cached for a shorter time
+	const auto now = std::chrono::system_clock::now();
+	TitleCache::Entry failed;
+	failed._fetched = now - std::chrono::seconds(600);
+	EXPECT_FALSE(cache.IsFresh(failed, now));
+	failed._status = 200;
+	EXPECT_TRUE(cache.IsFresh(failed, now));
+
+	cache.Get("http://broken/", fetch);
+	cache.Get("http://broken/", fetch);
+	EXPECT_EQ(2, fetches);
+
+	// a is the least recently used one now
+	cache.Get("http://b/", fetch);
+	EXPECT_FALSE(cache.Find("http://a/"));
+	EXPECT_TRUE(cache.Find("http://b/"));
+	EXPECT_TRUE(cache.Find("http://broken/"));
+
+	// Stale entries are fetched again, older ones don't replace newer
+	TitleCache::Entry stale;
+	stale._status = 200;
+	stale._title = "Stale";
+	stale._fetched = now - std::chrono::hours(2);
+	cache.Put("http://b/", stale);
+	EXPECT_EQ("Title of http://b/", cache.Find("http://b/")->_title);
+	cache.Put("http://c/", stale);
+	EXPECT_FALSE(cache.Find("http://c/"));
+	EXPECT_EQ("Title of http://c/", cache.Get("http://c/", fetch)._title);
+
+	const auto stats = cache.GetStats();
+	EXPECT_EQ(2u, stats._hits);
+	EXPECT_EQ(4u, stats._misses);
+	EXPECT_EQ(2u, stats._entries);
+	EXPECT_GT(stats._bytes, 0u);
+}
+
+TEST(TitleCache, SingleFlight)
+{
+	Metrics metrics;
+	TitleCache cache(TitleCache::Options(), &metrics);
+
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	std::atomic<int> fetches{0};
+	auto fetch = [&](const std::string &) {
+		fetches++;
+		released.wait();
+		TitleCache::Entry entry;
+		entry._status = 200;
+		entry._title = "Shared";
+		return entry;
+	};
+
+	constexpr int threads = 4;
+	std::vector<std::string> titles(threads);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++)
+		workers.emplace_back([&, i]{ titles[i] = cache.Get("http://slow/", fetch)._title; });
+
+	while (cache.GetStats()._shared < static_cast<std::uint64_t>(threads - 1))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	release.set_value();
+	for (auto &worker : workers)
+		worker.join();
+
+	EXPECT_EQ(1, fetches);
+	for (const auto &title : titles)
+		EXPECT_EQ("Shared", title);
+	EXPECT_EQ(1u, metrics._titleCacheMisses.Get());
+	EXPECT_EQ(static_cast<std::uint64_t>(threads - 1), metrics._titleCacheShared.Get());
+	EXPECT_EQ(1, metrics._titleCacheEntries.Get());
+}
+
+TEST(TitleCache, AsyncLookup)
+{
+	TitleCache cache{TitleCache::Options()};
+
+	TitleCache::Done pendingDone;
+	auto first = cache.Lookup("http://a/", [&](const std::string &, TitleCache::Done done) { pendingDone = done; });
+	auto second = cache.Lookup("http://a/", [](const std::string &, TitleCache::Done) { FAIL() << "Fetched twice"; });
+	EXPECT_EQ(std::future_status::timeout, first.wait_for(std::chrono::seconds(0)));
+
+	TitleCache::Entry entry;
+	entry._status = 200;
+	entry._title = "Later";
+	std::thread([&] { pendingDone(entry); }).join();
+	EXPECT_EQ("Later", first.get()._title);
+	EXPECT_EQ("Later", second.get()._title);
+
+	// Throwing fetch is cached as failure
+	auto failed = cache.Lookup("http://b/", [](const std::string &, TitleCache::Done) { throw std::runtime_error("No network"); });
+	EXPECT_EQ(0, failed.get()._status);
+	EXPECT_TRUE(cache.Find("http://b/"));
+}
+
+#endif // LCOV_EXCL_STOP
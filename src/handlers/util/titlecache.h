@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "metrics.h"
+
+/**
+ * LRU of page titles by URL. Failed fetches are cached too, for a shorter
+ * time. Concurrent lookups of the same URL share one fetch
+ */
+class TitleCache
+{
+public:
+	class Options
+	{
+	public:
+		size_t _maxEntries = 1000;
+		std::chrono::seconds _ttl{3600};
+		std::chrono::seconds _failureTtl{300};
+	};
+
+	class Entry
+	{
+	public:
+		bool IsOk() const { return _status == 200; }
+
+		std::string _title;
+		long _status = 0; // HTTP status, 0 if request failed
+		std::chrono::system_clock::time_point _fetched;
+	};
+
+	class Stats
+	{
+	public:
+		std::uint64_t _hits = 0;
+		std::uint64_t _misses = 0; // fetches made
+		std::uint64_t _shared = 0; // lookups that waited for fetch of another one
+		size_t _entries = 0;
+		size_t _bytes = 0; // estimated memory use
+	};
+
+	typedef std::function<Entry(const std::string &url)> Fetch;
+	typedef std::function<void(Entry entry)> Done;
+	typedef std::function<void(const std::string &url, Done done)> AsyncFetch;
+
+	/**
+	 * @param metrics If set, stats are also recorded there
+	 */
+	explicit TitleCache(const Options &options, Metrics *metrics = nullptr);
+
+	/**
+	 * @brief Cached entry of the URL if it's fresh, otherwise result of fetch
+	 * Fetch is started on calling thread without the lock held and must call done exactly once,
+	 * from any thread. Exceptions thrown by it are cached as failures
+	 */
+	std::shared_future<Entry> Lookup(const std::string &url, const AsyncFetch &fetch);
+	Entry Get(const std::string &url, const Fetch &fetch);
+
+	/**
+	 * @brief Fresh cached entry of the URL, doesn't count as a hit
+	 */
+	std::optional<Entry> Find(const std::string &url) const;
+
+	void Put(const std::string &url, Entry entry);
+	bool IsFresh(const Entry &entry, std::chrono::system_clock::time_point now = std::chrono::system_clock::now()) const;
+
+	Stats GetStats() const;
+
+private:
+	typedef std::list<std::pair<std::string, Entry>> LruList;
+
+	static size_t EntrySize(const std::string &url, const Entry &entry);
+	/**
+	 * @brief Call with _mutex held
+	 */
+	void Insert(const std::string &url, Entry entry);
+	void UpdateGauges();
+
+	const Options _options;
+	Metrics *_metrics;
+
+	mutable std::mutex _mutex;
+	LruList _lru; // most recently used first
+	std::unordered_map<std::string, LruList::iterator> _entries;
+	std::unordered_map<std::string, std::shared_future<Entry>> _inFlight;
+	Stats _stats;
+};
@@ -0,0 +1,580 @@
+#include "urlarchive.h"
+
+#include <glog/logging.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "fulltextindex.h"
+#include "thread_util.h"
+
+// Preset dictionary of zlib streams, archived records are too short to compress well on their own
+static const std::string compressionDictionary =
+		"https://www.reddit.com/r/comments/https://en.wikipedia.org/wiki/https://github.com/"
+		"https://twitter.com/status/https://youtu.be/ - YouTubehttps://www.youtube.com/watch?v=";
+
+// Stable across builds, unlike std::hash
+static std::int64_t hashUrl(const std::string &url)
+{
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : url)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return static_cast<std::int64_t>(hash);
+}
+
+static std::string entryText(const UrlArchive::Entry &entry)
+{
+	return entry._url + " " + entry._title;
+}
+
+UrlArchive::UrlArchive(const std::string &path, const Options &options)
+	: _options(options)
+{
+	if (sqlite3_open(path.c_str(), &_db) != SQLITE_OK)
+	{
+		LOG(ERROR) << "Failed to open " << path << " for URL archive: " << sqlite3_errmsg(_db);
+		sqlite3_close(_db);
+		_db = nullptr;
+		return;
+	}
+
+	sqlite3_busy_timeout(_db, 5000);
+}
+
+UrlArchive::~UrlArchive()
+{
+	{
+		std::lock_guard<std::mutex> lock(_threadMutex);
+		_isRunning = false;
+	}
+	_wakeup.notify_one();
+	if (_thread.joinable())
+		_thread.join();
+
+	if (_db)
+		sqlite3_close(_db);
+}
+
+void UrlArchive::Start()
+{
+	if (!_db || _ready.exchange(true))
+		return;
+
+	if (_options._keepFullDays > 0 || _options._keepArchiveDays > 0)
+	{
+		_isRunning = true;
+		_thread = std::thread(&UrlArchive::RetentionThread, this);
+		nameThread(_thread, "URL retention");
+	}
+}
+
+std::vector<UrlArchive::Entry> UrlArchive::Search(const std::string &request, size_t limit)
+{
+	std::vector<Entry> entries;
+	const auto query = FullTextIndex::MakeQuery(request);
+	if (query.empty() || !_ready)
+		return entries;
+
+	std::lock_guard<std::mutex> lock(_dbMutex);
+	sqlite3_stmt *statement = nullptr;
+	sqlite3_prepare_v2(_db, "SELECT a.id, a.first_seen, a.last_seen, a.times, a.size, a.data FROM url_archive a "
+							"JOIN (SELECT rowid, rank FROM url_archive_fts WHERE url_archive_fts MATCH ? ORDER BY rank LIMIT ?) m "
+							"ON a.id = m.rowid ORDER BY m.rank", -1, &statement, nullptr);
+	sqlite3_bind_text(statement, 1, query.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(statement, 2, static_cast<sqlite3_int64>(limit));
+
+	while (sqlite3_step(statement) == SQLITE_ROW)
+		if (auto entry = ReadEntry(statement))
+			entries.push_back(*entry);
+
+	sqlite3_finalize(statement);
+	return entries;
+}
+
+size_t UrlArchive::ArchiveBatch(std::int64_t cutoff)
+{
+	class LoggedRow
+	{
+	public:
+		std::int64_t _id;
+		std::string _url;
+		std::string _title;
+		std::int64_t _time;
+	};
+
+	std::lock_guard<std::mutex> lock(_dbMutex);
+	if (!_db || !Exec("BEGIN IMMEDIATE"))
+		return 0;
+
+	std::vector<LoggedRow> rows;
+	sqlite3_stmt *select = nullptr;
+	sqlite3_prepare_v2(_db, "SELECT id, URL, title, time FROM url_log WHERE time < ? ORDER BY time LIMIT ?", -1, &select, nullptr);
+	sqlite3_bind_int64(select, 1, cutoff);
+	sqlite3_bind_int64(select, 2, static_cast<sqlite3_int64>(_options._batchSize));
+	while (sqlite3_step(select) == SQLITE_ROW)
+		rows.push_back({sqlite3_column_int64(select, 0),
+						reinterpret_cast<const char *>(sqlite3_column_text(select, 1)),
+						reinterpret_cast<const char *>(sqlite3_column_text(select, 2)),
+						sqlite3_column_int64(select, 3)});
+	sqlite3_finalize(select);
+
+	sqlite3_stmt *remove = nullptr;
+	sqlite3_prepare_v2(_db, "DELETE FROM url_log WHERE id = ?", -1, &remove, nullptr);
+
+	bool success = true;
+	size_t merged = 0;
+	for (const auto &row : rows)
+	{
+		auto previous = FindEntry(row._url);
+		auto entry = previous.value_or(Entry{0, row._url, row._title, row._time, row._time, 0});
+		if (previous)
+		{
+			merged++;
+			if (row._time >= entry._lastSeen && !row._title.empty())
+				entry._title = row._title;
+			entry._firstSeen = std::min(entry._firstSeen, row._time);
+			entry._lastSeen = std::max(entry._lastSeen, row._time);
+		}
+		entry._times++;
+
+		sqlite3_bind_int64(remove, 1, row._id);
+		success = WriteEntry(entry, previous ? &*previous : nullptr) && sqlite3_step(remove) == SQLITE_DONE;
+		sqlite3_reset(remove);
+		if (!success)
+			break;
+	}
+	sqlite3_finalize(remove);
+
+	if (!success || !Exec("COMMIT"))
+	{
+		LOG(ERROR) << "Failed to archive URLs: " << sqlite3_errmsg(_db);
+		Exec("ROLLBACK");
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> statsLock(_statsMutex);
+	_stats._archived += rows.size();
+	_stats._merged += merged;
+	return rows.size();
+}
+
+size_t UrlArchive::ExpireBatch(std::int64_t cutoff)
+{
+	std::lock_guard<std::mutex> lock(_dbMutex);
+	if (!_db || !Exec("BEGIN IMMEDIATE"))
+		return 0;
+
+	std::vector<Entry> entries;
+	std::vector<std::int64_t> broken;
+	sqlite3_stmt *select = nullptr;
+	sqlite3_prepare_v2(_db, "SELECT id, first_seen, last_seen, times, size, data FROM url_archive WHERE last_seen < ? ORDER BY last_seen LIMIT ?", -1, &select, nullptr);
+	sqlite3_bind_int64(select, 1, cutoff);
+	sqlite3_bind_int64(select, 2, static_cast<sqlite3_int64>(_options._batchSize));
+	while (sqlite3_step(select) == SQLITE_ROW)
+	{
+		if (auto entry = ReadEntry(select))
+			entries.push_back(*entry);
+		else
+			broken.push_back(sqlite3_column_int64(select, 0));
+	}
+	sqlite3_finalize(select);
+
+	bool success = true;
+	for (const auto &entry : entries)
+		success = success && DeleteEntry(entry);
+
+	// Can't be removed from index without their text, searches skip them
+	for (auto id : broken)
+		success = success && Exec("DELETE FROM url_archive WHERE id = " + std::to_string(id));
+
+	if (!success || !Exec("COMMIT"))
+	{
+		LOG(ERROR) << "Failed to delete old archived URLs: " << sqlite3_errmsg(_db);
+		Exec("ROLLBACK");
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> statsLock(_statsMutex);
+	_stats._expired += entries.size() + broken.size();
+	return entries.size() + broken.size();
+}
+
+int UrlArchive::Vacuum()
+{
+	const auto queryInt = [this](const std::string &sql) {
+		int value = 0;
+		sqlite3_stmt *statement = nullptr;
+		if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW)
+			value = sqlite3_column_int(statement, 0);
+		sqlite3_finalize(statement);
+		return value;
+	};
+
+	std::lock_guard<std::mutex> lock(_dbMutex);
+	if (!_db || _options._vacuumPages <= 0)
+		return 0;
+
+	constexpr int incremental = 2;
+	if (queryInt("PRAGMA auto_vacuum") != incremental)
+	{
+		if (!_options._switchAutoVacuum)
+		{
+			if (!_vacuumSkipLogged)
+				LOG(INFO) << "Storage is not in incremental vacuum mode, free pages are kept. Set URL.SwitchAutoVacuum to switch it";
+			_vacuumSkipLogged = true;
+			return 0;
+		}
+
+		LOG(WARNING) << "Switching storage to incremental vacuum, this rewrites the whole database once. Writes stall until it's done";
+		if (!Exec("PRAGMA auto_vacuum = INCREMENTAL") || !Exec("VACUUM"))
+			return 0;
+	}
+
+	const auto freeBefore = queryInt("PRAGMA freelist_count");
+	if (freeBefore == 0 || !Exec("PRAGMA incremental_vacuum(" + std::to_string(_options._vacuumPages) + ")"))
+		return 0;
+
+	const auto freed = freeBefore - queryInt("PRAGMA freelist_count");
+	std::lock_guard<std::mutex> statsLock(_statsMutex);
+	_stats._vacuumedPages += freed;
+	return freed;
+}
+
+UrlArchive::Stats UrlArchive::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(_statsMutex);
+	return _stats;
+}
+
+std::string UrlArchive::CreateSql()
+{
+	return "CREATE INDEX IF NOT EXISTS url_log_time ON url_log(time);"
+		   "CREATE TABLE IF NOT EXISTS url_archive ("
+				"id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, "
+				"url_hash INTEGER NOT NULL, "
+				"first_seen INTEGER NOT NULL, "
+				"last_seen INTEGER NOT NULL, "
+				"times INTEGER NOT NULL, "
+				"size INTEGER NOT NULL, " // of uncompressed data
+				"data BLOB NOT NULL);" // zlib compressed "URL\ntitle"
+		   "CREATE INDEX IF NOT EXISTS url_archive_hash ON url_archive(url_hash);"
+		   "CREATE INDEX IF NOT EXISTS url_archive_last_seen ON url_archive(last_seen);"
+		   "CREATE VIRTUAL TABLE IF NOT EXISTS url_archive_fts USING fts5(text, content='');";
+}
+
+std::string UrlArchive::Compress(const std::string &data)
+{
+	z_stream stream = {};
+	if (deflateInit(&stream, Z_BEST_COMPRESSION) != Z_OK)
+		return "";
+
+	deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(compressionDictionary.data()), static_cast<uInt>(compressionDictionary.size()));
+
+	std::string compressed(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+	stream.avail_in = static_cast<uInt>(data.size());
+	stream.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+	stream.avail_out = static_cast<uInt>(compressed.size());
+
+	const auto result = deflate(&stream, Z_FINISH);
+	compressed.resize(stream.total_out);
+	deflateEnd(&stream);
+	return result == Z_STREAM_END ? compressed : "";
+}
+
+std::optional<std::string> UrlArchive::Decompress(const void *data, size_t size, size_t originalSize)
+{
+	z_stream stream = {};
+	if (inflateInit(&stream) != Z_OK)
+		return {};
+
+	std::string decompressed(originalSize, '\0');
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<void *>(data));
+	stream.avail_in = static_cast<uInt>(size);
+	stream.next_out = reinterpret_cast<Bytef *>(&decompressed[0]);
+	stream.avail_out = static_cast<uInt>(decompressed.size());
+
+	auto result = inflate(&stream, Z_FINISH);
+	if (result == Z_NEED_DICT)
+	{
+		inflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(compressionDictionary.data()), static_cast<uInt>(compressionDictionary.size()));
+		result = inflate(&stream, Z_FINISH);
+	}
+
+	const auto total = stream.total_out;
+	inflateEnd(&stream);
+	if (result != Z_STREAM_END || total != originalSize)
+		return {};
+
+	return decompressed;
+}
+
+void UrlArchive::RetentionThread()
+{
+	std::unique_lock<std::mutex> lock(_threadMutex);
+	while (_isRunning)
+	{
+		lock.unlock();
+		RunRetention();
+		lock.lock();
+
+		_wakeup.wait_for(lock, _options._interval, [this] { return !_isRunning; });
+	}
+}
+
+void UrlArchive::RunRetention()
+{
+	const auto isRunning = [this] {
+		std::lock_guard<std::mutex> lock(_threadMutex);
+		return _isRunning;
+	};
+
+	const auto before = GetStats();
+	const std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	constexpr std::int64_t day = 24 * 60 * 60;
+
+	if (_options._keepFullDays > 0)
+		while (isRunning() && ArchiveBatch(now - _options._keepFullDays * day) == _options._batchSize)
+			std::this_thread::sleep_for(_options._pause);
+
+	if (_options._keepArchiveDays > 0)
+		while (isRunning() && ExpireBatch(now - _options._keepArchiveDays * day) == _options._batchSize)
+			std::this_thread::sleep_for(_options._pause);
+
+	if (isRunning())
+		Vacuum();
+
+	const auto after = GetStats();
+	if (after._archived != before._archived || after._expired != before._expired || after._vacuumedPages != before._vacuumedPages)
+		LOG(INFO) << "URL retention: archived " << after._archived - before._archived
+				  << " (" << after._merged - before._merged << " already known)"
+				  << ", expired " << after._expired - before._expired
+				  << ", vacuumed " << after._vacuumedPages - before._vacuumedPages << " pages";
+}
+
+bool UrlArchive::Exec(const std::string &sql)
+{
+	char *error = nullptr;
+	if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+	{
+		LOG(ERROR) << "URL archive statement failed: " << (error ? error : "unknown error");
+		sqlite3_free(error);
+		return false;
+	}
+	return true;
+}
+
+std::optional<UrlArchive::Entry> UrlArchive::ReadEntry(sqlite3_stmt *statement)
+{
+	const auto data = Decompress(sqlite3_column_blob(statement, 5),
+								 static_cast<size_t>(sqlite3_column_bytes(statement, 5)),
+								 static_cast<size_t>(sqlite3_column_int64(statement, 4)));
+	if (!data)
+	{
+		LOG(ERROR) << "Archived URL " << sqlite3_column_int64(statement, 0) << " is corrupted";
+		return {};
+	}
+
+	const auto separator = data->find('\n');
+	Entry entry;
+	entry._id = sqlite3_column_int64(statement, 0);
+	entry._url = data->substr(0, separator);
+	entry._title = separator == data->npos ? "" : data->substr(separator + 1);
+	entry._firstSeen = sqlite3_column_int64(statement, 1);
+	entry._lastSeen = sqlite3_column_int64(statement, 2);
+	entry._times = sqlite3_column_int(statement, 3);
+	return entry;
+}
+
+std::optional<UrlArchive::Entry> UrlArchive::FindEntry(const std::string &url)
+{
+	std::optional<Entry> found;
+	sqlite3_stmt *statement = nullptr;
+	sqlite3_prepare_v2(_db, "SELECT id, first_seen, last_seen, times, size, data FROM url_archive WHERE url_hash = ?", -1, &statement, nullptr);
+	sqlite3_bind_int64(statement, 1, hashUrl(url));
+	while (!found && sqlite3_step(statement) == SQLITE_ROW)
+	{
+		auto entry = ReadEntry(statement);
+		if (entry && entry->_url == url)
+			found = entry;
+	}
+	sqlite3_finalize(statement);
+	return found;
+}
+
+bool UrlArchive::WriteEntry(const Entry &entry, const Entry *previous)
+{
+	const auto data = entry._url + "\n" + entry._title;
+	const auto compressed = Compress(data);
+	if (compressed.empty())
+		return false;
+
+	sqlite3_stmt *statement = nullptr;
+	sqlite3_prepare_v2(_db, previous
+					   ? "UPDATE url_archive SET url_hash = ?, first_seen = ?, last_seen = ?, times = ?, size = ?, data = ? WHERE id = ?"
+					   : "INSERT INTO url_archive (url_hash, first_seen, last_seen, times, size, data) VALUES (?, ?, ?, ?, ?, ?)",
+					   -1, &statement, nullptr);
+	sqlite3_bind_int64(statement, 1, hashUrl(entry._url));
+	sqlite3_bind_int64(statement, 2, entry._firstSeen);
+	sqlite3_bind_int64(statement, 3, entry._lastSeen);
+	sqlite3_bind_int(statement, 4, entry._times);
+	sqlite3_bind_int64(statement, 5, static_cast<sqlite3_int64>(data.size()));
+	sqlite3_bind_blob(statement, 6, compressed.data(), static_cast<int>(compressed.size()), SQLITE_TRANSIENT);
+	if (previous)
+		sqlite3_bind_int64(statement, 7, previous->_id);
+	const bool written = sqlite3_step(statement) == SQLITE_DONE;
+	sqlite3_finalize(statement);
+	if (!written)
+		return false;
+
+	const auto id = previous ? previous->_id : sqlite3_last_insert_rowid(_db);
+	if (previous && entryText(*previous) == entryText(entry))
+		return true;
+
+	bool indexed = true;
+	if (previous)
+	{
+		sqlite3_prepare_v2(_db, "INSERT INTO url_archive_fts (url_archive_fts, rowid, text) VALUES ('delete', ?, ?)", -1, &statement, nullptr);
+		sqlite3_bind_int64(statement, 1, id);
+		sqlite3_bind_text(statement, 2, entryText(*previous).c_str(), -1, SQLITE_TRANSIENT);
+		indexed = sqlite3_step(statement) == SQLITE_DONE;
+		sqlite3_finalize(statement);
+	}
+
+	sqlite3_prepare_v2(_db, "INSERT INTO url_archive_fts (rowid, text) VALUES (?, ?)", -1, &statement, nullptr);
+	sqlite3_bind_int64(statement, 1, id);
+	sqlite3_bind_text(statement, 2, entryText(entry).c_str(), -1, SQLITE_TRANSIENT);
+	indexed = indexed && sqlite3_step(statement) == SQLITE_DONE;
+	sqlite3_finalize(statement);
+	return indexed;
+}
+
+bool UrlArchive::DeleteEntry(const Entry &entry)
+{
+	sqlite3_stmt *statement = nullptr;
+	sqlite3_prepare_v2(_db, "INSERT INTO url_archive_fts (url_archive_fts, rowid, text) VALUES ('delete', ?, ?)", -1, &statement, nullptr);
+	sqlite3_bind_int64(statement, 1, entry._id);
+	sqlite3_bind_text(statement, 2, entryText(entry).c_str(), -1, SQLITE_TRANSIENT);
+	bool deleted = sqlite3_step(statement) == SQLITE_DONE;
+	sqlite3_finalize(statement);
+
+	return deleted && Exec("DELETE FROM url_archive WHERE id = " + std::to_string(entry._id));
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "migrations.h"
+
+TEST(UrlArchive, Compress)
+{
+	for (const std::string data : {"\n", "https://www.youtube.com/watch?v=dQw4w9WgXcQ\nRick Astley - Never Gonna Give You Up - YouTube"})
+	{
+		const auto compressed = UrlArchive::Compress(data);
+		ASSERT_FALSE(compressed.empty());
+		EXPECT_EQ(data, UrlArchive::Decompress(compressed.data(), compressed.size(), data.size()));
+		EXPECT_FALSE(UrlArchive::Decompress(compressed.data(), compressed.size() / 2, data.size()));
+	}
+
+	const std::string url = "https://www.youtube.com/watch?v=dQw4w9WgXcQ\n";
+	EXPECT_LT(UrlArchive::Compress(url).size(), url.size());
+}
+
+TEST(UrlArchive, Retention)
+{
+	const std::string path = "urlarchive_test.db";
+	std::remove(path.c_str());
+
+	{
+		SchemaMigrations migrations(path, SchemaMigrations::Options());
+		ASSERT_TRUE(migrations.Run({{1, "Tables", "CREATE TABLE url_log (id INTEGER PRIMARY KEY AUTOINCREMENT, URL TEXT, title TEXT, time INTEGER, fulltext TEXT);", {}},
+									{2, "Archive", UrlArchive::CreateSql(), {}}}));
+	}
+
+	sqlite3 *db = nullptr;
+	sqlite3_open(path.c_str(), &db);
+	const auto exec = [db](const std::string &sql) {
+		ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+	};
+	const auto count = [db](const std::string &table) {
+		sqlite3_stmt *statement = nullptr;
+		sqlite3_prepare_v2(db, ("SELECT count(*) FROM " + table).c_str(), -1, &statement, nullptr);
+		sqlite3_step(statement);
+		const auto result = sqlite3_column_int(statement, 0);
+		sqlite3_finalize(statement);
+		return result;
+	};
+
+	exec("INSERT INTO url_log (URL, title, time, fulltext) VALUES "
+		 "('http://a.com/', 'Old title', 100, ''), "
+		 "('http://b.com/', 'Lemon grab', 110, ''), "
+		 "('http://a.com/', 'New title', 120, ''), "
+		 "('http://a.com/', '', 130, ''), "
+		 "('http://c.com/', 'Recent', 1000, '');");
+
+	UrlArchive::Options options;
+	options._batchSize = 2;
+	UrlArchive archive(path, options);
+	EXPECT_TRUE(archive.Search("title", 10).empty()); // not started
+	archive.Start();
+
+	EXPECT_EQ(2, archive.ArchiveBatch(500));
+	EXPECT_EQ(2, archive.ArchiveBatch(500));
+	EXPECT_EQ(0, archive.ArchiveBatch(500));
+	EXPECT_EQ(1, count("url_log"));
+	EXPECT_EQ(2, count("url_archive"));
+
+	const auto stats = archive.GetStats();
+	EXPECT_EQ(4, stats._archived);
+	EXPECT_EQ(2, stats._merged);
+
+	auto found = archive.Search("title", 10);
+	ASSERT_EQ(1, found.size());
+	EXPECT_EQ("http://a.com/", found[0]._url);
+	EXPECT_EQ("New title", found[0]._title); // latest non-empty one
+	EXPECT_EQ(100, found[0]._firstSeen);
+	EXPECT_EQ(130, found[0]._lastSeen);
+	EXPECT_EQ(3, found[0]._times);
+	EXPECT_TRUE(archive.Search("old", 10).empty());
+	EXPECT_EQ(1, archive.Search("lem", 10).size());
+	EXPECT_EQ(2, archive.Search("http", 10).size());
+
+	EXPECT_EQ(1, archive.ExpireBatch(125));
+	EXPECT_EQ(0, archive.ExpireBatch(125));
+	EXPECT_TRUE(archive.Search("lemon", 10).empty());
+	EXPECT_EQ(1, archive.Search("http", 10).size());
+	exec("INSERT INTO url_archive_fts(url_archive_fts) VALUES ('integrity-check');");
+
+	const auto autoVacuum = [](sqlite3 *connection) {
+		sqlite3_stmt *statement = nullptr;
+		sqlite3_prepare_v2(connection, "PRAGMA auto_vacuum", -1, &statement, nullptr);
+		sqlite3_step(statement);
+		const auto result = sqlite3_column_int(statement, 0);
+		sqlite3_finalize(statement);
+		return result;
+	};
+
+	// Full VACUUM is only done when allowed
+	EXPECT_EQ(0, archive.Vacuum());
+	EXPECT_EQ(0, autoVacuum(db));
+	sqlite3_close(db);
+
+	options._switchAutoVacuum = true;
+	UrlArchive switching(path, options);
+	switching.Start();
+	switching.Vacuum();
+
+	// Connections opened before keep the old mode
+	sqlite3_open(path.c_str(), &db);
+	EXPECT_EQ(2, autoVacuum(db));
+	sqlite3_close(db);
+	std::remove(path.c_str());
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+
+/**
+ * Retention of url_log. Rows older than the configured age are moved to
+ * url_archive: one row per URL with the latest title, first and last time it
+ * was posted, and the number of posts, compressed with zlib. The archive is
+ * searchable through its own contentless FTS5 index
+ *
+ * Archived URLs not posted for a long time may be deleted too. Freed pages
+ * are given back with incremental vacuum
+ *
+ * Runs on its own thread and connection, in small transactions
+ */
+class UrlArchive
+{
+public:
+	class Options
+	{
+	public:
+		int _keepFullDays = 0; // url_log rows older than this are archived, 0 keeps them forever
+		int _keepArchiveDays = 0; // archived URLs not posted for this long are deleted, 0 keeps them forever
+		size_t _batchSize = 500; // rows per transaction
+		std::chrono::milliseconds _pause{50}; // between transactions
+		std::chrono::seconds _interval{600};
+		int _vacuumPages = 1000; // at most per run, 0 disables vacuum
+		bool _switchAutoVacuum = false; // allow one full VACUUM to enable incremental vacuum, all writes wait for it
+	};
+
+	class Entry
+	{
+	public:
+		std::int64_t _id = 0;
+		std::string _url;
+		std::string _title;
+		std::int64_t _firstSeen = 0;
+		std::int64_t _lastSeen = 0;
+		int _times = 0;
+	};
+
+	class Stats
+	{
+	public:
+		std::uint64_t _archived = 0; // url_log rows moved to archive
+		std::uint64_t _merged = 0; // ... of them merged into already archived URLs
+		std::uint64_t _expired = 0; // archived URLs deleted
+		std::uint64_t _vacuumedPages = 0;
+	};
+
+	UrlArchive(const std::string &path, const Options &options);
+	~UrlArchive();
+
+	/**
+	 * @brief Use the archive, it's created by schema migrations. Starts retention thread if it's enabled
+	 */
+	void Start();
+	bool IsReady() const { return _ready; }
+
+	/**
+	 * @brief Archived URLs matching all words of request (as prefixes), best matches first
+	 */
+	std::vector<Entry> Search(const std::string &request, size_t limit);
+
+	/**
+	 * @brief Move next batch of url_log rows posted before cutoff to archive
+	 * @return Number of moved rows
+	 */
+	size_t ArchiveBatch(std::int64_t cutoff);
+
+	/**
+	 * @brief Delete next batch of archived URLs last posted before cutoff
+	 * @return Number of deleted URLs
+	 */
+	size_t ExpireBatch(std::int64_t cutoff);
+
+	/**
+	 * @brief Give back up to _vacuumPages free pages
+	 * Only works in incremental auto vacuum mode. Database is switched to it with one full VACUUM
+	 * if _switchAutoVacuum is set, otherwise nothing is done
+	 * @return Number of freed pages
+	 */
+	int Vacuum();
+
+	Stats GetStats() const;
+
+	/**
+	 * @brief Statements creating archive tables and url_log index used by retention
+	 */
+	static std::string CreateSql();
+
+	static std::string Compress(const std::string &data);
+	static std::optional<std::string> Decompress(const void *data, size_t size, size_t originalSize);
+
+private:
+	void RetentionThread();
+	void RunRetention();
+
+	bool Exec(const std::string &sql);
+	std::optional<Entry> ReadEntry(sqlite3_stmt *statement);
+	/**
+	 * @brief Archived entry of the URL, call with _dbMutex held
+	 */
+	std::optional<Entry> FindEntry(const std::string &url);
+	bool WriteEntry(const Entry &entry, const Entry *previous);
+	bool DeleteEntry(const Entry &entry);
+
+	sqlite3 *_db = nullptr;
+	std::mutex _dbMutex;
+	const Options _options;
+	std::atomic<bool> _ready{false};
+	bool _vacuumSkipLogged = false;
+
+	mutable std::mutex _statsMutex;
+	Stats _stats;
+
+	std::mutex _threadMutex;
+	std::condition_variable _wakeup;
+	bool _isRunning = false;
+	std::thread _thread;
+};
@@ -0,0 +1,170 @@
+#include "urlruleset.h"
+
+#include <glog/logging.h>
+
+#include "stringops.h"
+
+namespace {
+
+// \1..\9 outside of character classes, numbers are relative to the rule's own groups
+bool hasBackreference(const std::string &pattern)
+{
+	bool inClass = false;
+	for (size_t i = 0; i < pattern.size(); i++)
+	{
+		if (pattern[i] == '\\')
+		{
+			if (++i < pattern.size() && !inClass && pattern[i] >= '1' && pattern[i] <= '9')
+				return true;
+		} else if (pattern[i] == '[') {
+			inClass = true;
+		} else if (pattern[i] == ']') {
+			inClass = false;
+		}
+	}
+
+	return false;
+}
+
+}
+
+UrlRuleSet::UrlRuleSet(const std::vector<Rule> &rules)
+{
+	std::vector<const Rule *> blacklist;
+	std::vector<const Rule *> whitelist;
+	for (const auto &rule : rules)
+	{
+		if (!IsValid(rule._pattern))
+		{
+			LOG(WARNING) << "Skipping invalid URL rule " << rule._id << ": " << rule._pattern;
+			continue;
+		}
+
+		(rule._blacklist ? blacklist : whitelist).push_back(&rule);
+	}
+
+	_blacklist.Compile(blacklist);
+	_whitelist.Compile(whitelist);
+}
+
+bool UrlRuleSet::ShouldPrint(const std::string &url)
+{
+	auto memoized = _memoized.find(url);
+	if (memoized != _memoized.end())
+		return memoized->second;
+
+	bool result = true;
+	if (auto rule = Match(url, true))
+	{
+		LOG(INFO) << "URL is found in blacklist rule " << *rule;
+		if (auto exception = Match(url, false))
+			LOG(INFO) << "URL is found in whitelist rule " << *exception;
+		else
+			result = false;
+	}
+
+	if (_memoized.size() >= MaxMemoizedUrls)
+		_memoized.clear();
+	_memoized.emplace(url, result);
+	return result;
+}
+
+std::optional<int> UrlRuleSet::Match(const std::string &url, bool blacklist) const
+{
+	return (blacklist ? _blacklist : _whitelist).Find(url);
+}
+
+bool UrlRuleSet::IsValid(const std::string &pattern)
+{
+	try {
+		std::regex(toLower(pattern));
+		return true;
+	} catch (std::regex_error &) {
+		return false;
+	}
+}
+
+void UrlRuleSet::Matcher::Compile(const std::vector<const Rule *> &rules)
+{
+	if (rules.empty())
+		return;
+
+	std::string combined;
+	size_t group = 1;
+	for (const auto rule : rules)
+	{
+		const auto pattern = toLower(rule->_pattern);
+		if (hasBackreference(pattern))
+		{
+			_separate.emplace_back(std::regex(pattern, std::regex::ECMAScript | std::regex::optimize), rule->_id);
+			continue;
+		}
+
+		if (!combined.empty())
+			combined += "|";
+		combined += "(" + pattern + ")";
+
+		_groups.emplace_back(group, rule->_id);
+		group += 1 + std::regex(pattern).mark_count();
+	}
+
+	if (!combined.empty())
+		_regex = std::regex(combined, std::regex::ECMAScript | std::regex::optimize);
+}
+
+std::optional<int> UrlRuleSet::Matcher::Find(const std::string &url) const
+{
+	std::smatch match;
+	if (_regex && std::regex_search(url, match, *_regex))
+	{
+		for (const auto &group : _groups)
+			if (match[group.first].matched)
+				return group.second;
+	}
+
+	for (const auto &rule : _separate)
+		if (std::regex_search(url, rule.first))
+			return rule.second;
+
+	return {};
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+TEST(UrlRuleSet, Match)
+{
+	UrlRuleSet rules({
+		{1, "youtube\\.com", true},
+		{2, "(www\\.)?YOUTUBE\\.com/(watch|embed)", false},
+		{3, "(", true},
+		{4, "(imgur|gfycat)\\.com", true},
+		{5, "\\.gif$", true},
+		{6, "//(\\w+)\\.example\\.com/\\1/", true},
+	});
+
+	EXPECT_EQ(1, rules.Match("https://youtube.com/channel/x", true));
+	EXPECT_TRUE(rules.ShouldPrint("https://youtube.com/watch?v=x"));
+	EXPECT_FALSE(rules.ShouldPrint("https://youtube.com/channel/x"));
+
+	// Groups inside rules don't shift ids of the next ones
+	EXPECT_EQ(2, rules.Match("https://www.youtube.com/embed/x", false));
+	EXPECT_EQ(4, rules.Match("https://gfycat.com/x", true));
+	EXPECT_EQ(5, rules.Match("https://example.com/cat.gif", true));
+	EXPECT_FALSE(rules.Match("https://example.com/gif", true));
+	EXPECT_TRUE(rules.ShouldPrint("https://example.com/"));
+
+	// Backreferences keep their own group numbers
+	EXPECT_EQ(6, rules.Match("https://foo.example.com/foo/page", true));
+	EXPECT_FALSE(rules.Match("https://foo.example.com/bar/page", true));
+
+	EXPECT_FALSE(UrlRuleSet::IsValid("("));
+	EXPECT_TRUE(UrlRuleSet::IsValid("example\\.(com|org)"));
+
+	UrlRuleSet empty({});
+	EXPECT_TRUE(empty.ShouldPrint("https://youtube.com/"));
+	EXPECT_FALSE(empty.Match("https://youtube.com/", true));
+}
+
+#endif // LCOV_EXCL_STOP
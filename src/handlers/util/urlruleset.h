@@ -0,0 +1,66 @@
+#pragma once
+
+#include <optional>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * URL rules compiled once: blacklist and whitelist rules are each joined
+ * into one regex of alternatives, so a URL is matched against all rules in
+ * two searches. Capture groups of alternatives map a match back to its rule.
+ * Rules with backreferences are searched on their own, joining would renumber
+ * their groups
+ *
+ * Not synchronized, build a new set when rules change
+ */
+class UrlRuleSet
+{
+public:
+	class Rule
+	{
+	public:
+		int _id = -1;
+		std::string _pattern; // case insensitive
+		bool _blacklist = true;
+	};
+
+	explicit UrlRuleSet(const std::vector<Rule> &rules);
+
+	/**
+	 * @brief Title is printed unless URL matches a blacklist rule and no whitelist one
+	 * Results are memoized per URL
+	 */
+	bool ShouldPrint(const std::string &url);
+
+	/**
+	 * @brief Id of a matching rule of the list
+	 */
+	std::optional<int> Match(const std::string &url, bool blacklist) const;
+
+	/**
+	 * @brief Invalid patterns are skipped by the set, check them before storing
+	 */
+	static bool IsValid(const std::string &pattern);
+
+	static constexpr size_t MaxMemoizedUrls = 1024;
+
+private:
+	class Matcher
+	{
+	public:
+		void Compile(const std::vector<const Rule *> &rules);
+		std::optional<int> Find(const std::string &url) const;
+
+	private:
+		std::optional<std::regex> _regex;
+		std::vector<std::pair<size_t, int>> _groups; // capture group of each alternative, rule id
+		std::vector<std::pair<std::regex, int>> _separate; // rules with backreferences, rule id
+	};
+
+	Matcher _blacklist;
+	Matcher _whitelist;
+	std::unordered_map<std::string, bool> _memoized;
+};
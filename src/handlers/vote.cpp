@@ -5,34 +5,34 @@
 Voting::Voting(LemonBot *bot)
 	: LemonHandler("voting", bot)
 {
-
+	RegisterCommands({"!polls", "!addpoll", "!pollinfo", "!vote", "!unvote", "!closepoll", "!invite"});
 }
 
 LemonHandler::ProcessingResult Voting::HandleMessage(const ChatMessage &msg)
 {
 	std::string args;
-	auto &body = msg._body;
+	auto &body = msg.Body();
 	if (body == "!polls")
 	{
 		ListPolls();
 		return ProcessingResult::StopProcessing;
 	} else if (getCommandArguments(body, "!addpoll", args)) {
-		AddPoll(args, msg._jid);
+		AddPoll(args, msg.Jid());
 		return ProcessingResult::StopProcessing;
 	} else if (getCommandArguments(body, "!pollinfo", args)) {
 		PrintPoll(args);
 		return ProcessingResult::StopProcessing;
 	} else if (getCommandArguments(body, "!vote", args)) {
-		Vote(args, msg._jid);
+		Vote(args, msg.Jid());
 		return ProcessingResult::StopProcessing;
 	} else if (getCommandArguments(body, "!unvote", args)) {
-		Unvote(args, msg._jid);
+		Unvote(args, msg.Jid());
 		return ProcessingResult::StopProcessing;
 	} else if (getCommandArguments(body, "!closepoll", args)) {
-		ClosePoll(args, msg._jid);
+		ClosePoll(args, msg.Jid());
 		return ProcessingResult::StopProcessing;
 	} else if (getCommandArguments(body, "!invite", args)) {
-		Invite(args, msg._jid);
+		Invite(args, msg.Jid());
 		return ProcessingResult::StopProcessing;
 	}
 
@@ -1,7 +1,6 @@
 #include "warframe.h"
 
 #include <string>
-#include <cpr/cpr.h>
 #include <glog/logging.h>
 #include <pugixml.hpp>
 #include "util/stringops.h"
@@ -25,7 +24,12 @@ void UpdateThread(std::future<void> &&stop, Warframe *parent, int updateSeconds)
 Warframe::Warframe(LemonBot *bot)
 	: LemonHandler("warframe", bot)
 {
+	RegisterCommands({"!wf"});
 	_updateSecondsMax = from_string<int>(GetRawConfigValue("Warframe.UpdateSeconds")).value_or(300);
+
+	HttpClient::Limits limits;
+	limits._timeout = std::chrono::milliseconds(2000);
+	SetHttpLimits(limits);
 }
 
 bool Warframe::Init()
@@ -51,7 +55,7 @@ Warframe::~Warframe()
 
 LemonHandler::ProcessingResult Warframe::HandleMessage(const ChatMessage &msg)
 {
-	if (msg._body == "!wf") {
+	if (msg.Body() == "!wf") {
 		Update();
 		return ProcessingResult::StopProcessing;
 	}
@@ -77,18 +81,18 @@ bool Warframe::isOfIntereest(const std::string &description)
 
 void Warframe::Update()
 {
-	auto feedContent = cpr::Get(cpr::Url(rssUrl), cpr::Timeout(2000));
+	auto feedContent = httpRequest({"GET", rssUrl}).get();
 
-	if (feedContent.status_code != 200)
+	if (feedContent._status != 200)
 	{
-		LOG(WARNING) << "Status code is not 200 OK: " + std::to_string(feedContent.status_code) + " | " + feedContent.error.message;
+		LOG(WARNING) << "Status code is not 200 OK: " + std::to_string(feedContent._status) + " | " + feedContent._error;
 		return;
 	}
 
 	pugi::xml_document doc;
-	auto parsingResult = doc.load_string(feedContent.text.c_str());
+	auto parsingResult = doc.load_string(feedContent._body.c_str());
 	if (!parsingResult) {
-		LOG(WARNING) << "Invalid XML: " << std::endl << feedContent.text;
+		LOG(WARNING) << "Invalid XML: " << std::endl << feedContent._body;
 		return;
 	}
 
@@ -0,0 +1,199 @@
+#include "identityregistry.h"
+
+UserID IdentityRegistry::Snapshot::GetUserID(const std::string &jid) const
+{
+	auto user = _byJid.find(jid);
+	return user != _byJid.end() ? user->second : UnknownUser;
+}
+
+UserID IdentityRegistry::Snapshot::GetUserIDByNick(const std::string &nick) const
+{
+	auto user = _byNick.find(nick);
+	return user != _byNick.end() ? user->second._id : UnknownUser;
+}
+
+const IdentityRegistry::User *IdentityRegistry::Snapshot::GetUser(UserID id) const
+{
+	if (id == UnknownUser || id > _users.size())
+		return nullptr;
+
+	return &_users[id - 1];
+}
+
+IdentityRegistry::IdentityRegistry()
+	: _snapshot(std::make_shared<const Snapshot>())
+{
+
+}
+
+bool IdentityRegistry::OnJoin(const std::string &nick, const std::string &jid)
+{
+	std::lock_guard<std::mutex> lock(_writeMutex);
+	auto snapshot = std::make_shared<Snapshot>(*GetSnapshot());
+
+	const auto id = GetOrAddUser(*snapshot, jid);
+	auto interned = internString(nick);
+	snapshot->_users[id - 1]._nick = interned;
+
+	const bool isNew = snapshot->_byNick.emplace(*interned, Snapshot::NickEntry{interned, id}).second;
+	Publish(snapshot);
+	return isNew;
+}
+
+void IdentityRegistry::OnLeave(const std::string &nick, const std::string &jid, const std::string &newNick)
+{
+	std::lock_guard<std::mutex> lock(_writeMutex);
+	auto snapshot = std::make_shared<Snapshot>(*GetSnapshot());
+
+	snapshot->_byNick.erase(nick);
+
+	const auto id = GetOrAddUser(*snapshot, jid);
+	auto interned = internString(newNick);
+	snapshot->_users[id - 1]._nick = interned;
+	if (!newNick.empty())
+	{
+		snapshot->_byNick.erase(newNick);
+		snapshot->_byNick.emplace(*interned, Snapshot::NickEntry{interned, id});
+	}
+
+	Publish(snapshot);
+}
+
+std::shared_ptr<const IdentityRegistry::Snapshot> IdentityRegistry::GetSnapshot() const
+{
+	return std::atomic_load(&_snapshot);
+}
+
+UserID IdentityRegistry::GetUserID(const std::string &jid) const
+{
+	return GetSnapshot()->GetUserID(jid);
+}
+
+std::string IdentityRegistry::GetNickByJid(const std::string &jid) const
+{
+	auto snapshot = GetSnapshot();
+	auto user = snapshot->GetUser(snapshot->GetUserID(jid));
+	return user ? *user->_nick : "";
+}
+
+std::string IdentityRegistry::GetJidByNick(const std::string &nick) const
+{
+	return *GetInternedJidByNick(nick);
+}
+
+InternedString IdentityRegistry::GetInternedJidByNick(const std::string &nick) const
+{
+	auto snapshot = GetSnapshot();
+	auto user = snapshot->GetUser(snapshot->GetUserIDByNick(nick));
+	return user ? user->_jid : internString("");
+}
+
+std::vector<std::pair<std::string, std::string>> IdentityRegistry::GetOnlineUsers() const
+{
+	std::vector<std::pair<std::string, std::string>> result;
+
+	auto snapshot = GetSnapshot();
+	for (const auto &user : snapshot->_users)
+		if (!user._nick->empty())
+			result.emplace_back(*user._nick, *user._jid);
+
+	return result;
+}
+
+// Must be called with _writeMutex held, on a snapshot that is not published yet
+UserID IdentityRegistry::GetOrAddUser(Snapshot &snapshot, const std::string &jid)
+{
+	if (auto id = snapshot.GetUserID(jid))
+		return id;
+
+	snapshot._users.push_back({internString(jid), internString("")});
+	const auto id = static_cast<UserID>(snapshot._users.size());
+
+	// Vector growth doesn't move the strings themselves, keys stay valid
+	snapshot._byJid.emplace(*snapshot._users.back()._jid, id);
+	return id;
+}
+
+void IdentityRegistry::Publish(std::shared_ptr<const Snapshot> snapshot)
+{
+	std::atomic_store(&_snapshot, std::move(snapshot));
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+TEST(IdentityRegistry, JoinLeaveRename)
+{
+	IdentityRegistry registry;
+
+	EXPECT_TRUE(registry.OnJoin("alice", "alice@example.com"));
+	EXPECT_FALSE(registry.OnJoin("alice", "alice@example.com"));
+	EXPECT_TRUE(registry.OnJoin("bob", "bob@example.com"));
+
+	const auto alice = registry.GetUserID("alice@example.com");
+	const auto bob = registry.GetUserID("bob@example.com");
+	EXPECT_NE(UnknownUser, alice);
+	EXPECT_NE(alice, bob);
+	EXPECT_EQ(UnknownUser, registry.GetUserID("nobody@example.com"));
+
+	EXPECT_EQ("alice@example.com", registry.GetJidByNick("alice"));
+	EXPECT_EQ("bob", registry.GetNickByJid("bob@example.com"));
+
+	// Rename
+	registry.OnLeave("bob", "bob@example.com", "robert");
+	EXPECT_EQ("", registry.GetJidByNick("bob"));
+	EXPECT_EQ("bob@example.com", registry.GetJidByNick("robert"));
+	EXPECT_EQ("robert", registry.GetNickByJid("bob@example.com"));
+	EXPECT_EQ(bob, registry.GetUserID("bob@example.com"));
+
+	// Leave, id is kept for the next join
+	registry.OnLeave("alice", "alice@example.com", "");
+	EXPECT_EQ("", registry.GetJidByNick("alice"));
+	EXPECT_EQ("", registry.GetNickByJid("alice@example.com"));
+	EXPECT_EQ(alice, registry.GetUserID("alice@example.com"));
+
+	auto online = registry.GetOnlineUsers();
+	ASSERT_EQ(1, online.size());
+	EXPECT_EQ("robert", online[0].first);
+	EXPECT_EQ("bob@example.com", online[0].second);
+
+	EXPECT_TRUE(registry.OnJoin("alice", "alice@example.com"));
+	EXPECT_EQ(alice, registry.GetUserID("alice@example.com"));
+}
+
+TEST(IdentityRegistry, ConcurrentReaders)
+{
+	IdentityRegistry registry;
+	std::atomic<bool> done{false};
+
+	std::thread writer([&]{
+		for (int i = 0; i < 2000; i++)
+		{
+			const auto n = std::to_string(i % 50);
+			registry.OnJoin("nick" + n, "user" + n + "@example.com");
+			registry.OnLeave("nick" + n, "user" + n + "@example.com", i % 2 ? "renamed" + n : "");
+		}
+		done = true;
+	});
+
+	while (!done)
+	{
+		// Every snapshot is complete, keys stay valid while it is held
+		auto snapshot = registry.GetSnapshot();
+		for (const auto &nick : snapshot->_byNick)
+		{
+			auto user = snapshot->GetUser(nick.second._id);
+			ASSERT_NE(nullptr, user);
+			EXPECT_EQ(nick.first, *nick.second._nick);
+		}
+	}
+
+	writer.join();
+	EXPECT_EQ(50, registry.GetSnapshot()->_users.size());
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "stringpool.h"
+
+typedef std::uint32_t UserID;
+constexpr UserID UnknownUser = 0;
+
+/**
+ * Maps MUC nicks to jids and back. Every jid gets a small permanent id
+ *
+ * Readers never lock: they take the current immutable snapshot, writers
+ * (presence updates) are serialized, build a modified copy and publish it
+ */
+class IdentityRegistry
+{
+public:
+	class User
+	{
+	public:
+		InternedString _jid;
+		InternedString _nick; // Empty when offline
+	};
+
+	class Snapshot
+	{
+	public:
+		UserID GetUserID(const std::string &jid) const;
+		UserID GetUserIDByNick(const std::string &nick) const;
+		const User *GetUser(UserID id) const;
+
+		// Nick key points into the interned string stored next to the id
+		class NickEntry
+		{
+		public:
+			InternedString _nick;
+			UserID _id;
+		};
+
+		// Jid keys point into strings owned by _users, jid of a user never changes
+		std::unordered_map<std::string_view, UserID> _byJid;
+		std::unordered_map<std::string_view, NickEntry> _byNick;
+		std::vector<User> _users; // id - 1 is the index
+	};
+
+	IdentityRegistry();
+
+	/**
+	 * @return True if nick wasn't online before
+	 */
+	bool OnJoin(const std::string &nick, const std::string &jid);
+	void OnLeave(const std::string &nick, const std::string &jid, const std::string &newNick);
+
+	std::shared_ptr<const Snapshot> GetSnapshot() const;
+
+	UserID GetUserID(const std::string &jid) const;
+	std::string GetNickByJid(const std::string &jid) const;
+	std::string GetJidByNick(const std::string &nick) const;
+	InternedString GetInternedJidByNick(const std::string &nick) const; // Empty string if nick is unknown
+
+	/**
+	 * @brief Online users as (nick, jid) pairs
+	 */
+	std::vector<std::pair<std::string, std::string>> GetOnlineUsers() const;
+
+private:
+	UserID GetOrAddUser(Snapshot &snapshot, const std::string &jid);
+	void Publish(std::shared_ptr<const Snapshot> snapshot);
+
+	std::mutex _writeMutex;
+	std::shared_ptr<const Snapshot> _snapshot; // use atomic_load/atomic_store
+};
@@ -0,0 +1,101 @@
+#include "messagefeatures.h"
+
+#include "messagerouter.h"
+
+namespace {
+	std::string findMention(const std::string &body)
+	{
+		// "nick: text" or "nick, text"
+		const auto firstSpace = body.find(' ');
+		if (firstSpace != std::string::npos && firstSpace > 1)
+		{
+			const char last = body[firstSpace - 1];
+			if (last == ':' || last == ',')
+				return body.substr(0, firstSpace - 1);
+		}
+
+		// "@nick" anywhere, but not inside a word (mail addresses)
+		for (auto at = body.find('@'); at != std::string::npos; at = body.find('@', at + 1))
+		{
+			if (at > 0 && body[at - 1] != ' ')
+				continue;
+
+			const auto end = body.find_first_of(" ,:", at + 1);
+			if (end != at + 1 && at + 1 < body.size())
+				return body.substr(at + 1, end == std::string::npos ? std::string::npos : end - at - 1);
+		}
+
+		return "";
+	}
+}
+
+std::shared_ptr<const MessageFeatures> MessageFeatures::Extract(const std::string &body, unsigned requested)
+{
+	auto features = std::make_shared<MessageFeatures>();
+
+	if (requested & Command)
+	{
+		features->_command = MessageRouter::GetCommand(body);
+		if (!features->_command.empty())
+			features->_present |= Command;
+	}
+
+	// Every link has a scheme, skip the regex for the common case of no links at all
+	if ((requested & URLs) && body.find("http") != std::string::npos)
+	{
+		features->_urls = findURLs(body);
+		if (!features->_urls.empty())
+			features->_present |= URLs;
+	}
+
+	if (requested & Mention)
+	{
+		features->_mention = findMention(body);
+		if (!features->_mention.empty())
+			features->_present |= Mention;
+	}
+
+	if (requested & Lowercase)
+	{
+		features->_lowercaseBody = toLower(body);
+		features->_present |= Lowercase;
+	}
+
+	return features;
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+TEST(MessageFeatures, Extract)
+{
+	auto plain = MessageFeatures::Extract("Hello World");
+	EXPECT_EQ(MessageFeatures::Lowercase, plain->_present);
+	EXPECT_EQ("hello world", plain->_lowercaseBody);
+
+	auto command = MessageFeatures::Extract("!seen someone");
+	EXPECT_TRUE(command->Has(MessageFeatures::Command));
+	EXPECT_EQ("!seen", command->_command);
+
+	auto links = MessageFeatures::Extract("see http://example.com/ and https://test.com/page", MessageFeatures::URLs);
+	EXPECT_EQ(MessageFeatures::URLs, links->_present);
+	EXPECT_EQ(2, links->_urls.size());
+	EXPECT_TRUE(links->_lowercaseBody.empty());
+
+	EXPECT_FALSE(MessageFeatures::Extract("http is a protocol")->Has(MessageFeatures::URLs));
+}
+
+TEST(MessageFeatures, Mention)
+{
+	EXPECT_EQ("Alice", MessageFeatures::Extract("Alice: hi")->_mention);
+	EXPECT_EQ("Bob", MessageFeatures::Extract("Bob, hi")->_mention);
+	EXPECT_EQ("Carol", MessageFeatures::Extract("ask @Carol about it")->_mention);
+	EXPECT_EQ("Dave", MessageFeatures::Extract("@Dave")->_mention);
+
+	EXPECT_FALSE(MessageFeatures::Extract("mail me at me@example.com")->Has(MessageFeatures::Mention));
+	EXPECT_FALSE(MessageFeatures::Extract("nobody here")->Has(MessageFeatures::Mention));
+	EXPECT_FALSE(MessageFeatures::Extract("lone @ sign")->Has(MessageFeatures::Mention));
+}
+
+#endif // LCOV_EXCL_STOP
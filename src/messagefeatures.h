@@ -0,0 +1,42 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+
+#include "handlers/util/stringops.h"
+
+/**
+ * Things handlers look for in a message, computed once by the bot before
+ * dispatch instead of every handler scanning the body again
+ */
+class MessageFeatures
+{
+public:
+	enum Feature : unsigned {
+		None      = 0,
+		Command   = 1 << 0, // Starts with "!word"
+		URLs      = 1 << 1, // Contains http(s) links
+		Mention   = 1 << 2, // Addressed to someone: "nick: text", "nick, text" or "@nick"
+		Lowercase = 1 << 3, // Lower cased body is available
+	};
+
+	/**
+	 * @brief Features handlers may subscribe to, other bits only request values
+	 */
+	static constexpr unsigned TriggerMask = Command | URLs | Mention;
+
+	/**
+	 * @brief Classify message body
+	 * @param requested Features to compute, others are left empty and unset
+	 */
+	static std::shared_ptr<const MessageFeatures> Extract(const std::string &body, unsigned requested = ~0u);
+
+	bool Has(Feature feature) const { return (_present & feature) != 0; }
+
+	unsigned _present = None;
+	std::string _command;
+	std::list<URL> _urls;
+	std::string _mention;
+	std::string _lowercaseBody;
+};
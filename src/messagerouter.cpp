@@ -0,0 +1,221 @@
+#include "messagerouter.h"
+
+#include "handlers/lemonhandler.h"
+
+void MessageRouter::AddHandler(const std::shared_ptr<LemonHandler> &handler)
+{
+	_handlers.push_back(handler);
+	Rebuild();
+}
+
+void MessageRouter::Clear()
+{
+	_handlers.clear();
+	Rebuild();
+}
+
+const MessageRouter::Route &MessageRouter::GetRoute(const std::string &command, unsigned features) const
+{
+	const auto triggers = features & MessageFeatures::TriggerMask;
+	if (command.empty())
+		return _passiveRoutes[triggers];
+
+	auto route = _commandRoutes.find(command);
+	if (route == _commandRoutes.end())
+		return _passiveRoutes[triggers]; // Unknown commands are plain text for everyone
+
+	return route->second[triggers];
+}
+
+MessageRouter::Route MessageRouter::Select(const ChatMessage &msg) const
+{
+	const auto features = msg.Features();
+
+	Route result;
+	bool claimed = false;
+	for (const auto &handler : GetRoute(features->_command, features->_present))
+	{
+		if (claimed && handler->GetPassiveTraffic() != LemonHandler::PassiveTraffic::All)
+			continue;
+
+		result.push_back(handler);
+		claimed = claimed || handler->ClaimsMessage(msg);
+	}
+
+	return result;
+}
+
+const MessageRouter::Route &MessageRouter::GetHandlers() const
+{
+	return _handlers;
+}
+
+unsigned MessageRouter::GetRequestedFeatures() const
+{
+	return _requestedFeatures;
+}
+
+std::string MessageRouter::GetCommand(const std::string &body)
+{
+	if (body.empty() || body.front() != '!')
+		return "";
+
+	return body.substr(0, body.find(' '));
+}
+
+void MessageRouter::Rebuild()
+{
+	for (auto &route : _passiveRoutes)
+		route.clear();
+	_commandRoutes.clear();
+	_requestedFeatures = MessageFeatures::Command;
+
+	for (const auto &handler : _handlers)
+		for (const auto &command : handler->GetCommands())
+			_commandRoutes[command];
+
+	for (const auto &handler : _handlers)
+	{
+		_requestedFeatures |= handler->GetRequestedFeatures();
+
+		const auto traffic = handler->GetPassiveTraffic();
+		const auto triggers = handler->GetTriggers();
+		// Handler subscribes to any of its triggers
+		const auto subscribed = [triggers](unsigned features) {
+			return triggers == MessageFeatures::None || (triggers & features) != 0;
+		};
+
+		// Every combination of features a message may have
+		for (unsigned features = 0; features < _passiveRoutes.size(); features++)
+			if (traffic != LemonHandler::PassiveTraffic::None && subscribed(features))
+				_passiveRoutes[features].push_back(handler);
+
+		// Own commands regardless of triggers, commands of others if handler takes all traffic
+		for (auto &route : _commandRoutes)
+		{
+			const bool owned = handler->GetCommands().count(route.first) > 0;
+			for (unsigned features = 0; features < route.second.size(); features++)
+				if (owned || (traffic == LemonHandler::PassiveTraffic::All && subscribed(features)))
+					route.second[features].push_back(handler);
+		}
+	}
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+class RouterTestHandler : public LemonHandler
+{
+public:
+	RouterTestHandler(const std::string &name, const std::set<std::string> &commands, PassiveTraffic traffic,
+	                  unsigned triggers = MessageFeatures::None, unsigned requested = MessageFeatures::None)
+		: LemonHandler(name, nullptr)
+	{
+		RegisterCommands(commands);
+		SetPassiveTraffic(traffic, triggers);
+		RequestFeatures(requested);
+	}
+
+	ProcessingResult HandleMessage(const ChatMessage &msg) final
+	{
+		return ProcessingResult::KeepGoing;
+	}
+
+	bool ClaimsMessage(const ChatMessage &msg) const final
+	{
+		return LemonHandler::ClaimsMessage(msg) || msg.Body() == _claims;
+	}
+
+	std::string _claims;
+};
+
+static std::vector<std::string> RouteNames(const MessageRouter::Route &route)
+{
+	std::vector<std::string> names;
+	for (const auto &handler : route)
+		names.push_back(handler->GetName());
+	return names;
+}
+
+TEST(MessageRouter, GetCommand)
+{
+	EXPECT_EQ("!seen", MessageRouter::GetCommand("!seen"));
+	EXPECT_EQ("!seen", MessageRouter::GetCommand("!seen someone"));
+	EXPECT_EQ("", MessageRouter::GetCommand("hello !seen"));
+	EXPECT_EQ("", MessageRouter::GetCommand(""));
+}
+
+TEST(MessageRouter, Routes)
+{
+	using Traffic = LemonHandler::PassiveTraffic;
+
+	MessageRouter router;
+	router.AddHandler(std::make_shared<RouterTestHandler>("mirror", std::set<std::string>{"!mirror"}, Traffic::All));
+	router.AddHandler(std::make_shared<RouterTestHandler>("quotes", std::set<std::string>{"!gq", "!aq"}, Traffic::None));
+	router.AddHandler(std::make_shared<RouterTestHandler>("url", std::set<std::string>{"!url"}, Traffic::PlainText));
+
+	const auto none = MessageFeatures::None;
+	EXPECT_EQ(std::vector<std::string>({"mirror", "quotes"}), RouteNames(router.GetRoute("!gq", none)));
+	EXPECT_EQ(std::vector<std::string>({"mirror", "url"}), RouteNames(router.GetRoute("!url", none)));
+	EXPECT_EQ(std::vector<std::string>({"mirror"}), RouteNames(router.GetRoute("!mirror", none)));
+	EXPECT_EQ(std::vector<std::string>({"mirror", "url"}), RouteNames(router.GetRoute("", none)));
+	EXPECT_EQ(std::vector<std::string>({"mirror", "url"}), RouteNames(router.GetRoute("!unknown", none)));
+
+	router.Clear();
+	EXPECT_TRUE(router.GetRoute("!gq", none).empty());
+	EXPECT_TRUE(router.GetHandlers().empty());
+}
+
+TEST(MessageRouter, Features)
+{
+	using Traffic = LemonHandler::PassiveTraffic;
+	using F = MessageFeatures;
+
+	MessageRouter router;
+	router.AddHandler(std::make_shared<RouterTestHandler>("seen", std::set<std::string>{"!seen"}, Traffic::All));
+	router.AddHandler(std::make_shared<RouterTestHandler>("url", std::set<std::string>{"!url"}, Traffic::PlainText, F::URLs));
+	router.AddHandler(std::make_shared<RouterTestHandler>("phrases", std::set<std::string>{}, Traffic::PlainText, F::None, F::Lowercase));
+
+	EXPECT_EQ(unsigned(F::Command | F::URLs | F::Lowercase), router.GetRequestedFeatures());
+
+	EXPECT_EQ(std::vector<std::string>({"seen", "phrases"}), RouteNames(router.GetRoute("", F::None)));
+	EXPECT_EQ(std::vector<std::string>({"seen", "phrases"}), RouteNames(router.GetRoute("", F::Lowercase | F::Mention)));
+	EXPECT_EQ(std::vector<std::string>({"seen", "url", "phrases"}), RouteNames(router.GetRoute("", F::URLs)));
+	EXPECT_EQ(std::vector<std::string>({"seen", "url", "phrases"}), RouteNames(router.GetRoute("!unknown", F::Command | F::URLs)));
+
+	// Triggers don't hide handler's own commands
+	EXPECT_EQ(std::vector<std::string>({"seen", "url"}), RouteNames(router.GetRoute("!url", F::Command)));
+
+	// Handlers taking all traffic see commands of others with their triggers, i.e. links in "!aq http://..."
+	router.AddHandler(std::make_shared<RouterTestHandler>("log", std::set<std::string>{"!log"}, Traffic::All, F::URLs));
+	router.AddHandler(std::make_shared<RouterTestHandler>("quotes", std::set<std::string>{"!aq"}, Traffic::None));
+	EXPECT_EQ(std::vector<std::string>({"seen", "quotes"}), RouteNames(router.GetRoute("!aq", F::Command)));
+	EXPECT_EQ(std::vector<std::string>({"seen", "log", "quotes"}), RouteNames(router.GetRoute("!aq", F::Command | F::URLs)));
+	EXPECT_EQ(std::vector<std::string>({"seen", "log"}), RouteNames(router.GetRoute("!log", F::Command)));
+}
+
+TEST(MessageRouter, Select)
+{
+	using Traffic = LemonHandler::PassiveTraffic;
+
+	MessageRouter router;
+	auto dice = std::make_shared<RouterTestHandler>("dice", std::set<std::string>{}, Traffic::PlainText);
+	dice->_claims = ".1d20";
+	router.AddHandler(dice);
+	router.AddHandler(std::make_shared<RouterTestHandler>("url", std::set<std::string>{"!url"}, Traffic::PlainText));
+	router.AddHandler(std::make_shared<RouterTestHandler>("seen", std::set<std::string>{"!seen"}, Traffic::All));
+	router.AddHandler(std::make_shared<RouterTestHandler>("quotes", std::set<std::string>{"!gq"}, Traffic::PlainText));
+
+	auto select = [&router](const std::string &body) {
+		return RouteNames(router.Select(ChatMessage("nick", "", body, false)));
+	};
+
+	EXPECT_EQ(std::vector<std::string>({"dice", "url", "seen", "quotes"}), select("text"));
+	// Handlers taking all traffic still get claimed messages
+	EXPECT_EQ(std::vector<std::string>({"dice", "seen"}), select(".1d20"));
+	EXPECT_EQ(std::vector<std::string>({"url", "seen"}), select("!url x"));
+	EXPECT_EQ(std::vector<std::string>({"seen", "quotes"}), select("!gq"));
+}
+
+#endif // LCOV_EXCL_STOP
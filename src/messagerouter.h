@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "messagefeatures.h"
+
+class LemonHandler;
+class ChatMessage;
+
+/**
+ * Maps command words and message features to handlers that should see them,
+ * so a message reaches its recipients after a single lookup instead of asking
+ * every handler in turn
+ */
+class MessageRouter
+{
+public:
+	typedef std::vector<std::shared_ptr<LemonHandler>> Route;
+
+	void AddHandler(const std::shared_ptr<LemonHandler> &handler);
+	void Clear();
+
+	/**
+	 * @brief Get handlers for a command, in the order they were added
+	 * @param command Command word, empty for plain text messages
+	 * @param features MessageFeatures bits present in message, selects plain text recipients
+	 */
+	const Route &GetRoute(const std::string &command, unsigned features) const;
+	/**
+	 * @brief Handlers that get the message, decided before any of them runs
+	 * Once a handler claims the message (see LemonHandler::ClaimsMessage), only
+	 * handlers taking all traffic follow it
+	 */
+	Route Select(const ChatMessage &msg) const;
+	const Route &GetHandlers() const;
+
+	/**
+	 * @brief MessageFeatures bits to extract from every message, union of what handlers need
+	 */
+	unsigned GetRequestedFeatures() const;
+
+	/**
+	 * @brief Extract command word from message body
+	 * @return First word if message starts with "!", empty string otherwise
+	 */
+	static std::string GetCommand(const std::string &body);
+
+private:
+	void Rebuild();
+
+	// Routes by MessageFeatures::TriggerMask bits of message
+	typedef std::array<Route, MessageFeatures::TriggerMask + 1> FeatureRoutes;
+
+	Route _handlers;
+	FeatureRoutes _passiveRoutes;
+	unsigned _requestedFeatures = MessageFeatures::Command;
+	std::unordered_map<std::string, FeatureRoutes> _commandRoutes;
+};
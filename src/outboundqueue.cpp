@@ -0,0 +1,401 @@
+#include "outboundqueue.h"
+
+#include <glog/logging.h>
+
+#include "handlers/util/thread_util.h"
+
+OutboundQueue::OutboundQueue(const Options &options, Sink sink, Metrics *metrics)
+	: _options(options)
+	, _sink(std::move(sink))
+	, _metrics(metrics)
+	, _tokens(options._burst)
+	, _lastRefill(std::chrono::steady_clock::now())
+{
+	_drainThread = std::thread(&OutboundQueue::DrainThread, this);
+	nameThread(_drainThread, "Outbound queue");
+}
+
+OutboundQueue::~OutboundQueue()
+{
+	// Replies to !die and !restart are usually still here
+	Flush(_options._shutdownFlush);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+	_wakeup.notify_all();
+	_drainThread.join();
+
+	if (!_queue.empty())
+		LOG(WARNING) << _queue.size() << " outgoing messages dropped on shutdown";
+}
+
+bool OutboundQueue::Push(const ChatMessage &message)
+{
+	std::vector<std::string> parts;
+	if (_options._maxLength > 0 && message.Body().size() > _options._maxLength)
+		parts = Split(message.Body(), _options._maxLength);
+	else
+		parts.push_back(message.Body());
+
+	bool queued = true;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const auto now = std::chrono::steady_clock::now();
+
+		for (auto &part : parts)
+		{
+			auto partMessage = message.WithBody(std::move(part));
+
+			if (TryCoalesce(partMessage, now))
+				continue;
+
+			if (_queue.size() >= _options._maxQueued)
+			{
+				_dropped++;
+				if (_metrics)
+					_metrics->_outboundDropped.Increment();
+				LOG(WARNING) << "Outbound queue is full, message dropped: " << partMessage.Body();
+				queued = false;
+				continue;
+			}
+
+			_queue.push_back({std::move(partMessage), now});
+		}
+
+		if (_metrics)
+			_metrics->_outboundDepth.Set(_queue.size());
+	}
+
+	_wakeup.notify_one();
+	return queued;
+}
+
+bool OutboundQueue::Flush(std::chrono::milliseconds timeout)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_flushing++;
+	_wakeup.notify_all();
+
+	const bool flushed = _drained.wait_for(lock, timeout, [this]{ return _queue.empty() && !_sending; });
+	_flushing--;
+	return flushed;
+}
+
+std::vector<std::string> OutboundQueue::Split(const std::string &body, size_t maxLength)
+{
+	std::vector<std::string> parts;
+	std::string current;
+
+	auto flush = [&]{
+		if (!current.empty())
+			parts.push_back(std::move(current));
+		current.clear();
+	};
+
+	size_t lineStart = 0;
+	while (lineStart <= body.size())
+	{
+		auto lineEnd = body.find('\n', lineStart);
+		if (lineEnd == std::string::npos)
+			lineEnd = body.size();
+
+		std::string line = body.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd + 1;
+
+		if (!current.empty() && current.size() + 1 + line.size() <= maxLength)
+		{
+			current += "\n" + line;
+			continue;
+		}
+
+		flush();
+
+		// Line alone doesn't fit, cut it without breaking UTF-8 sequences
+		while (line.size() > maxLength)
+		{
+			size_t cut = maxLength;
+			while (cut > 0 && (static_cast<unsigned char>(line[cut]) & 0xC0) == 0x80)
+				cut--;
+			if (cut == 0)
+				cut = maxLength;
+
+			parts.push_back(line.substr(0, cut));
+			line.erase(0, cut);
+		}
+
+		current = std::move(line);
+	}
+
+	flush();
+	return parts;
+}
+
+// Must be called with _mutex held
+bool OutboundQueue::TryCoalesce(const ChatMessage &message, std::chrono::steady_clock::time_point now)
+{
+	if (_options._coalesceWindow.count() == 0 || _queue.empty())
+		return false;
+
+	// Only the tail may grow, so ordering is preserved
+	auto &tail = _queue.back();
+	if (tail._enqueued + _options._coalesceWindow < now)
+		return false;
+
+	const bool sameDestination =
+			(tail._message.GetOrigin() == ChatMessage::Origin::Discord) == (message.GetOrigin() == ChatMessage::Origin::Discord)
+			&& tail._message.DiscordChannel() == message.DiscordChannel();
+	if (!sameDestination)
+		return false;
+
+	if (_options._maxLength > 0 && tail._message.Body().size() + 1 + message.Body().size() > _options._maxLength)
+		return false;
+
+	tail._message = tail._message.WithBody(tail._message.Body() + "\n" + message.Body());
+	_coalesced++;
+	return true;
+}
+
+OutboundQueue::Stats OutboundQueue::GetStats() const
+{
+	using namespace std::chrono;
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	Stats stats;
+	stats._depth = _queue.size();
+	stats._sent = _sent;
+	stats._dropped = _dropped;
+	stats._coalesced = _coalesced;
+	if (_sent > 0)
+		stats._averageLatency = duration_cast<microseconds>(_totalLatency / _sent);
+	stats._maxLatency = duration_cast<microseconds>(_maxLatency);
+	return stats;
+}
+
+// Must be called with _mutex held
+void OutboundQueue::RefillTokens(std::chrono::steady_clock::time_point now)
+{
+	std::chrono::duration<double> elapsed = now - _lastRefill;
+	_tokens = std::min<double>(_options._burst, _tokens + elapsed.count() * _options._ratePerMinute / 60.0);
+	_lastRefill = now;
+}
+
+void OutboundQueue::DrainThread()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_wakeup.wait(lock, [this]{ return !_running || !_queue.empty(); });
+		if (!_running)
+			return;
+
+		RefillTokens(std::chrono::steady_clock::now());
+		if (_tokens < 1)
+		{
+			std::chrono::duration<double> untilNextToken((1 - _tokens) * 60.0 / std::max<size_t>(_options._ratePerMinute, 1));
+			_wakeup.wait_for(lock, untilNextToken, [this]{ return !_running; });
+			continue;
+		}
+
+		// Give following messages a chance to join this one
+		const auto lingerUntil = _queue.front()._enqueued + _options._coalesceWindow;
+		if (_flushing == 0 && std::chrono::steady_clock::now() < lingerUntil)
+		{
+			_wakeup.wait_until(lock, lingerUntil, [this]{ return !_running || _flushing > 0; });
+			continue;
+		}
+
+		_tokens -= 1;
+		auto entry = std::move(_queue.front());
+		_queue.pop_front();
+		if (_metrics)
+			_metrics->_outboundDepth.Set(_queue.size());
+
+		_sending = true;
+		lock.unlock();
+		try {
+			_sink(entry._message);
+		} catch (std::exception &e) {
+			LOG(ERROR) << "Failed to send message: " << e.what();
+		}
+		lock.lock();
+		_sending = false;
+		if (_queue.empty())
+			_drained.notify_all();
+
+		auto latency = std::chrono::steady_clock::now() - entry._enqueued;
+		_sent++;
+		_totalLatency += latency;
+		_maxLatency = std::max(_maxLatency, latency);
+		if (_metrics)
+		{
+			_metrics->_outboundSent.Increment();
+			_metrics->_outboundLatency.Record(latency);
+		}
+	}
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+static bool WaitForSent(const OutboundQueue &queue, std::uint64_t count)
+{
+	for (int i = 0; i < 2000; i++)
+	{
+		if (queue.GetStats()._sent >= count)
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return false;
+}
+
+TEST(OutboundQueue, TokenBucket)
+{
+	std::mutex sentMutex;
+	std::vector<std::string> sent;
+
+	OutboundQueue::Options options;
+	options._burst = 2;
+	options._ratePerMinute = 600; // one message per 100ms
+
+	OutboundQueue queue(options, [&](const ChatMessage &message) {
+		std::lock_guard<std::mutex> lock(sentMutex);
+		sent.push_back(message.Body());
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 4; i++)
+		EXPECT_TRUE(queue.Push(ChatMessage("", "", std::to_string(i), false)));
+
+	ASSERT_TRUE(WaitForSent(queue, 2));
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+
+	ASSERT_TRUE(WaitForSent(queue, 4));
+	EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(150));
+
+	std::lock_guard<std::mutex> lock(sentMutex);
+	EXPECT_EQ(std::vector<std::string>({"0", "1", "2", "3"}), sent);
+	EXPECT_EQ(0, queue.GetStats()._depth);
+	EXPECT_EQ(0, queue.GetStats()._dropped);
+}
+
+TEST(OutboundQueue, Metrics)
+{
+	Metrics metrics;
+	OutboundQueue::Options options;
+	options._burst = 1;
+	options._ratePerMinute = 1;
+	options._maxQueued = 1;
+	options._shutdownFlush = std::chrono::milliseconds(0);
+
+	OutboundQueue queue(options, [](const ChatMessage &) {}, &metrics);
+
+	queue.Push(ChatMessage("", "", "first", false));
+	ASSERT_TRUE(WaitForSent(queue, 1));
+	queue.Push(ChatMessage("", "", "second", false));
+	queue.Push(ChatMessage("", "", "third", false));
+
+	EXPECT_EQ(1, metrics._outboundSent.Get());
+	EXPECT_EQ(1, metrics._outboundLatency.GetCount());
+	EXPECT_EQ(1, metrics._outboundDropped.Get());
+	EXPECT_EQ(1, metrics._outboundDepth.Get());
+}
+
+TEST(OutboundQueue, Overflow)
+{
+	OutboundQueue::Options options;
+	options._burst = 1;
+	options._ratePerMinute = 1;
+	options._maxQueued = 2;
+	options._shutdownFlush = std::chrono::milliseconds(0);
+
+	OutboundQueue queue(options, [](const ChatMessage &) {});
+
+	ASSERT_TRUE(queue.Push(ChatMessage("", "", "first", false)));
+	ASSERT_TRUE(WaitForSent(queue, 1));
+
+	EXPECT_TRUE(queue.Push(ChatMessage("", "", "second", false)));
+	EXPECT_TRUE(queue.Push(ChatMessage("", "", "third", false)));
+	EXPECT_FALSE(queue.Push(ChatMessage("", "", "fourth", false)));
+
+	auto stats = queue.GetStats();
+	EXPECT_EQ(2, stats._depth);
+	EXPECT_EQ(1, stats._dropped);
+	EXPECT_EQ(1, stats._sent);
+}
+
+TEST(OutboundQueue, Coalesce)
+{
+	std::mutex sentMutex;
+	std::vector<std::string> sent;
+
+	OutboundQueue::Options options;
+	options._coalesceWindow = std::chrono::milliseconds(200);
+	options._maxLength = 12;
+
+	OutboundQueue queue(options, [&](const ChatMessage &message) {
+		std::lock_guard<std::mutex> lock(sentMutex);
+		sent.push_back(message.Body());
+	});
+
+	auto discord = ChatMessage("", "", "three", false).WithOrigin(ChatMessage::Origin::Discord);
+
+	queue.Push(ChatMessage("", "", "one", false));
+	queue.Push(ChatMessage("", "", "two", false));
+	queue.Push(discord);                                // other destination
+	queue.Push(ChatMessage("", "", "four", false));     // can't jump over "three"
+	queue.Push(ChatMessage("", "", "five", false));
+	queue.Push(ChatMessage("", "", "sixsix", false));   // doesn't fit
+
+	ASSERT_TRUE(WaitForSent(queue, 4));
+
+	std::lock_guard<std::mutex> lock(sentMutex);
+	EXPECT_EQ(std::vector<std::string>({"one\ntwo", "three", "four\nfive", "sixsix"}), sent);
+	EXPECT_EQ(2, queue.GetStats()._coalesced);
+}
+
+TEST(OutboundQueue, FlushOnShutdown)
+{
+	std::mutex sentMutex;
+	std::vector<std::string> sent;
+
+	OutboundQueue::Options options;
+	options._burst = 1;
+	options._ratePerMinute = 600; // one message per 100ms
+	options._coalesceWindow = std::chrono::milliseconds(10000);
+	options._maxLength = 1;
+	options._shutdownFlush = std::chrono::milliseconds(250);
+
+	{
+		OutboundQueue queue(options, [&](const ChatMessage &message) {
+			std::lock_guard<std::mutex> lock(sentMutex);
+			sent.push_back(message.Body());
+		});
+
+		// Rate limit lets three of them out before deadline, coalescing window is not waited for
+		for (int i = 0; i < 5; i++)
+			queue.Push(ChatMessage("", "", std::to_string(i), false));
+	}
+
+	EXPECT_EQ(std::vector<std::string>({"0", "1", "2"}), sent);
+}
+
+TEST(OutboundQueue, Split)
+{
+	EXPECT_EQ(std::vector<std::string>({"short"}), OutboundQueue::Split("short", 10));
+	EXPECT_EQ(std::vector<std::string>({"line1\nline2", "line3"}), OutboundQueue::Split("line1\nline2\nline3", 11));
+	EXPECT_EQ(std::vector<std::string>({"abcd", "efgh", "ij\nk"}), OutboundQueue::Split("abcdefghij\nk", 4));
+
+	// Blank lines on part boundaries are not sent as empty messages
+	EXPECT_EQ(std::vector<std::string>({"a", "b"}), OutboundQueue::Split("a\n\n\nb", 1));
+
+	// Multibyte characters are never cut in half
+	EXPECT_EQ(std::vector<std::string>({"\xD0\xB0", "\xD0\xB1"}), OutboundQueue::Split("\xD0\xB0\xD0\xB1", 3));
+}
+
+#endif // LCOV_EXCL_STOP
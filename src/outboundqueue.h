@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chatmessage.h"
+#include "handlers/util/metrics.h"
+
+/**
+ * Outgoing message queue, drained by its own thread at a rate limited by a
+ * token bucket. Senders never block
+ *
+ * Optionally holds each message for a short window, appending following
+ * messages for the same destination to it, and splits long bodies on line
+ * boundaries
+ */
+class OutboundQueue
+{
+public:
+	typedef std::function<void(const ChatMessage &message)> Sink;
+
+	class Options
+	{
+	public:
+		size_t _burst = 3;              // messages that can be sent back to back
+		size_t _ratePerMinute = 60;     // sustained rate
+		size_t _maxQueued = 100;        // messages beyond this are dropped
+		std::chrono::milliseconds _coalesceWindow{0}; // 0 disables coalescing
+		size_t _maxLength = 0;          // body length limit in bytes, 0 for unlimited
+		std::chrono::milliseconds _shutdownFlush{3000}; // pending messages are still sent this long on shutdown
+	};
+
+	/**
+	 * @param metrics If set, queue depth, counters and latency are mirrored there
+	 */
+	OutboundQueue(const Options &options, Sink sink, Metrics *metrics = nullptr);
+	~OutboundQueue();
+
+	/**
+	 * @brief Enqueue message for sending
+	 * @return False if queue is full and message (or its part) was dropped
+	 */
+	bool Push(const ChatMessage &message);
+
+	/**
+	 * @brief Send pending messages as fast as rate limit allows, without waiting for coalescing
+	 * @return False if some were left after timeout
+	 */
+	bool Flush(std::chrono::milliseconds timeout);
+
+	/**
+	 * @brief Split body into parts no longer than maxLength, preferably on line boundaries
+	 */
+	static std::vector<std::string> Split(const std::string &body, size_t maxLength);
+
+	class Stats
+	{
+	public:
+		size_t _depth = 0;
+		std::uint64_t _sent = 0;
+		std::uint64_t _dropped = 0;
+		std::uint64_t _coalesced = 0;
+		std::chrono::microseconds _averageLatency{0};
+		std::chrono::microseconds _maxLatency{0};
+	};
+
+	Stats GetStats() const;
+
+private:
+	class Entry
+	{
+	public:
+		ChatMessage _message;
+		std::chrono::steady_clock::time_point _enqueued;
+	};
+
+	void DrainThread();
+	void RefillTokens(std::chrono::steady_clock::time_point now);
+	bool TryCoalesce(const ChatMessage &message, std::chrono::steady_clock::time_point now);
+
+	const Options _options;
+	const Sink _sink;
+	Metrics *const _metrics;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::condition_variable _drained;
+	std::deque<Entry> _queue;
+	bool _running = true;
+	bool _sending = false;
+	size_t _flushing = 0;
+
+	double _tokens = 0;
+	std::chrono::steady_clock::time_point _lastRefill;
+
+	std::uint64_t _sent = 0;
+	std::uint64_t _dropped = 0;
+	std::uint64_t _coalesced = 0;
+	std::chrono::steady_clock::duration _totalLatency{0};
+	std::chrono::steady_clock::duration _maxLatency{0};
+
+	std::thread _drainThread;
+};
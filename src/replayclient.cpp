@@ -0,0 +1,200 @@
+#include "replayclient.h"
+#include "xmpphandler.h"
+
+#include <fstream>
+
+#include <json/reader.h>
+#include <json/value.h>
+
+#include <glog/logging.h>
+
+ReplayClient::ReplayClient(std::vector<ReplayEvent> events, size_t repeat)
+	: _events(std::move(events))
+	, _repeat(repeat)
+{
+
+}
+
+std::optional<ReplayEvent> ReplayClient::ParseEvent(const std::string &line)
+{
+	Json::Value root;
+	Json::Reader reader;
+	if (!reader.parse(line, root) || !root.isObject())
+		return {};
+
+	ReplayEvent event;
+	const auto type = root.get("type", "message").asString();
+	if (type == "message")
+		event._type = ReplayEvent::Type::Message;
+	else if (type == "presence")
+		event._type = ReplayEvent::Type::Presence;
+	else
+		return {};
+
+	event._nick = root.get("nick", "").asString();
+	event._jid = root.get("jid", "").asString();
+	event._body = root.get("body", "").asString();
+	event._isPrivate = root.get("private", false).asBool();
+	event._online = root.get("online", true).asBool();
+	event._newNick = root.get("newNick", event._online ? event._nick : "").asString();
+	return event;
+}
+
+std::optional<std::vector<ReplayEvent>> ReplayClient::LoadLog(const std::string &path)
+{
+	std::ifstream log(path);
+	if (!log)
+	{
+		LOG(ERROR) << "Can't open replay log " << path;
+		return {};
+	}
+
+	std::vector<ReplayEvent> events;
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(log, line))
+	{
+		lineNumber++;
+		if (line.empty())
+			continue;
+
+		auto event = ParseEvent(line);
+		if (!event)
+		{
+			LOG(WARNING) << path << ":" << lineNumber << ": skipping malformed event";
+			continue;
+		}
+
+		events.push_back(std::move(*event));
+	}
+
+	return events;
+}
+
+void ReplayClient::SetXMPPHandler(XMPPHandler *handler)
+{
+	_handler = handler;
+}
+
+bool ReplayClient::Connect(const std::string &jid, const std::string &password)
+{
+	_connected = true;
+	_handler->OnConnect();
+
+	_replayStart = std::chrono::steady_clock::now();
+	for (size_t pass = 0; pass < _repeat && _connected; pass++)
+	{
+		for (const auto &event : _events)
+		{
+			if (!_connected)
+				break;
+
+			if (event._type == ReplayEvent::Type::Presence)
+			{
+				_handler->OnPresence(event._nick, event._jid, event._online, event._newNick);
+			} else {
+				_handler->OnMessage(ChatMessage(event._nick, event._jid, event._body, event._isPrivate)
+									.WithOrigin(ChatMessage::Origin::XMPP));
+			}
+
+			_eventsReplayed++;
+		}
+	}
+
+	_connected = false;
+	return true;
+}
+
+bool ReplayClient::Disconnect()
+{
+	_connected = false;
+	return true;
+}
+
+bool ReplayClient::JoinRoom(const std::string &jid)
+{
+	return true;
+}
+
+void ReplayClient::SendMessage(const std::string &message, const std::string &recipient)
+{
+	_messagesSent++;
+}
+
+size_t ReplayClient::GetEventsReplayed() const
+{
+	return _eventsReplayed;
+}
+
+size_t ReplayClient::GetMessagesSent() const
+{
+	return _messagesSent;
+}
+
+std::chrono::steady_clock::time_point ReplayClient::GetReplayStart() const
+{
+	return _replayStart;
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+class ReplayTestHandler : public XMPPHandler
+{
+public:
+	void OnConnect() final { _connected = true; }
+	void OnMessage(const ChatMessage &msg) final { _log.push_back(msg.Nick() + ": " + msg.Body()); }
+	void OnPresence(const std::string &nick, const std::string &jid, bool online, const std::string &newNick) final
+	{
+		_log.push_back(nick + (online ? " joined as " + newNick : " left"));
+	}
+
+	bool _connected = false;
+	std::vector<std::string> _log;
+};
+
+TEST(ReplayClient, ParseEvent)
+{
+	auto message = ReplayClient::ParseEvent(R"({"type": "message", "nick": "n", "jid": "j@x", "body": "hi", "private": true})");
+	ASSERT_TRUE(message);
+	EXPECT_EQ(ReplayEvent::Type::Message, message->_type);
+	EXPECT_EQ("n", message->_nick);
+	EXPECT_EQ("j@x", message->_jid);
+	EXPECT_EQ("hi", message->_body);
+	EXPECT_TRUE(message->_isPrivate);
+
+	auto join = ReplayClient::ParseEvent(R"({"type": "presence", "nick": "n", "jid": "j@x"})");
+	ASSERT_TRUE(join);
+	EXPECT_EQ(ReplayEvent::Type::Presence, join->_type);
+	EXPECT_TRUE(join->_online);
+	EXPECT_EQ("n", join->_newNick);
+
+	auto leave = ReplayClient::ParseEvent(R"({"type": "presence", "nick": "n", "online": false})");
+	ASSERT_TRUE(leave);
+	EXPECT_FALSE(leave->_online);
+	EXPECT_TRUE(leave->_newNick.empty());
+
+	EXPECT_FALSE(ReplayClient::ParseEvent("not json"));
+	EXPECT_FALSE(ReplayClient::ParseEvent(R"({"type": "unknown"})"));
+}
+
+TEST(ReplayClient, Replay)
+{
+	std::vector<ReplayEvent> events(2);
+	events[0]._type = ReplayEvent::Type::Presence;
+	events[0]._nick = events[0]._newNick = "n";
+	events[1]._nick = "n";
+	events[1]._body = "hello";
+
+	ReplayTestHandler handler;
+	ReplayClient client(events, 2);
+	client.SetXMPPHandler(&handler);
+	EXPECT_TRUE(client.Connect("", ""));
+
+	EXPECT_TRUE(handler._connected);
+	EXPECT_EQ(4, client.GetEventsReplayed());
+	EXPECT_EQ(std::vector<std::string>({"n joined as n", "n: hello", "n joined as n", "n: hello"}), handler._log);
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "xmppclient.h"
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+class XMPPHandler;
+
+class ReplayEvent
+{
+public:
+	enum class Type
+	{
+		Message,
+		Presence,
+	};
+
+	Type _type = Type::Message;
+	std::string _nick;
+	std::string _jid;
+	std::string _body;
+	bool _isPrivate = false;
+	bool _online = true;
+	std::string _newNick;
+};
+
+/**
+ * Feeds a recorded chat log to the bot as fast as it can take it.
+ * Log is JSONL, one event per line:
+ * {"type": "message", "nick": "...", "jid": "...", "body": "...", "private": false}
+ * {"type": "presence", "nick": "...", "jid": "...", "online": true, "newNick": "..."}
+ */
+class ReplayClient
+		: public XMPPClient
+{
+public:
+	explicit ReplayClient(std::vector<ReplayEvent> events, size_t repeat = 1);
+
+	static std::optional<ReplayEvent> ParseEvent(const std::string &line);
+	static std::optional<std::vector<ReplayEvent>> LoadLog(const std::string &path);
+
+	// XMPPClient interface
+	void SetXMPPHandler(XMPPHandler *handler) override;
+	bool Connect(const std::string &jid, const std::string &password) override;
+	bool Disconnect() override;
+	bool JoinRoom(const std::string &jid) override;
+	void SendMessage(const std::string &message, const std::string &recipient) override;
+
+	size_t GetEventsReplayed() const;
+	size_t GetMessagesSent() const;
+	std::chrono::steady_clock::time_point GetReplayStart() const;
+
+private:
+	XMPPHandler *_handler = nullptr;
+
+	const std::vector<ReplayEvent> _events;
+	const size_t _repeat;
+
+	std::atomic<bool> _connected{false};
+	size_t _eventsReplayed = 0;
+	std::atomic<size_t> _messagesSent{0};
+	std::chrono::steady_clock::time_point _replayStart;
+};
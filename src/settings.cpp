@@ -92,7 +92,17 @@ std::shared_ptr<cpptoml::table> Settings::GetTable(const std::string &name) cons
 
 std::string Settings::GetRawString(const std::string &name) const
 {
-	return _config->get_qualified_as<std::string>(name).value_or("");
+	if (auto value = _config->get_qualified_as<std::string>(name))
+		return *value;
+
+	// Numeric settings are handed out as strings too, callers use from_string
+	if (auto value = _config->get_qualified_as<std::int64_t>(name))
+		return std::to_string(*value);
+
+	if (auto value = _config->get_qualified_as<bool>(name))
+		return *value ? "true" : "false";
+
+	return "";
 }
 
 std::set<std::string> Settings::GetStringSet(const std::string &name) const
@@ -128,6 +138,8 @@ TEST(Settings, Read)
 	EXPECT_EQ("muc_value", test.GetMUC());
 
 	EXPECT_EQ("StringValue", test.GetRawString("TestGroup.StringName"));
+	EXPECT_EQ("42", test.GetRawString("TestGroup.IntName"));
+	EXPECT_EQ("false", test.GetRawString("TestGroup.BoolName"));
 	auto stringSet = test.GetStringSet("TestGroup.StringSetName");
 
 	EXPECT_EQ(2, stringSet.size());
@@ -0,0 +1,65 @@
+#include "stringpool.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace
+{
+	class StringPool
+	{
+	public:
+		InternedString Intern(const std::string &value)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			auto &entry = _strings[value];
+			if (auto existing = entry.lock())
+				return existing;
+
+			auto interned = std::make_shared<const std::string>(value);
+			entry = interned;
+
+			// Forget strings nobody refers to anymore
+			if (++_internedSinceCleanup > _strings.size())
+			{
+				for (auto it = _strings.begin(); it != _strings.end(); )
+					it = it->second.expired() ? _strings.erase(it) : std::next(it);
+				_internedSinceCleanup = 0;
+			}
+
+			return interned;
+		}
+
+	private:
+		std::mutex _mutex;
+		std::unordered_map<std::string, std::weak_ptr<const std::string>> _strings;
+		size_t _internedSinceCleanup = 0;
+	};
+}
+
+InternedString internString(const std::string &value)
+{
+	static const InternedString empty = std::make_shared<const std::string>();
+	if (value.empty())
+		return empty;
+
+	static StringPool pool;
+	return pool.Intern(value);
+}
+
+#ifdef _BUILD_TESTS // LCOV_EXCL_START
+
+#include <gtest/gtest.h>
+
+TEST(StringPool, Intern)
+{
+	auto first = internString("value");
+	auto second = internString(std::string("val") + "ue");
+	EXPECT_EQ(first.get(), second.get());
+	EXPECT_EQ("value", *first);
+
+	EXPECT_NE(first.get(), internString("other").get());
+	EXPECT_EQ(internString("").get(), internString("").get());
+}
+
+#endif // LCOV_EXCL_STOP
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+typedef std::shared_ptr<const std::string> InternedString;
+
+/**
+ * @brief Get shared copy of the string, equal strings share one buffer while in use
+ * Thread-safe
+ */
+InternedString internString(const std::string &value);